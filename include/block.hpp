@@ -15,6 +15,22 @@
 #include <deque>
 #include <mutex>
 #include <cstring>
+#include <atomic>
+#include <coroutine>
+#include <type_traits>
+#include <condition_variable>
+#include <set>
+#include <streambuf>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <tbb/task_arena.h>
+
+#include "block_stats.hpp"
+#include "slab.hpp"
+#include "trace.hpp"
 
 
 using std::istream;
@@ -50,8 +66,33 @@ POD_FIXED_READ_WRITER_SPECIALIZATION(float)
 POD_FIXED_READ_WRITER_SPECIALIZATION(char)
 POD_FIXED_READ_WRITER_SPECIALIZATION(bool)
 
+/* Blocks whose bytes in memory are exactly their bytes on disk opt in through
+   is_fixed_layout and are read and written with one call, straight into the
+   block, whatever their structure.  They must be trivially copyable, the
+   layout is the in-memory one in native byte order.  tensor_io.hpp opts in
+   Tensor, PackedTensor and GRElement. */
+template<typename T>
+struct is_fixed_layout : std::false_type {};
+
+template<typename T>
+concept fixed_layout = is_fixed_layout<T>::value;
+
+template<fixed_layout T>
+struct FixedReadWriter<T> {
+    static_assert(std::is_trivially_copyable_v<T>, "a fixed layout block must be trivially copyable");
+    typedef T data_type;
+    void read(istream & is, T & data) {
+        is.read(reinterpret_cast<char *>(&data), sizeof(T));
+    }
+    void write(ostream & os, T const & data) {
+        os.write(reinterpret_cast<const char *>(&data), sizeof(T));
+    }
+};
+
+// arrays of numbers or of fixed layout blocks, all elements in one call
 template<typename T, size_t N>
-struct FixedReadWriter<std::array<T,N>> : public std::enable_if_t<std::is_arithmetic<T>::value> {
+    requires (std::is_arithmetic_v<T> || fixed_layout<T>)
+struct FixedReadWriter<std::array<T,N>> {
     typedef std::array<T,N> data_type;
     void read(istream & is, std::array<T,N> & data) {
         is.read(reinterpret_cast<char *>(&data[0]), sizeof(T) * N);
@@ -67,18 +108,35 @@ struct FixedReadWriter<std::array<T,N>> : public std::enable_if_t<std::is_arithm
 template<typename Key, typename Block>
 class BlockStorage {
 public:
-    /* ScopedWrapper is a cursor that will save when destroyed */
+    /* ScopedWrapper is a cursor that will save when destroyed, if the block
+       was handed out for writing through operator* or operator->.  value()
+       reads it without that, so releasing a block that was only read writes
+       nothing back */
     class ScopedWrapper;
 
+    /* AsyncGet is the awaitable returned by async_get.  A cache hit completes
+       without suspending, a miss suspends the coroutine and resumes it on a
+       worker of the task arena once the block has been read from disk.  The
+       read itself runs outside the storage lock, so misses on different keys
+       read in parallel */
+    class AsyncGet;
+
     ScopedWrapper get(Key const &key);
     ScopedWrapper operator[](Key const &key) { return get(key); }
+    AsyncGet async_get(Key const &key, tbb::task_arena & arena);
     void save_one(Key const &key);
 
     size_t cache_hits();
     size_t cache_misses();
 
+    // a consistent enough view of the counters that never takes the storage lock
+    BlockStorageStats::Snapshot stats() const { return stats_.snapshot(); }
+    void write_stats(std::string const & path, StatsFormat format = StatsFormat::json) const { stats().write(path, format); }
 
-    BlockStorage(std::string const & path, size_t maximum_loaded_blocks = 1);
+
+    // resident blocks live in a slab sized to maximum_loaded_blocks, which can
+    // be backed by huge pages where the OS provides them
+    BlockStorage(std::string const & path, size_t maximum_loaded_blocks = 1, bool huge_pages = false);
     BlockStorage(BlockStorage<Key, Block> const &) = delete;
     BlockStorage(BlockStorage<Key, Block> &&) noexcept;
     ~BlockStorage();
@@ -87,6 +145,9 @@ public:
 
 private:
 
+    std::shared_ptr<Block> get_block(Key const & key);
+    bool try_get_loaded(Key const & key, std::shared_ptr<Block> & block);
+    void save_block(Key const & key, Block const & block, bool modified);
     void remove_one_from_mem();
     void increase_storage(size_t);
     std::shared_ptr<Block> grow_index(Key const & key);
@@ -106,6 +167,8 @@ private:
     void seekg_to_index_size();
 
     bool read_block(Key const & key, Block & block);
+    void read_block_unlocked(size_t index, Block & block);
+    void wait_until_loaded(std::unique_lock<std::mutex> & guard, Key const & key);
     void update_file_size();
     void write_footer();
     void read_footer();
@@ -114,10 +177,12 @@ private:
     size_t next_block_index_;
 
     std::map<Key,std::shared_ptr<Block>> loaded_;
+    std::shared_ptr<BlockSlab<Block>> slab_;
     
     std::deque<Key> keys_;
     size_t maximum_loaded_blocks_; // how many blocks to have loaded in memory at a time
     std::fstream block_file_;
+    int read_fd_; // read only descriptor for positional reads outside the lock
     std::string path_;
 
     size_t index_size_; // block_file_[N - index_size_, N) will contain the index
@@ -137,12 +202,18 @@ private:
     FixedReadWriter<Block> blocker_;
     FixedReadWriter<Key> keyer_;
 
+    BlockStorageStats stats_;
+
+    std::set<Key> loading_; // misses being read from disk outside the lock
+    std::condition_variable loaded_cv_; // signalled when a key leaves loading_
+
     std::mutex mutex_;
 };
 
 template<typename Key, typename Block>
 class BlockStorage<Key,Block>::ScopedWrapper {
     friend class BlockStorage<Key, Block>;
+    friend class BlockStorage<Key, Block>::AsyncGet;
 public:
     ~ScopedWrapper();
     ScopedWrapper(ScopedWrapper const &);
@@ -154,17 +225,112 @@ public:
 
     Block & operator*() const;
     std::shared_ptr<Block> operator->() const;
+    Block const & value() const;
 private:
     ScopedWrapper(BlockStorage<Key, Block> * storage, std::shared_ptr<Block> block, Key const & key);
     BlockStorage<Key, Block> * storage_;
     std::shared_ptr<Block> block_;
     Key key_;
+    mutable bool modified_; // handed out for writing since the last save
+};
+
+template<typename Key, typename Block>
+class BlockStorage<Key,Block>::AsyncGet {
+    friend class BlockStorage<Key, Block>;
+public:
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> handle);
+    ScopedWrapper await_resume();
+private:
+    AsyncGet(BlockStorage<Key, Block> * storage, Key const & key, tbb::task_arena & arena);
+    BlockStorage<Key, Block> * storage_;
+    Key key_;
+    tbb::task_arena * arena_;
+    std::shared_ptr<Block> block_;
+    std::exception_ptr error_;
+};
+
+/* BlockTask is an eagerly started coroutine for code that co_awaits
+   BlockStorage::async_get.  wait() blocks until the body has run to the end
+   and rethrows anything it threw. */
+class BlockTask {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    BlockTask(BlockTask const &) = delete;
+    BlockTask(BlockTask && other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+    ~BlockTask();
+
+    bool done() const;
+    void wait() const;
+private:
+    // the completion flag lives outside of the coroutine frame so that the
+    // thread finishing the coroutine can still signal it after wait() has
+    // returned and the frame has been destroyed
+    struct state {
+        std::atomic<bool> done{false};
+        std::exception_ptr error;
+    };
+    struct final_awaiter;
+
+    explicit BlockTask(handle_type handle) : handle_(handle) {}
+    handle_type handle_;
+};
+
+struct BlockTask::final_awaiter {
+    bool await_ready() noexcept { return false; }
+    void await_suspend(handle_type handle) noexcept;
+    void await_resume() noexcept {}
 };
 
+struct BlockTask::promise_type {
+    std::shared_ptr<state> state_ = std::make_shared<state>();
+
+    BlockTask get_return_object() { return BlockTask(handle_type::from_promise(*this)); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { state_->error = std::current_exception(); }
+};
+
+inline void BlockTask::final_awaiter::await_suspend(handle_type handle) noexcept
+{
+    auto s = handle.promise().state_;
+    s->done.store(true, std::memory_order_release);
+    s->done.notify_all();
+}
+
+inline bool BlockTask::done() const
+{
+    return !handle_ || handle_.promise().state_->done.load(std::memory_order_acquire);
+}
+
+inline void BlockTask::wait() const
+{
+    if(!handle_) return;
+
+    auto s = handle_.promise().state_;
+    s->done.wait(false, std::memory_order_acquire);
+    if(s->error) {
+        std::rethrow_exception(s->error);
+    }
+}
+
+inline BlockTask::~BlockTask()
+{
+    if(!handle_) return;
+
+    // never destroy a frame that another thread may still be running
+    handle_.promise().state_->done.wait(false, std::memory_order_acquire);
+    handle_.destroy();
+}
+
 
 template<typename Key, typename Block>
-BlockStorage<Key,Block>::BlockStorage(std::string const & path, size_t maximum_loaded_blocks)
-    : next_block_index_(0), maximum_loaded_blocks_(maximum_loaded_blocks), path_(path), index_size_(0), data_size_(0), file_size_(0),
+BlockStorage<Key,Block>::BlockStorage(std::string const & path, size_t maximum_loaded_blocks, bool huge_pages)
+    : next_block_index_(0), slab_(BlockSlab<Block>::create(maximum_loaded_blocks, huge_pages)),
+      maximum_loaded_blocks_(maximum_loaded_blocks), read_fd_(-1), path_(path), index_size_(0), data_size_(0), file_size_(0),
       cache_hit_(0), cache_miss_(0), block_size_(0), key_size_(0), footer_size_(sizeof(data_size_) + sizeof(index_size_))
 { 
     open_file();
@@ -173,13 +339,15 @@ BlockStorage<Key,Block>::BlockStorage(std::string const & path, size_t maximum_l
 template<typename Key, typename Block>
 BlockStorage<Key,Block>::BlockStorage(BlockStorage<Key,Block> && other) noexcept
     : index_(std::move(other.index_)), next_block_index_(other.next_block_index_),
-      loaded_(std::move(other.loaded_)), 
-      keys_(std::move(other.keys_)), maximum_loaded_blocks_(other.maximum_loaded_blocks_), block_file_(std::move(other.block_file_)), path_(std::move(other.path_)),
+      loaded_(std::move(other.loaded_)), slab_(std::move(other.slab_)),
+      keys_(std::move(other.keys_)), maximum_loaded_blocks_(other.maximum_loaded_blocks_), block_file_(std::move(other.block_file_)), read_fd_(other.read_fd_), path_(std::move(other.path_)),
       index_size_(other.index_size_), data_size_(other.data_size_), file_size_(other.file_size_),
       cache_hit_(other.cache_hit_), cache_miss_(other.cache_miss_), block_size_(other.block_size_), key_size_(other.key_size_), footer_size_(other.footer_size_),
       blocker_(std::move(other.blocker_)), keyer_(std::move(other.keyer_)),
-      mutex_()
-{ }
+      stats_(other.stats_), loading_(std::move(other.loading_)), loaded_cv_(), mutex_()
+{
+    other.read_fd_ = -1;
+}
 
 
 template<typename Key, typename Block>
@@ -213,6 +381,45 @@ bool BlockStorage<Key, Block>::read_block(Key const & key, Block & block)
     return true;
 }
 
+/* reads the block at index with a positional read on read_fd_, which touches
+   no shared state and so runs without the lock.  The caller flushes
+   block_file_ first and keeps the key in loading_ so no save races it. */
+template<typename Key, typename Block>
+void BlockStorage<Key, Block>::read_block_unlocked(size_t index, Block & block)
+{
+    // an istream over bytes already in memory
+    struct MemoryBuffer : std::streambuf {
+        MemoryBuffer(char * p, size_t n) { setg(p, p, p + n); }
+    };
+
+    thread_local std::vector<char> buffer;
+    buffer.resize(block_size_);
+
+    auto offset = std::streamoff(data_streampos_) + std::streamoff(index * block_size_);
+    size_t done = 0;
+    while(done < block_size_) {
+        auto n = ::pread(read_fd_, buffer.data() + done, block_size_ - done, off_t(offset + done));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) {
+            std::stringstream ss;
+            ss << "error reading block: " << path_ << " - " << (n < 0 ? strerror(errno) : "end of file");
+            throw std::runtime_error(ss.str());
+        }
+        done += size_t(n);
+    }
+
+    MemoryBuffer mb(buffer.data(), buffer.size());
+    std::istream is(&mb);
+    blocker_.read(is, block);
+}
+
+// must be executed under lock, returns once no read of key is in flight
+template<typename Key, typename Block>
+void BlockStorage<Key, Block>::wait_until_loaded(std::unique_lock<std::mutex> & guard, Key const & key)
+{
+    loaded_cv_.wait(guard, [&] { return loading_.count(key) == 0; });
+}
+
 template<typename Key, typename Block>
 size_t BlockStorage<Key,Block>::cache_hits() {
     std::unique_lock<std::mutex> guard(mutex_);
@@ -268,6 +475,8 @@ template<typename Key, typename Block>
 void BlockStorage<Key,Block>::close_file()
 {
     block_file_.close();
+    if(read_fd_ >= 0) ::close(read_fd_);
+    read_fd_ = -1;
 }
 
 template<typename Key, typename Block>
@@ -337,6 +546,15 @@ void BlockStorage<Key,Block>::open_file(size_t resize_old_size)
         ss << "Could not open file: " << path_ << " - " << std::strerror(errno); 
         throw std::runtime_error(ss.str());
     }
+
+    // misses read through their own descriptor so they need neither the lock
+    // nor block_file_'s position
+    read_fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if(read_fd_ < 0) {
+        std::stringstream ss;
+        ss << "Could not open file for reading: " << path_ << " - " << std::strerror(errno);
+        throw std::runtime_error(ss.str());
+    }
     update_file_size();
 
     if(file_size_ == 0) {
@@ -377,21 +595,43 @@ void BlockStorage<Key,Block>::save_one(Key const & key)
 {
     std::unique_lock<std::mutex> guard(mutex_);
 
+    auto it = loaded_.find(key);
+    if(it == loaded_.end())
+        return;
+    wait_until_loaded(guard, key);
+
+    // the caller asks for the write, so count it as a modified block
+    save_block(key, *it->second, true);
+}
+
+// must be executed under lock, modified counts the save as a write-back
+template<typename Key, typename Block>
+void BlockStorage<Key,Block>::save_block(Key const & key, Block const & block, bool modified)
+{
+    GRAVITATE_TRACE_SCOPE("storage", "save_one");
+    auto start = stats_.now();
+
     auto it = index_.find(key);
     if(it == index_.end()) 
         return;
 
     seekp_to_block(it->second);
-    blocker_.write(block_file_, *loaded_[key]);
+    blocker_.write(block_file_, block);
     if(!block_file_ && errno != 0) {
         throw std::logic_error("error writing block");
     }
-    // lets read it back in just to make sure
+    stats_.wrote(block_size_);
+    if(modified) stats_.wrote_back();
+
+    // lets read it back in just to make sure, counted apart from the reads gets need
     seekg_to_block(it->second);
     
     Block b;
     blocker_.read(block_file_, b);
+    stats_.verified(block_size_);
     // block_file_.flush();
+
+    stats_.record(BlockOp::save, start);
 }
 
 /* MUST execute under a lock */
@@ -400,19 +640,28 @@ void BlockStorage<Key,Block>::remove_one_from_mem()
 {
     if(keys_.size() == 0) return;
 
+    auto start = stats_.now();
+
     auto key_to_remove = keys_.front();
     keys_.pop_front();
     loaded_.erase(key_to_remove);
+
+    stats_.evicted();
+    stats_.resident(loaded_.size());
+    stats_.record(BlockOp::evict, start);
 }
 
 /* must be executed under lock */
 template<typename Key, typename Block>
 void BlockStorage<Key,Block>::increase_storage(size_t increase_by)
 {
+    GRAVITATE_TRACE_SCOPE("storage", "increase_storage");
 
     size_t old_size = file_size_;
     size_t new_size = file_size_ + increase_by;
 
+    stats_.grew_file();
+
     block_file_.close();
     std::filesystem::resize_file(path_, new_size);
     block_file_.open(path_, std::fstream::in | std::fstream::out | std::fstream::binary);
@@ -425,12 +674,14 @@ void BlockStorage<Key,Block>::increase_storage(size_t increase_by)
     block_file_.seekg(index_streampos_, std::ios::beg);
     // read the index into the buffer
     block_file_.read(buffer.get(), index_size_);
+    stats_.read(index_size_);
 
     // move to the start position of the new index
     block_file_.seekp(-(long long)index_size_ - (long long)footer_size_, std::ios::end);
     index_streampos_ = block_file_.tellp();
     // write the new index
     block_file_.write(buffer.get(), index_size_);
+    stats_.wrote(index_size_);
     // get the footer_offset which is at the end of the index
     footer_streampos_ = block_file_.tellp();
     write_footer();
@@ -440,6 +691,9 @@ void BlockStorage<Key,Block>::increase_storage(size_t increase_by)
 template<typename Key, typename Block>
 std::shared_ptr<Block> BlockStorage<Key,Block>::grow_index(Key const & key)
 {
+    GRAVITATE_TRACE_SCOPE("storage", "grow_index");
+    auto start = stats_.now();
+
     // do we have enough space for the new data?
     if( data_size_ + block_size_ +                  // current_data + new_data
         index_size_ + key_size_ + sizeof(size_t) +  // current_index + new_index
@@ -463,7 +717,7 @@ std::shared_ptr<Block> BlockStorage<Key,Block>::grow_index(Key const & key)
     index_[key] = next_block_index_;                                         // update the index in memory
 
     // write a blank block to the blocks
-    auto pb = std::make_shared<Block>();
+    auto pb = slab_->make();
     seekp_to_block(next_block_index_);
     blocker_.write(block_file_, *pb);
 
@@ -477,15 +731,51 @@ std::shared_ptr<Block> BlockStorage<Key,Block>::grow_index(Key const & key)
     seekp_to_index_size();
     block_file_.write(reinterpret_cast<const char *>(&index_size_), sizeof(index_size_));
     block_file_.flush();
+    stats_.wrote(key_size_ + sizeof(size_t));
+    stats_.wrote(block_size_);
+    stats_.wrote(footer_size_);
 
     // increment our offset
     next_block_index_++;
+
+    stats_.record(BlockOp::grow, start);
     return pb;
 }
 
 template<typename Key, typename Block>
 typename BlockStorage<Key,Block>::ScopedWrapper BlockStorage<Key,Block>::get(Key const &key) 
 {
+    return BlockStorage<Key,Block>::ScopedWrapper(this, get_block(key), key);
+}
+
+template<typename Key, typename Block>
+typename BlockStorage<Key,Block>::AsyncGet BlockStorage<Key,Block>::async_get(Key const &key, tbb::task_arena & arena)
+{
+    return AsyncGet(this, key, arena);
+}
+
+// returns true and counts a hit if the block is already in memory
+template<typename Key, typename Block>
+bool BlockStorage<Key,Block>::try_get_loaded(Key const & key, std::shared_ptr<Block> & block)
+{
+    auto start = stats_.now();
+    std::unique_lock<std::mutex> guard(mutex_);
+
+    auto it = loaded_.find(key);
+    if (it == loaded_.end()) 
+        return false;
+
+    ++cache_hit_;
+    block = it->second;
+    stats_.record(BlockOp::get_hit, start);
+    return true;
+}
+
+template<typename Key, typename Block>
+std::shared_ptr<Block> BlockStorage<Key,Block>::get_block(Key const &key) 
+{
+    GRAVITATE_TRACE_SCOPE("storage", "get");
+    auto start = stats_.now();
     std::unique_lock<std::mutex> guard(mutex_);
 
     if(!block_file_ && errno != 0) {
@@ -495,31 +785,56 @@ typename BlockStorage<Key,Block>::ScopedWrapper BlockStorage<Key,Block>::get(Key
         throw std::runtime_error(ss.str());
     }
 
+    // another get may be reading this key, it is a hit once that publishes
+    wait_until_loaded(guard, key);
+
     auto it = loaded_.find(key);
     if (it != loaded_.end()) 
     {
         ++cache_hit_;
-        return ScopedWrapper(this, it->second, key);
+        stats_.record(BlockOp::get_hit, start);
+        return it->second;
     }
     ++cache_miss_;
-    if (loaded_.size() >= maximum_loaded_blocks_) 
+    if (loaded_.size() + loading_.size() >= maximum_loaded_blocks_) 
         remove_one_from_mem(); 
 
     std::shared_ptr<Block> block;
 
     auto ip = index_.find(key);
     if (ip == index_.end()) {
+        // a new key changes the layout of the file, that stays under the lock
         block = grow_index(key);
     } else {    
-        // load the block from disk
-        block = std::make_shared<Block>();
-        seekg_to_block(ip->second);
-        blocker_.read(block_file_, *block);
+        // load the block from disk, no point initializing what we overwrite.
+        // The key is marked loading so other gets of it wait and saves of it
+        // hold off, then the read runs without the lock.
+        block = slab_->make_for_overwrite();
+        size_t index = ip->second;
+        loading_.insert(key);
+        block_file_.flush();
+        guard.unlock();
+
+        try {
+            read_block_unlocked(index, *block);
+        } catch(...) {
+            guard.lock();
+            loading_.erase(key);
+            loaded_cv_.notify_all();
+            throw;
+        }
+
+        guard.lock();
+        loading_.erase(key);
+        loaded_cv_.notify_all();
+        stats_.read(block_size_);
     }
 
     keys_.push_back(key);
     loaded_[key] = block;
-    return BlockStorage<Key,Block>::ScopedWrapper(this, block, key);
+    stats_.resident(loaded_.size());
+    stats_.record(BlockOp::get_miss, start);
+    return block;
 }
 
 
@@ -581,18 +896,21 @@ BlockStorage<Key,Block>::ScopedWrapper::ScopedWrapper(
     BlockStorage<Key,Block> * storage, 
     std::shared_ptr<Block> block,
     Key const & key)
-    : storage_(storage), block_(block), key_(key)
+    : storage_(storage), block_(block), key_(key), modified_(false)
 { }
 
 template<typename Key, typename Block>
 BlockStorage<Key,Block>::ScopedWrapper::ScopedWrapper(ScopedWrapper const & other)
-    : storage_(other.storage), block_(other.block), key_(other.key)
+    : storage_(other.storage_), block_(other.block_), key_(other.key_), modified_(other.modified_)
 { }
 
 template<typename Key, typename Block>
 BlockStorage<Key,Block>::ScopedWrapper::ScopedWrapper(ScopedWrapper && other) noexcept
-    : storage_(other.storage), block_(std::move(other.block)), key_(std::move(other.key))
-{ }
+    : storage_(other.storage_), block_(std::move(other.block_)), key_(other.key_), modified_(other.modified_)
+{ 
+    // the moved from wrapper no longer owns a block to save
+    other.storage_ = nullptr;
+}
 
 template<typename Key, typename Block>
 Key const & BlockStorage<Key,Block>::ScopedWrapper::key() const
@@ -603,23 +921,74 @@ Key const & BlockStorage<Key,Block>::ScopedWrapper::key() const
 template<typename Key, typename Block>
 void BlockStorage<Key,Block>::ScopedWrapper::save() const
 { 
-    storage_->save_one(key_);
+    // save the block we hold, it may have been evicted from the cache already
+    std::unique_lock<std::mutex> guard(storage_->mutex_);
+    storage_->wait_until_loaded(guard, key_);
+    storage_->save_block(key_, *block_, modified_);
+    modified_ = false;
 }
 
 template<typename Key, typename Block>
 BlockStorage<Key,Block>::ScopedWrapper::~ScopedWrapper()
 {
-    save();
+    if(storage_ != nullptr && modified_)
+        save();
 }
 
 template<typename Key, typename Block>
 Block & BlockStorage<Key,Block>::ScopedWrapper::operator*() const
 {
+    modified_ = true;
     return *block_;
 }
 
 template<typename Key, typename Block>
 std::shared_ptr<Block> BlockStorage<Key,Block>::ScopedWrapper::operator->() const
 {
+    modified_ = true;
     return block_;
 }
+
+template<typename Key, typename Block>
+Block const & BlockStorage<Key,Block>::ScopedWrapper::value() const
+{
+    return *block_;
+}
+
+template<typename Key, typename Block>
+BlockStorage<Key,Block>::AsyncGet::AsyncGet(
+    BlockStorage<Key,Block> * storage,
+    Key const & key,
+    tbb::task_arena & arena)
+    : storage_(storage), key_(key), arena_(&arena)
+{ }
+
+template<typename Key, typename Block>
+bool BlockStorage<Key,Block>::AsyncGet::await_ready()
+{
+    return storage_->try_get_loaded(key_, block_);
+}
+
+template<typename Key, typename Block>
+void BlockStorage<Key,Block>::AsyncGet::await_suspend(std::coroutine_handle<> handle)
+{
+    arena_->enqueue([this, handle]() {
+        // tbb terminates on exceptions escaping an enqueued task, so hand
+        // them back to the coroutine instead
+        try {
+            block_ = storage_->get_block(key_);
+        } catch(...) {
+            error_ = std::current_exception();
+        }
+        handle.resume();
+    });
+}
+
+template<typename Key, typename Block>
+typename BlockStorage<Key,Block>::ScopedWrapper BlockStorage<Key,Block>::AsyncGet::await_resume()
+{
+    if(error_) {
+        std::rethrow_exception(error_);
+    }
+    return ScopedWrapper(storage_, block_, key_);
+}
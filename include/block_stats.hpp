@@ -0,0 +1,301 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/* LatencyHistogram counts durations in power of two nanosecond buckets.
+   Bucket b holds samples in [2^(b-1), 2^b) ns, bucket 0 holds zero.
+   Recording is a handful of relaxed atomic adds, so it is safe to leave on. */
+class LatencyHistogram {
+public:
+    static constexpr size_t buckets = 40; // the last bucket holds everything above ~9 minutes
+
+    struct Snapshot {
+        std::array<uint64_t, buckets> counts{};
+        uint64_t count = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+
+        // upper bound of the bucket containing the p-th quantile (0 <= p <= 1)
+        uint64_t percentile(double p) const;
+        static uint64_t bucket_upper_ns(size_t bucket) { return bucket == 0 ? 0 : (uint64_t(1) << bucket) - 1; }
+    };
+
+    LatencyHistogram() = default;
+    LatencyHistogram(LatencyHistogram const & other) { *this = other; }
+    LatencyHistogram & operator=(LatencyHistogram const &);
+
+    void record(uint64_t ns);
+    Snapshot snapshot() const;
+
+private:
+    std::array<std::atomic<uint64_t>, buckets> counts_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> total_ns_{0};
+    std::atomic<uint64_t> max_ns_{0};
+};
+
+inline LatencyHistogram & LatencyHistogram::operator=(LatencyHistogram const & other)
+{
+    for(size_t b = 0; b < buckets; ++b) {
+        counts_[b].store(other.counts_[b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    count_.store(other.count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    total_ns_.store(other.total_ns_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    max_ns_.store(other.max_ns_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+inline void LatencyHistogram::record(uint64_t ns)
+{
+    size_t b = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    if(b >= buckets) b = buckets - 1;
+
+    counts_[b].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t m = max_ns_.load(std::memory_order_relaxed);
+    while(ns > m && !max_ns_.compare_exchange_weak(m, ns, std::memory_order_relaxed)) {}
+}
+
+inline LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot s;
+    for(size_t b = 0; b < buckets; ++b) {
+        s.counts[b] = counts_[b].load(std::memory_order_relaxed);
+    }
+    s.count = count_.load(std::memory_order_relaxed);
+    s.total_ns = total_ns_.load(std::memory_order_relaxed);
+    s.max_ns = max_ns_.load(std::memory_order_relaxed);
+    return s;
+}
+
+inline uint64_t LatencyHistogram::Snapshot::percentile(double p) const
+{
+    uint64_t n = 0;
+    for(auto c : counts) n += c;
+    if(n == 0) return 0;
+
+    uint64_t rank = (uint64_t)(p * (n - 1)) + 1;
+    uint64_t seen = 0;
+    for(size_t b = 0; b < buckets; ++b) {
+        seen += counts[b];
+        if(seen >= rank) {
+            return bucket_upper_ns(b) < max_ns ? bucket_upper_ns(b) : max_ns;
+        }
+    }
+    return max_ns;
+}
+
+
+enum class BlockOp : size_t { get_hit, get_miss, save, grow, evict };
+constexpr size_t block_op_count = 5;
+
+inline char const * block_op_name(BlockOp op) {
+    static char const * names[block_op_count] = { "get_hit", "get_miss", "save", "grow", "evict" };
+    return names[(size_t)op];
+}
+
+enum class StatsFormat { json, prometheus };
+
+/* BlockStorageStats is the instrumentation surface of a BlockStorage.
+   BlockStorage only updates it under its own mutex, so there is never more
+   than one writer and plain relaxed atomics are enough; they let snapshot()
+   run from any thread without taking the storage lock. */
+class BlockStorageStats {
+public:
+    struct Snapshot {
+        std::array<LatencyHistogram::Snapshot, block_op_count> latency;
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+        uint64_t read_ops = 0;
+        uint64_t write_ops = 0;
+        uint64_t bytes_verified = 0; // read back after a save, not in bytes_read
+        uint64_t evictions = 0;
+        uint64_t write_backs = 0;
+        uint64_t file_growths = 0;
+        uint64_t resident = 0;
+        uint64_t resident_high_water = 0;
+
+        LatencyHistogram::Snapshot const & operator[](BlockOp op) const { return latency[(size_t)op]; }
+
+        void write_json(std::ostream & os) const;
+        void write_prometheus(std::ostream & os, std::string const & prefix = "blockstorage") const;
+        void write(std::string const & path, StatsFormat format) const;
+    };
+
+    typedef std::chrono::steady_clock clock;
+
+    BlockStorageStats() = default;
+    BlockStorageStats(BlockStorageStats const & other) { *this = other; }
+    BlockStorageStats & operator=(BlockStorageStats const &);
+
+    static clock::time_point now() { return clock::now(); }
+    void record(BlockOp op, clock::time_point start) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        latency_[(size_t)op].record(ns < 0 ? 0 : (uint64_t)ns);
+    }
+
+    void read(size_t bytes) { add(bytes_read_, bytes); add(read_ops_, 1); }
+    void wrote(size_t bytes) { add(bytes_written_, bytes); add(write_ops_, 1); }
+    void verified(size_t bytes) { add(bytes_verified_, bytes); }
+    void evicted() { add(evictions_, 1); }
+    void wrote_back() { add(write_backs_, 1); }
+    void grew_file() { add(file_growths_, 1); }
+    void resident(size_t blocks);
+
+    Snapshot snapshot() const;
+
+private:
+    static void add(std::atomic<uint64_t> & counter, uint64_t v) { counter.fetch_add(v, std::memory_order_relaxed); }
+
+    std::array<LatencyHistogram, block_op_count> latency_;
+    std::atomic<uint64_t> bytes_read_{0};
+    std::atomic<uint64_t> bytes_written_{0};
+    std::atomic<uint64_t> read_ops_{0};
+    std::atomic<uint64_t> write_ops_{0};
+    std::atomic<uint64_t> bytes_verified_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> write_backs_{0};
+    std::atomic<uint64_t> file_growths_{0};
+    std::atomic<uint64_t> resident_{0};
+    std::atomic<uint64_t> resident_high_water_{0};
+};
+
+inline BlockStorageStats & BlockStorageStats::operator=(BlockStorageStats const & other)
+{
+    auto s = other.snapshot();
+    latency_ = other.latency_;
+    bytes_read_ = s.bytes_read;
+    bytes_written_ = s.bytes_written;
+    read_ops_ = s.read_ops;
+    write_ops_ = s.write_ops;
+    bytes_verified_ = s.bytes_verified;
+    evictions_ = s.evictions;
+    write_backs_ = s.write_backs;
+    file_growths_ = s.file_growths;
+    resident_ = s.resident;
+    resident_high_water_ = s.resident_high_water;
+    return *this;
+}
+
+inline void BlockStorageStats::resident(size_t blocks)
+{
+    resident_.store(blocks, std::memory_order_relaxed);
+    if(blocks > resident_high_water_.load(std::memory_order_relaxed)) {
+        resident_high_water_.store(blocks, std::memory_order_relaxed);
+    }
+}
+
+inline BlockStorageStats::Snapshot BlockStorageStats::snapshot() const
+{
+    Snapshot s;
+    for(size_t op = 0; op < block_op_count; ++op) {
+        s.latency[op] = latency_[op].snapshot();
+    }
+    s.bytes_read = bytes_read_.load(std::memory_order_relaxed);
+    s.bytes_written = bytes_written_.load(std::memory_order_relaxed);
+    s.read_ops = read_ops_.load(std::memory_order_relaxed);
+    s.write_ops = write_ops_.load(std::memory_order_relaxed);
+    s.bytes_verified = bytes_verified_.load(std::memory_order_relaxed);
+    s.evictions = evictions_.load(std::memory_order_relaxed);
+    s.write_backs = write_backs_.load(std::memory_order_relaxed);
+    s.file_growths = file_growths_.load(std::memory_order_relaxed);
+    s.resident = resident_.load(std::memory_order_relaxed);
+    s.resident_high_water = resident_high_water_.load(std::memory_order_relaxed);
+    return s;
+}
+
+inline void BlockStorageStats::Snapshot::write_json(std::ostream & os) const
+{
+    os << "{\n  \"latency\": {";
+    for(size_t op = 0; op < block_op_count; ++op) {
+        auto const & h = latency[op];
+        os << (op == 0 ? "\n" : ",\n");
+        os << "    \"" << block_op_name((BlockOp)op) << "\": {"
+           << "\"count\": " << h.count
+           << ", \"total_ns\": " << h.total_ns
+           << ", \"max_ns\": " << h.max_ns
+           << ", \"p50_ns\": " << h.percentile(0.5)
+           << ", \"p90_ns\": " << h.percentile(0.9)
+           << ", \"p99_ns\": " << h.percentile(0.99)
+           << ", \"buckets\": [";
+        for(size_t b = 0; b < LatencyHistogram::buckets; ++b) {
+            os << (b == 0 ? "" : ", ") << h.counts[b];
+        }
+        os << "]}";
+    }
+    os << "\n  },\n";
+    os << "  \"bytes_read\": " << bytes_read << ",\n";
+    os << "  \"bytes_written\": " << bytes_written << ",\n";
+    os << "  \"read_ops\": " << read_ops << ",\n";
+    os << "  \"write_ops\": " << write_ops << ",\n";
+    os << "  \"bytes_verified\": " << bytes_verified << ",\n";
+    os << "  \"evictions\": " << evictions << ",\n";
+    os << "  \"write_backs\": " << write_backs << ",\n";
+    os << "  \"file_growths\": " << file_growths << ",\n";
+    os << "  \"resident\": " << resident << ",\n";
+    os << "  \"resident_high_water\": " << resident_high_water << "\n";
+    os << "}\n";
+}
+
+inline void BlockStorageStats::Snapshot::write_prometheus(std::ostream & os, std::string const & prefix) const
+{
+    auto const metric = prefix + "_op_latency_seconds";
+    os << "# TYPE " << metric << " histogram\n";
+    for(size_t op = 0; op < block_op_count; ++op) {
+        auto const & h = latency[op];
+        auto name = block_op_name((BlockOp)op);
+        uint64_t cumulative = 0;
+        for(size_t b = 0; b < LatencyHistogram::buckets; ++b) {
+            cumulative += h.counts[b];
+            os << metric << "_bucket{op=\"" << name << "\",le=\""
+               << (b == 0 ? 0 : uint64_t(1) << b) * 1e-9 << "\"} " << cumulative << "\n";
+        }
+        os << metric << "_bucket{op=\"" << name << "\",le=\"+Inf\"} " << h.count << "\n";
+        os << metric << "_sum{op=\"" << name << "\"} " << h.total_ns * 1e-9 << "\n";
+        os << metric << "_count{op=\"" << name << "\"} " << h.count << "\n";
+    }
+
+    auto counter = [&](char const * name, uint64_t value) {
+        os << "# TYPE " << prefix << "_" << name << " counter\n";
+        os << prefix << "_" << name << " " << value << "\n";
+    };
+    auto gauge = [&](char const * name, uint64_t value) {
+        os << "# TYPE " << prefix << "_" << name << " gauge\n";
+        os << prefix << "_" << name << " " << value << "\n";
+    };
+    counter("bytes_read_total", bytes_read);
+    counter("bytes_written_total", bytes_written);
+    counter("read_ops_total", read_ops);
+    counter("write_ops_total", write_ops);
+    counter("bytes_verified_total", bytes_verified);
+    counter("evictions_total", evictions);
+    counter("write_backs_total", write_backs);
+    counter("file_growths_total", file_growths);
+    gauge("resident_blocks", resident);
+    gauge("resident_blocks_high_water", resident_high_water);
+}
+
+inline void BlockStorageStats::Snapshot::write(std::string const & path, StatsFormat format) const
+{
+    std::ofstream os(path, std::ios::out | std::ios::trunc);
+    if(!os) {
+        std::stringstream ss;
+        ss << "Could not open stats file: " << path;
+        throw std::runtime_error(ss.str());
+    }
+
+    switch(format) {
+    case StatsFormat::json: write_json(os); break;
+    case StatsFormat::prometheus: write_prometheus(os); break;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+/*
+Which instruction set level the runtime dispatched kernels use.
+
+One binary runs on every node, so the hot kernels are compiled several times,
+once per level, and a table of function pointers is filled on first use with
+the best versions the machine allows (see linalg4_kernels(),
+precision_kernels() and curvature_kernels()).
+
+    portable   the baseline of the build, SSE2 on x86-64
+    avx2       AVX2, FMA and F16C, Haswell and later
+    avx512     AVX-512F on top of avx2, Skylake-SP and later
+
+cpu_level() is the level of the CPU, read once from CPUID, capped by the
+GRAVITATE_ISA environment variable when it is set to one of the names above:
+
+    GRAVITATE_ISA=avx2 ./gravitate     # what an AVX2 node would run
+
+so results can be reproduced across nodes and every implementation can be
+tested on the machine with the widest one.  A level above what the CPU has is
+the CPU's level, an unknown name is an error.
+
+A kernel is compiled for a level by defining it with GRAVITATE_TARGET_AVX2 or
+GRAVITATE_TARGET_AVX512, which also inline everything the kernel calls so the
+Tensor code it is built from is compiled for that level too.  Off x86 every
+level above portable is unavailable and the macros are not defined.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifndef GRAVITATE_X86
+#define GRAVITATE_X86 1
+#endif
+#endif
+
+#ifdef GRAVITATE_X86
+#define GRAVITATE_TARGET_AVX2 __attribute__((target("avx2,fma,f16c"), flatten))
+#define GRAVITATE_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma,f16c"), flatten))
+#endif
+
+enum class CpuLevel { portable, avx2, avx512 };
+
+inline char const * cpu_level_name(CpuLevel level) {
+    static char const * names[] = { "portable", "avx2", "avx512" };
+    return names[(size_t)level];
+}
+
+inline CpuLevel parse_cpu_level(std::string const & name) {
+    for(auto level : { CpuLevel::portable, CpuLevel::avx2, CpuLevel::avx512 }) {
+        if(name == cpu_level_name(level)) return level;
+    }
+    throw std::invalid_argument("unknown instruction set level '" + name + "', expected portable, avx2 or avx512");
+}
+
+// the highest level this CPU supports
+inline CpuLevel detected_cpu_level() {
+#ifdef GRAVITATE_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+    if(avx2 && __builtin_cpu_supports("avx512f")) return CpuLevel::avx512;
+    if(avx2) return CpuLevel::avx2;
+#endif
+    return CpuLevel::portable;
+}
+
+// the detected level capped by GRAVITATE_ISA, chosen once
+inline CpuLevel cpu_level() {
+    static CpuLevel const level = [] {
+        CpuLevel detected = detected_cpu_level();
+        char const * requested = std::getenv("GRAVITATE_ISA");
+        if(!requested || !*requested) return detected;
+        return std::min(detected, parse_cpu_level(requested));
+    }();
+    return level;
+}
+
+// whether kernels compiled for level may run
+inline bool cpu_supports(CpuLevel level) {
+    return level <= cpu_level();
+}
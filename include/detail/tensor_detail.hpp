@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <array>
 #include <tuple>
+#include <utility>
 #include <iostream>
 
 using std::tuple;
@@ -265,44 +267,126 @@ struct index_type_from_size<0> {
 };
 
 
-template<typename T, size_t N>
-struct TensorHelper<T,N,0> {
-    typedef tuple<> dimension_type;
-    static size_t index(tuple<> i) { return 0; }
-    static dimension_type dimension(size_t index) { return tuple<>{}; }
-    typedef decltype(dimension(0)) index_type;
-};
-template<typename T, size_t N>
-struct TensorHelper<T,N,1> {
-    typedef tuple<T> dimension_type;
-
-    static size_t index(tuple<size_t> ti) { return get<0>(ti); }
-    static dimension_type dimension(size_t index) {
-        return {(T)index};
+// strides of a tensor with M indices of dimension N, the first index moves fastest
+template<size_t N, size_t M>
+constexpr std::array<size_t,M> make_strides() {
+    std::array<size_t,M> strides{};
+    size_t s = 1;
+    for(size_t k = 0; k < M; ++k) {
+        strides[k] = s;
+        s *= N;
     }
-    typedef decltype(dimension(0)) index_type;
-};
+    return strides;
+}
+
 template<typename T, size_t N, size_t M>
 struct TensorHelper {
-    static size_t index(index_type_from_size<M>::type i) {
-        static_assert(std::tuple_size<typename index_type_from_size<M>::type>::value == M, "index_type_from_size<M>::type must be M");
-        // static_assert(tuple_size<)
-        auto tail = tuple_tail<1>(i);
-        static_assert(std::tuple_size<decltype(tail)>::value == M-1, "tuple_tail<0> must be M-1");
-        return get<0>(i) + N * TensorHelper<T,N,M-1>::index(tuple_tail<1>(i));
+    typedef typename index_type_from_size<M>::type index_type;
+    typedef index_type dimension_type;
+
+    static constexpr std::array<size_t,M> strides = make_strides<N,M>();
+
+    // sum of index * stride, unrolled at compile time
+    static constexpr size_t index(index_type i) {
+        return index_impl(i, std::make_index_sequence<M>{});
     }
 
-    static auto dimension(size_t index)   
-    {
-        return tuple_cat(make_tuple<T>(index % N), 
-            TensorHelper<T,N,M-1>::dimension(index / N)
-        );
+    // splits a flat offset back into its indices, unrolled at compile time
+    static constexpr index_type dimension(size_t index) {
+        return dimension_impl(index, std::make_index_sequence<M>{});
     }
 
-    typedef decltype(dimension(0)) index_type;
+private:
+    template<size_t ... Is>
+    static constexpr size_t index_impl(index_type const & i, std::index_sequence<Is...>) {
+        return (size_t(0) + ... + (std::get<Is>(i) * power<N,Is>::value));
+    }
+
+    template<size_t ... Is>
+    static constexpr index_type dimension_impl(size_t index, std::index_sequence<Is...>) {
+        return index_type((index / power<N,Is>::value) % N...);
+    }
+};
+
+
+/*
+Odometer iteration over the indices of a tensor.
+
+for_each_offsets<N,M>(strides, f) visits every combination of M indices of
+dimension N with the first index moving fastest and calls f(offsets, indices).
+offsets[s] is the dot product of the indices with strides[s], kept up to date
+by adding a stride when an index advances, so a kernel can walk several
+tensors with different layouts at once without dividing anything.  The loop
+nest is generated at compile time so small tensors unroll completely.
+*/
+template<size_t N, size_t M, size_t K, size_t S>
+struct OffsetLoop {
+    template<typename Function>
+    static constexpr void run(std::array<std::array<size_t,M>,S> const & strides,
+                              std::array<size_t,S> offsets, std::array<size_t,M> & indices, Function & f)
+    {
+        for(size_t i = 0; i < N; ++i) {
+            indices[K-1] = i;
+            OffsetLoop<N,M,K-1,S>::run(strides, offsets, indices, f);
+            for(size_t s = 0; s < S; ++s) {
+                offsets[s] += strides[s][K-1];
+            }
+        }
+    }
 };
 
+template<size_t N, size_t M, size_t S>
+struct OffsetLoop<N,M,0,S> {
+    template<typename Function>
+    static constexpr void run(std::array<std::array<size_t,M>,S> const &,
+                              std::array<size_t,S> const & offsets, std::array<size_t,M> const & indices, Function & f)
+    {
+        f(offsets, indices);
+    }
+};
 
+template<size_t N, size_t M, size_t S, typename Function>
+constexpr void for_each_offsets(std::array<std::array<size_t,M>,S> const & strides, Function && f) {
+    std::array<size_t,M> indices{};
+    OffsetLoop<N,M,M,S>::run(strides, std::array<size_t,S>{}, indices, f);
+}
 
+// for_each_index<N,M>(f) calls f(offset, indices) for every element in storage order
+template<size_t N, size_t M, typename Function>
+constexpr void for_each_index(Function && f) {
+    for_each_offsets<N,M,1>({make_strides<N,M>()}, [&](std::array<size_t,1> const & offsets, std::array<size_t,M> const & indices) {
+        f(offsets[0], indices);
+    });
+}
 
+/*
+Layout of a single product-and-contract step.  The product of a tensor with
+A indices and one with B indices has A+B indices; contracting product
+indices i and j leaves A+B-2.  For each remaining index r, first[r] and
+second[r] are its strides in the two operands (one of them is zero) and
+first_contracted/second_contracted are the strides of the summed index.
+*/
+template<size_t N, size_t A, size_t B, size_t i, size_t j>
+struct ContractionLayout {
+    static constexpr size_t lo = i < j ? i : j;
+    static constexpr size_t hi = i < j ? j : i;
+    static constexpr size_t result_degree = A + B - 2;
+
+    static constexpr size_t first_stride(size_t p) { return p < A ? make_strides<N,A+B>()[p] : 0; }
+    static constexpr size_t second_stride(size_t p) { return p < A ? 0 : make_strides<N,A+B>()[p - A]; }
+
+    static constexpr std::array<std::array<size_t,result_degree>,3> strides() {
+        std::array<std::array<size_t,result_degree>,3> s{};
+        auto result = make_strides<N,result_degree>();
+        for(size_t r = 0, p = 0; r < result_degree; ++r, ++p) {
+            while(p == lo || p == hi) ++p;
+            s[0][r] = result[r];
+            s[1][r] = first_stride(p);
+            s[2][r] = second_stride(p);
+        }
+        return s;
+    }
 
+    static constexpr size_t first_contracted = first_stride(lo) + first_stride(hi);
+    static constexpr size_t second_contracted = second_stride(lo) + second_stride(hi);
+};
@@ -0,0 +1,295 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "detail/tensor_detail.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/*
+Compile time einsum over Tensors.
+
+    auto c = einsum<"ab,cbd->acd">(g, conn);
+
+Every operand gets one group of letters, one letter per tensor index, and the
+letters after -> name the indices of the result in order.  A letter that
+appears in the result must appear exactly once among the operands; every other
+letter must appear exactly twice and is summed over, which requires one upper
+(contravariant) and one lower (covariant) occurrence, the same rule
+contraction_type enforces for a single pair.  A letter may be repeated inside
+one operand to take a trace.  Any number of operands and summed pairs are
+allowed, all operands must share element type and dimension.
+
+The loop nest is generated at compile time.  The outer loops walk the result
+in storage order so every result element is written once, and the inner loops
+walk the summed indices with the smallest stride innermost, accumulating in a
+register.  Nothing is materialised besides the result, in particular not the
+outer product of the operands.
+*/
+
+template<size_t L>
+struct fixed_string {
+    char value[L]{};
+
+    constexpr fixed_string(char const (&s)[L]) {
+        for(size_t i = 0; i < L; ++i) value[i] = s[i];
+    }
+    constexpr std::string_view view() const { return std::string_view(value, L - 1); }
+};
+
+// the parsed labels of an einsum expression
+struct EinsumExpression {
+    static constexpr size_t max_operands = 8;
+    static constexpr size_t max_degree = 16;
+
+    bool well_formed = true;
+    size_t operands = 1;
+    std::array<size_t,max_operands> degree{};
+    std::array<std::array<char,max_degree>,max_operands> labels{};
+    size_t result_degree = 0;
+    std::array<char,max_degree> result{};
+
+    // occurrences of a label among the operands and in the result
+    constexpr size_t count(char label) const {
+        size_t n = 0;
+        for(size_t o = 0; o < operands; ++o)
+            for(size_t p = 0; p < degree[o]; ++p)
+                n += labels[o][p] == label;
+        return n;
+    }
+    constexpr size_t result_count(char label) const {
+        size_t n = 0;
+        for(size_t p = 0; p < result_degree; ++p)
+            n += result[p] == label;
+        return n;
+    }
+};
+
+constexpr bool is_einsum_label(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr EinsumExpression parse_einsum(std::string_view s) {
+    EinsumExpression e;
+    bool arrow = false;
+
+    for(size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if(c == ' ') {
+            continue;
+        } else if(!arrow && c == '-' && i + 1 < s.size() && s[i + 1] == '>') {
+            arrow = true;
+            ++i;
+        } else if(!arrow && c == ',') {
+            if(++e.operands > EinsumExpression::max_operands) return EinsumExpression{false};
+        } else if(is_einsum_label(c)) {
+            auto & degree = arrow ? e.result_degree : e.degree[e.operands - 1];
+            if(degree == EinsumExpression::max_degree) return EinsumExpression{false};
+            (arrow ? e.result[degree] : e.labels[e.operands - 1][degree]) = c;
+            ++degree;
+        } else {
+            return EinsumExpression{false};
+        }
+    }
+
+    e.well_formed = arrow;
+    return e;
+}
+
+template<typename Tensor>
+struct einsum_operand;
+
+template<typename T, size_t N, typename ... Variances>
+struct einsum_operand<Tensor<T,N,Variances...>> {
+    typedef T element_type;
+    static constexpr size_t dimensions = N;
+    static constexpr size_t degree = sizeof...(Variances);
+
+    template<size_t ... Ks>
+    static constexpr std::array<bool,sizeof...(Variances)> contravariant_impl(std::index_sequence<Ks...>) {
+        return { is_contravariant<Ks,Variances...>::value... };
+    }
+    static constexpr std::array<bool,sizeof...(Variances)> contravariant = contravariant_impl(std::index_sequence_for<Variances...>{});
+};
+
+template<fixed_string S, typename ... Tensors>
+struct EinsumPlan {
+    static constexpr EinsumExpression expression = parse_einsum(S.view());
+    static constexpr size_t operands = sizeof...(Tensors);
+
+    typedef typename std::common_type_t<typename einsum_operand<Tensors>::element_type...> element_type;
+    static constexpr size_t N = std::array<size_t,operands>{ einsum_operand<Tensors>::dimensions... }[0];
+
+    static constexpr bool same_space =
+        ((std::is_same_v<typename einsum_operand<Tensors>::element_type, element_type> &&
+          einsum_operand<Tensors>::dimensions == N) && ...);
+
+    static constexpr bool labels_match_degrees = [] {
+        if(expression.operands != operands) return false;
+        std::array<size_t,operands> degrees = { einsum_operand<Tensors>::degree... };
+        for(size_t o = 0; o < operands; ++o) {
+            if(expression.degree[o] != degrees[o]) return false;
+        }
+        return true;
+    }();
+
+    // is the p-th index of operand o contravariant
+    static constexpr bool contravariant(size_t o, size_t p) {
+        std::array<std::array<bool,EinsumExpression::max_degree>,operands> flags{};
+        size_t k = 0;
+        ((std::copy(einsum_operand<Tensors>::contravariant.begin(), einsum_operand<Tensors>::contravariant.end(), flags[k].begin()), ++k), ...);
+        return flags[o][p];
+    }
+
+    static constexpr bool labels_pair = [] {
+        for(size_t r = 0; r < expression.result_degree; ++r) {
+            char l = expression.result[r];
+            if(expression.result_count(l) != 1 || expression.count(l) != 1) return false;
+        }
+        for(size_t o = 0; o < expression.operands; ++o) {
+            for(size_t p = 0; p < expression.degree[o]; ++p) {
+                char l = expression.labels[o][p];
+                if(expression.result_count(l) == 0 && expression.count(l) != 2) return false;
+            }
+        }
+        return true;
+    }();
+
+    static constexpr bool variances_pair = [] {
+        if(!labels_match_degrees) return false;
+        for(size_t o = 0; o < operands; ++o) {
+            for(size_t p = 0; p < expression.degree[o]; ++p) {
+                char l = expression.labels[o][p];
+                if(expression.result_count(l) != 0) continue;
+                size_t upper = 0;
+                for(size_t q = 0; q < operands; ++q)
+                    for(size_t r = 0; r < expression.degree[q]; ++r)
+                        upper += expression.labels[q][r] == l && contravariant(q, r);
+                if(upper != 1) return false;
+            }
+        }
+        return true;
+    }();
+
+    static constexpr size_t free_degree = expression.result_degree;
+    static constexpr size_t summed_degree = [] {
+        size_t n = 0;
+        for(size_t o = 0; o < expression.operands; ++o)
+            for(size_t p = 0; p < expression.degree[o]; ++p)
+                n += expression.result_count(expression.labels[o][p]) == 0;
+        return n / 2;
+    }();
+
+    // stride of a label in operand o, repeated labels add up so a trace walks the diagonal
+    static constexpr size_t label_stride(size_t o, char label) {
+        size_t stride = 0, s = 1;
+        for(size_t p = 0; p < expression.degree[o]; ++p, s *= N) {
+            if(expression.labels[o][p] == label) stride += s;
+        }
+        return stride;
+    }
+
+    // summed labels ordered by their total stride, the smallest moves fastest
+    static constexpr std::array<char,summed_degree> summed_labels = [] {
+        std::array<char,summed_degree> labels{};
+        size_t n = 0;
+        for(size_t o = 0; o < expression.operands; ++o) {
+            for(size_t p = 0; p < expression.degree[o]; ++p) {
+                char l = expression.labels[o][p];
+                bool seen = false;
+                for(size_t k = 0; k < n; ++k) seen = seen || labels[k] == l;
+                if(!seen && expression.result_count(l) == 0) labels[n++] = l;
+            }
+        }
+        auto weight = [](char l) {
+            size_t w = 0;
+            for(size_t o = 0; o < operands; ++o) w += label_stride(o, l);
+            return w;
+        };
+        for(size_t a = 1; a < n; ++a)
+            for(size_t b = a; b > 0 && weight(labels[b]) < weight(labels[b - 1]); --b)
+                std::swap(labels[b], labels[b - 1]);
+        return labels;
+    }();
+
+    // strides of the result indices in the result and every operand
+    static constexpr std::array<std::array<size_t,free_degree>,operands + 1> free_strides = [] {
+        std::array<std::array<size_t,free_degree>,operands + 1> s{};
+        s[0] = make_strides<N,free_degree>();
+        for(size_t r = 0; r < free_degree; ++r)
+            for(size_t o = 0; o < operands; ++o)
+                s[o + 1][r] = label_stride(o, expression.result[r]);
+        return s;
+    }();
+
+    static constexpr std::array<std::array<size_t,summed_degree>,operands> summed_strides = [] {
+        std::array<std::array<size_t,summed_degree>,operands> s{};
+        for(size_t k = 0; k < summed_degree; ++k)
+            for(size_t o = 0; o < operands; ++o)
+                s[o][k] = label_stride(o, summed_labels[k]);
+        return s;
+    }();
+
+    static constexpr bool result_contravariant(size_t r) {
+        for(size_t o = 0; o < operands; ++o)
+            for(size_t p = 0; p < expression.degree[o]; ++p)
+                if(expression.labels[o][p] == expression.result[r]) return contravariant(o, p);
+        return false;
+    }
+
+    template<size_t ... Rs>
+    static auto result_type_impl(std::index_sequence<Rs...>)
+        -> Tensor<element_type,N,std::conditional_t<result_contravariant(Rs),Contravariant,Covariant>...>;
+
+    typedef decltype(result_type_impl(std::make_index_sequence<free_degree>{})) result_type;
+};
+
+// each requirement is its own concept so a failed einsum names the rule it broke
+template<fixed_string S>
+concept einsum_well_formed = parse_einsum(S.view()).well_formed;
+
+template<fixed_string S, typename ... Tensors>
+concept einsum_same_space = EinsumPlan<S,Tensors...>::same_space;
+
+template<fixed_string S, typename ... Tensors>
+concept einsum_labels_match_degrees = EinsumPlan<S,Tensors...>::labels_match_degrees;
+
+template<fixed_string S, typename ... Tensors>
+concept einsum_labels_pair = EinsumPlan<S,Tensors...>::labels_pair;
+
+template<fixed_string S, typename ... Tensors>
+concept einsum_variances_pair = EinsumPlan<S,Tensors...>::variances_pair;
+
+template<fixed_string S, typename ... Tensors>
+concept einsum_compatible = sizeof...(Tensors) > 0 && einsum_well_formed<S> &&
+                            einsum_same_space<S,Tensors...> && einsum_labels_match_degrees<S,Tensors...> &&
+                            einsum_labels_pair<S,Tensors...> && einsum_variances_pair<S,Tensors...>;
+
+template<fixed_string S, typename ... Tensors, size_t ... Os>
+auto einsum_impl(std::index_sequence<Os...>, Tensors const & ... operands) {
+    typedef EinsumPlan<S,Tensors...> plan;
+    typedef typename plan::element_type T;
+
+    typename plan::result_type ret(true); // uninitialized
+    std::array<T const *,plan::operands> data = { &operands[0]... };
+
+    for_each_offsets<plan::N,plan::free_degree>(plan::free_strides, [&](auto const & base, auto const &) {
+        T sum = 0;
+        for_each_offsets<plan::N,plan::summed_degree>(plan::summed_strides, [&](auto const & off, auto const &) {
+            sum += (... * data[Os][base[Os + 1] + off[Os]]);
+        });
+        ret[base[0]] = sum;
+    });
+
+    return ret;
+}
+
+template<fixed_string S, typename ... Tensors>
+    requires einsum_compatible<S,Tensors...>
+auto einsum(Tensors const & ... operands) {
+    return einsum_impl<S>(std::index_sequence_for<Tensors...>{}, operands...);
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "einsum.hpp"
+
+#include <array>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+/*
+Source code for an einsum, so the formulas written against Tensor on the host
+run as the same arithmetic on an OpenCL device.
+
+    std::string source = einsum_source<"ab,bc->ac">("inverse_product", inverse, metric);
+
+generates, for the types of the operands (their values are not used),
+
+    void inverse_product(global const float * restrict a0, global const float * restrict a1,
+                         global float * restrict out)
+    kernel void inverse_product_kernel(global const float * a0, global const float * a1,
+                                       global float * out)
+
+The first computes one result from one tensor per operand, each in Tensor
+storage order.  The kernel runs it once per work item i on the i-th tensor of
+each array, a float16 buffer of 4x4 matrices is such an array.  With
+EinsumLanguage::cpp the function is plain C++ on raw pointers and there is no
+kernel, which lets the generated code be checked against einsum on the host:
+src/einsum_generate.cpp writes such a header at build time and
+TensorTest.EinsumGenerated runs it.
+
+The checks and the loop order are the ones of EinsumPlan.  All strides are
+folded into the source: when the result has at most max_unrolled_terms
+products in total every result element is one straight line sum with literal
+offsets, otherwise the loops are written out with literal bounds and strides.
+*/
+
+enum class EinsumLanguage { opencl, cpp };
+
+struct EinsumCodegenOptions {
+    EinsumLanguage language = EinsumLanguage::opencl;
+    size_t max_unrolled_terms = 1024;
+};
+
+template<fixed_string S, typename ... Tensors>
+struct EinsumCodegen {
+    typedef EinsumPlan<S,Tensors...> plan;
+    typedef typename plan::element_type T;
+    typedef typename plan::result_type result_type;
+
+    static_assert(std::is_same_v<T,float> || std::is_same_v<T,double>, "OpenCL C has float and double");
+
+    static constexpr size_t N = plan::N;
+    static constexpr size_t operands = plan::operands;
+    static constexpr size_t terms = result_type::size() * power<N,plan::summed_degree>::value;
+    static constexpr std::array<size_t,operands> sizes = { Tensors::size()... };
+
+    EinsumCodegenOptions options;
+
+    char const * type_name() const { return std::is_same_v<T,float> ? "float" : "double"; }
+
+    std::string parameters(bool kernel) const {
+        bool cl = options.language == EinsumLanguage::opencl;
+        std::string global = cl ? "global " : "";
+        std::string qualifier = kernel ? "" : (cl ? " restrict" : " __restrict");
+        std::ostringstream os;
+        for(size_t o = 0; o < operands; ++o) {
+            os << global << "const " << type_name() << " *" << qualifier << " a" << o << ", ";
+        }
+        os << global << type_name() << " *" << qualifier << " out";
+        return os.str();
+    }
+
+    // the offset of a digit vector along the given strides, as a literal
+    template<size_t D>
+    static size_t offset(std::array<size_t,D> const & digits, std::array<size_t,D> const & strides) {
+        size_t off = 0;
+        for(size_t d = 0; d < D; ++d) off += digits[d] * strides[d];
+        return off;
+    }
+
+    // the offset of the loop variables v0, v1... along the given strides, zero strides left out
+    template<size_t D>
+    static std::string offset_expression(char const * variable, std::array<size_t,D> const & strides) {
+        std::ostringstream os;
+        for(size_t d = 0; d < D; ++d) {
+            if(strides[d] == 0) continue;
+            if(os.tellp() > 0) os << " + ";
+            os << variable << d;
+            if(strides[d] != 1) os << " * " << strides[d];
+        }
+        return os.tellp() > 0 ? os.str() : "0";
+    }
+
+    // steps a digit vector in storage order, false after the last
+    template<size_t D>
+    static bool next(std::array<size_t,D> & digits) {
+        for(size_t d = 0; d < D; ++d) {
+            if(++digits[d] < N) return true;
+            digits[d] = 0;
+        }
+        return false;
+    }
+
+    void unrolled_body(std::ostream & os) const {
+        std::array<size_t,plan::free_degree> free{};
+        do {
+            os << "    out[" << offset(free, plan::free_strides[0]) << "] =";
+            std::array<size_t,plan::summed_degree> summed{};
+            bool first = true;
+            do {
+                os << (first ? " " : " + ");
+                first = false;
+                for(size_t o = 0; o < operands; ++o) {
+                    size_t off = offset(free, plan::free_strides[o + 1]) + offset(summed, plan::summed_strides[o]);
+                    os << (o ? " * " : "") << "a" << o << "[" << off << "]";
+                }
+            } while(next(summed));
+            os << ";\n";
+        } while(next(free));
+    }
+
+    void loop_body(std::ostream & os) const {
+        std::string indent = "    ";
+        for(size_t r = plan::free_degree; r-- > 0;) {
+            os << indent << "for(int i" << r << " = 0; i" << r << " < " << N << "; ++i" << r << ") { // "
+               << plan::expression.result[r] << "\n";
+            indent += "    ";
+        }
+        os << indent << type_name() << " sum = 0;\n";
+        std::string inner = indent;
+        for(size_t k = plan::summed_degree; k-- > 0;) {
+            os << inner << "for(int s" << k << " = 0; s" << k << " < " << N << "; ++s" << k << ") { // "
+               << plan::summed_labels[k] << "\n";
+            inner += "    ";
+        }
+        os << inner << "sum +=";
+        for(size_t o = 0; o < operands; ++o) {
+            std::string f = offset_expression("i", plan::free_strides[o + 1]);
+            std::string s = offset_expression("s", plan::summed_strides[o]);
+            os << (o ? " * " : " ") << "a" << o << "["
+               << (f == "0" ? s : s == "0" ? f : f + " + " + s) << "]";
+        }
+        os << ";\n";
+        for(size_t k = 0; k < plan::summed_degree; ++k) {
+            inner.resize(inner.size() - 4);
+            os << inner << "}\n";
+        }
+        os << indent << "out[" << offset_expression("i", plan::free_strides[0]) << "] = sum;\n";
+        for(size_t r = 0; r < plan::free_degree; ++r) {
+            indent.resize(indent.size() - 4);
+            os << indent << "}\n";
+        }
+    }
+
+    std::string source(std::string const & name) const {
+        std::ostringstream os;
+        bool cl = options.language == EinsumLanguage::opencl;
+        if(cl && std::is_same_v<T,double>) {
+            os << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+        }
+        os << "// einsum \"" << S.view() << "\"\n";
+        os << (cl ? "" : "inline ") << "void " << name << "(" << parameters(false) << ") {\n";
+        if(terms <= options.max_unrolled_terms) {
+            unrolled_body(os);
+        } else {
+            loop_body(os);
+        }
+        os << "}\n";
+
+        if(cl) {
+            os << "kernel void " << name << "_kernel(" << parameters(true) << ") {\n";
+            os << "    size_t i = get_global_id(0);\n";
+            os << "    " << name << "(";
+            for(size_t o = 0; o < operands; ++o) {
+                os << "a" << o << " + " << sizes[o] << " * i, ";
+            }
+            os << "out + " << result_type::size() << " * i);\n";
+            os << "}\n";
+        }
+        return os.str();
+    }
+};
+
+// keeps the overload without options from reading the options as an operand
+template<typename T>
+concept einsum_tensor = requires { einsum_operand<T>::degree; };
+
+// the source of a function computing einsum<S> on tensors of the types of operands
+template<fixed_string S, typename ... Tensors>
+    requires (einsum_tensor<Tensors> && ...) && einsum_compatible<S,Tensors...>
+std::string einsum_source(std::string const & name, EinsumCodegenOptions options, Tensors const & ...) {
+    return EinsumCodegen<S,Tensors...>{ options }.source(name);
+}
+
+template<fixed_string S, typename ... Tensors>
+    requires (einsum_tensor<Tensors> && ...) && einsum_compatible<S,Tensors...>
+std::string einsum_source(std::string const & name, Tensors const & ... operands) {
+    return einsum_source<S>(name, EinsumCodegenOptions{}, operands...);
+}
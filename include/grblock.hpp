@@ -3,24 +3,52 @@
 #include <cstddef>
 #include <tuple>
 #include <cmath>
+#include <vector>
 
 #include "tensor.hpp"
+#include "packed_tensor.hpp"
+#include "reduced_precision.hpp"
+#include "cpu_dispatch.hpp"
+#include "trace.hpp"
 
 using std::tie;
 
-typedef Tensor<float,4,Contravariant>                               vector_type;
-typedef Tensor<float,4,Covariant,Covariant>                         metric_type;
-typedef Tensor<float,4,Covariant,Covariant,Covariant>               metric_derivative_type;
-typedef Tensor<float,4,Covariant,Contravariant,Contravariant>       inverse_derivative_type;
-typedef Tensor<float,4,Covariant,Covariant,Covariant,Covariant>     metric_2nd_derivative_type;
-typedef Tensor<float,4,Contravariant, Covariant,Covariant>          connection_type;
-typedef Tensor<float,4,Covariant,Covariant>                         ricci_type;
-typedef Tensor<float,4,Contravariant,Covariant,Covariant,Covariant> riemann_type;
+// the metric is symmetric and so is each derivative of it in the derivative indices
+template<typename T> using basic_vector_type = Tensor<T,4,Contravariant>;
+template<typename T> using basic_metric_type = PackedTensor<T,4,symmetry<2>,Covariant,Covariant>;
+template<typename T> using basic_metric_derivative_type = PackedTensor<T,4,symmetry<1,2>,Covariant,Covariant,Covariant>;
+template<typename T> using basic_inverse_derivative_type = PackedTensor<T,4,symmetry<1,2>,Covariant,Contravariant,Contravariant>;
+template<typename T> using basic_metric_2nd_derivative_type = PackedTensor<T,4,symmetry<2,2>,Covariant,Covariant,Covariant,Covariant>;
+template<typename T> using basic_connection_type = PackedTensor<T,4,symmetry<1,2>,Contravariant,Covariant,Covariant>;
+template<typename T> using basic_ricci_type = Tensor<T,4,Covariant,Covariant>;
+template<typename T> using basic_riemann_type = Tensor<T,4,Contravariant,Covariant,Covariant,Covariant>;
+
+typedef basic_vector_type<float>                vector_type;
+typedef basic_metric_type<float>                metric_type;
+typedef basic_metric_derivative_type<float>     metric_derivative_type;
+typedef basic_inverse_derivative_type<float>    inverse_derivative_type;
+typedef basic_metric_2nd_derivative_type<float> metric_2nd_derivative_type;
+typedef basic_connection_type<float>            connection_type;
+typedef basic_ricci_type<float>                 ricci_type;
+typedef basic_riemann_type<float>               riemann_type;
+
+
+
+/* The fields are stored as T and the curvature kernels sum in Accumulator, so
+   BasicGRElement<float,double> keeps the float footprint but does not lose
+   the small differences that dominate near a horizon. */
+template<typename T, typename Accumulator = T>
+struct BasicGRElement {
+    typedef T element_type;
+    typedef Accumulator accumulator_type;
+    typedef basic_metric_type<T> metric_type;
+    typedef basic_metric_derivative_type<T> metric_derivative_type;
+    typedef basic_inverse_derivative_type<T> inverse_derivative_type;
+    typedef basic_metric_2nd_derivative_type<T> metric_2nd_derivative_type;
+    typedef basic_connection_type<T> connection_type;
+    typedef basic_ricci_type<T> ricci_type;
+    typedef basic_riemann_type<T> riemann_type;
 
-
-
- 
-struct GRElement {
     // vector_type corner_min, corner_max;
     metric_type metric;
     metric_type inverse;
@@ -29,10 +57,61 @@ struct GRElement {
     metric_2nd_derivative_type metric_2nd_derivative;
 
 
+    // the baseline build, for GRElement see curvature_kernels()
     ricci_type ricci() const;
     ricci_type ricci2() const;
     connection_type connection() const;
     riemann_type riemann() const;
+
+    // the metric inverse and connection in the accumulator type, for the kernels that build on them
+    PackedTensor<Accumulator,4,symmetry<2>,Contravariant,Contravariant> accumulated_inverse() const;
+    template<typename U>
+    basic_connection_type<U> connection_as() const;
+};
+
+typedef BasicGRElement<float> GRElement;
+typedef BasicGRElement<double> DoubleGRElement;
+typedef BasicGRElement<float,double> MixedGRElement;
+
+// the same element in another scalar type, converted component by component
+template<typename To, typename T, typename Accumulator>
+To element_cast(BasicGRElement<T,Accumulator> const & e) {
+    To ret;
+    auto copy = [](auto & to, auto const & from) {
+        for(size_t i = 0; i < from.size(); ++i) to[i] = from[i];
+    };
+    copy(ret.metric, e.metric);
+    copy(ret.inverse, e.inverse);
+    copy(ret.metric_derivative, e.metric_derivative);
+    copy(ret.inverse_derivative, e.inverse_derivative);
+    copy(ret.metric_2nd_derivative, e.metric_2nd_derivative);
+    return ret;
+}
+
+/* A GRElement stored as fp16 or bf16, half the bytes in memory and on disk.
+   Curvature is computed on the float GRElement that load() returns. */
+template<typename Storage>
+struct CompactGRElement {
+    CompactTensor<Storage,metric_type> metric;
+    CompactTensor<Storage,metric_type> inverse;
+    CompactTensor<Storage,metric_derivative_type> metric_derivative;
+    CompactTensor<Storage,inverse_derivative_type> inverse_derivative;
+    CompactTensor<Storage,metric_2nd_derivative_type> metric_2nd_derivative;
+
+    CompactGRElement() {}
+    explicit CompactGRElement(GRElement const & e) { store(e); }
+
+    void store(GRElement const & e) {
+        metric.store(e.metric);
+        inverse.store(e.inverse);
+        metric_derivative.store(e.metric_derivative);
+        inverse_derivative.store(e.inverse_derivative);
+        metric_2nd_derivative.store(e.metric_2nd_derivative);
+    }
+    GRElement load() const {
+        return GRElement{ metric.load(), inverse.load(), metric_derivative.load(),
+                          inverse_derivative.load(), metric_2nd_derivative.load() };
+    }
 };
 
 /* R_{a b} =  1/2 \partial_{c}(g^{c d}) \partial_{a}(g_{b d}) +  
@@ -52,35 +131,30 @@ struct GRElement {
                                 1/4 \partial_{a}(g_{c e}) \partial_{b}(g_{d f})
                               )
 */
-ricci_type GRElement::ricci() const {
-    ricci_type ret;
+template<typename T, typename Accumulator>
+typename BasicGRElement<T,Accumulator>::ricci_type BasicGRElement<T,Accumulator>::ricci() const {
+    GRAVITATE_TRACE_SCOPE("curvature", "ricci");
 
-    typedef Tensor<float,4,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant> parenthetical_type;
-    auto rbeg = ret.begin();
+    ricci_type ret;
 
-    std::for_each(/*std::execution::par_unseq, */rbeg, ret.end(), [&](float & v) {
-        size_t u = &v - rbeg; // get the index to this element
+    typedef Tensor<T,4,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant> parenthetical_type;
 
-        // get the indices of this element in the ricci tensor
-        auto dims = ret.dimension(u);
-        size_t a, b;
-        tie(a, b) = dims;
+    for_each_index<4,2>([&](size_t u, auto const & dims) {
+        T & v = ret[u];
 
-        float sum = 0.;
+        // name the indices of this element in the ricci tensor
+        size_t a = dims[0], b = dims[1];
 
-        inverse_derivative.print(std::cout);
-        std::cout << std::endl;
-        metric_derivative.print(std::cout);
-        std::cout << std::endl;
+        Accumulator sum = 0.;
 
         // contractions on the first four terms
 
         for(size_t c = 0; c < parenthetical_type::dimensions; c++)
         for(size_t d = 0; d < parenthetical_type::dimensions; d++) {
-            sum += inverse_derivative({c, c, d}) * metric_derivative({a, b, d}) 
-                 + inverse_derivative({c, c, d}) * metric_derivative({b, a, d})
-                 - inverse_derivative({c, c, d}) * metric_derivative({d, a, b})
-                 - inverse_derivative({b, c, d}) * metric_derivative({a, c, d});
+            sum += Accumulator(inverse_derivative({c, c, d})) * metric_derivative({a, b, d}) 
+                 + Accumulator(inverse_derivative({c, c, d})) * metric_derivative({b, a, d})
+                 - Accumulator(inverse_derivative({c, c, d})) * metric_derivative({d, a, b})
+                 - Accumulator(inverse_derivative({b, c, d})) * metric_derivative({a, c, d});
 
             if(std::isnan(sum)) {
                 std::cerr << "sum is NaN after step " << c << ", " << d << std::endl;
@@ -95,17 +169,13 @@ firstFourOuterLoop:
             throw std::logic_error("sum is NaN after first four terms");
         }
 
-        // the next four terms are evaluated similarly
-        for(size_t c = 0; c < parenthetical_type::dimensions; c++)
-        for(size_t d = 0; d < parenthetical_type::dimensions; d++) {
-            float temp = metric_2nd_derivative({a, c, b, d})
-                       + metric_2nd_derivative({b, c, a, d})
-                       - metric_2nd_derivative({c, d, a, b})
-                       - metric_2nd_derivative({a, b, c, d});
-            temp *= 0.5 * inverse({c, d});
-
-            sum += temp;
-        }
+        // the next four terms are evaluated similarly, g^{cd} is symmetric so each pair is visited once
+        sum += 0.5 * contract_symmetric<Accumulator>(inverse, [&](size_t c, size_t d) {
+            return Accumulator(metric_2nd_derivative({a, c, b, d}))
+                 + metric_2nd_derivative({b, c, a, d})
+                 - metric_2nd_derivative({c, d, a, b})
+                 - metric_2nd_derivative({a, b, c, d});
+        });
 
 
         if(std::isnan(sum)) {
@@ -113,22 +183,17 @@ firstFourOuterLoop:
             throw std::logic_error("sum is NaN after second four terms");
         }
 
-        // the remaining six terms require four contractions
-        for(size_t c = 0; c < parenthetical_type::dimensions; c++)
-        for(size_t d = 0; d < parenthetical_type::dimensions; d++)
-        for(size_t e = 0; e < parenthetical_type::dimensions; e++)
-        for(size_t f = 0; f < parenthetical_type::dimensions; f++) {
-            float temp = 0.25 * metric_derivative({a, b, c}) * metric_derivative({d, e, f})
-                       + 0.25 * metric_derivative({b, a, c}) * metric_derivative({d, e, f})
-                       - 0.25 * metric_derivative({c, a, b}) * metric_derivative({d, e, f})
-                       - 0.5  * metric_derivative({c, a, e}) * metric_derivative({f, b, d})
-                       + 0.5  * metric_derivative({c, a, e}) * metric_derivative({d, b, f})
-                       - 0.25 * metric_derivative({a, c, e}) * metric_derivative({b, d, f});
-            
-            temp *= inverse({c, d}) * inverse({e, f});
-
-            sum += temp;
-        }
+        // the remaining six terms require four contractions, again over symmetric pairs
+        sum += contract_symmetric<Accumulator>(inverse, [&](size_t c, size_t d) {
+            return contract_symmetric<Accumulator>(inverse, [&](size_t e, size_t f) {
+                return 0.25 * metric_derivative({a, b, c}) * metric_derivative({d, e, f})
+                     + 0.25 * metric_derivative({b, a, c}) * metric_derivative({d, e, f})
+                     - 0.25 * metric_derivative({c, a, b}) * metric_derivative({d, e, f})
+                     - 0.5  * metric_derivative({c, a, e}) * metric_derivative({f, b, d})
+                     + 0.5  * metric_derivative({c, a, e}) * metric_derivative({d, b, f})
+                     - 0.25 * metric_derivative({a, c, e}) * metric_derivative({b, d, f});
+            });
+        });
 
         if(std::isnan(sum)) {
             std::cerr << "sum is NaN after last six terms" << std::endl;
@@ -149,80 +214,40 @@ using this formula:
 R_{ab} = \frac{1}{2} g^{cd} \( ∂_a ∂_c g_{bd} + ∂_b ∂_d g_{ac} - ∂_a ∂_d g_{bc} - ∂_b ∂_c g_{ad} \) +
          \frac{1}{2} \( g^{ce} Γ^d_{ec} - g^{de} Γ^c_{ed} \)\( Γ^e_{ad} - Γ^e_{ab} \)
 */
-ricci_type GRElement::ricci2() const {
-    // TODO: figure out a caching strategy for the metric inverse
-    auto inv = invert(metric);
-    auto conn = connection();
-
-    ricci_type ret;
-
-    typedef Tensor<float,4,Covariant,Covariant,Contravariant,Contravariant,Covariant,Covariant> parenthetical_type;
-
-    auto rbeg = ret.begin();
-    std::transform(std::execution::par_unseq, rbeg, ret.end(), rbeg, [&](float & v) -> float {
-        size_t u = &v - rbeg; // get the index to this element
-
-        // calculate the indices in this tensor
-        auto dims = ret.dimension(u);
+template<typename T, typename Accumulator>
+typename BasicGRElement<T,Accumulator>::ricci_type BasicGRElement<T,Accumulator>::ricci2() const {
+    GRAVITATE_TRACE_SCOPE("curvature", "ricci2");
 
-        // uncontract the indices to the parenthetical type
-        auto uncontracted = tuple_cat(dims, tuple<size_t,size_t,size_t,size_t>{0,0,0,0});
-        
-        // get the initial index into the parenthetical type
-        auto uncontracted_index = parenthetical_type::index(uncontracted);
-
-        // get the stride assuming two contractions on the 2,4 3,5 indices
-        static constexpr size_t stride = tensor_stride<4,2,3,4,5>::value;
-
-        // add up all the contracted elements
-        // TODO: this should be paralized, but it's trickier because there is no storage array for these elements
-
-        float sum = 0;
-        for(size_t i = 0; i < power<4,4>::value; ++i, uncontracted_index += stride) {
-            // turn these back into dimensions
-            auto pdims = parenthetical_type::dimension(uncontracted_index);
-
-            // name all the dimensions
-            size_t a, b, c, d, e, f;
-            tie(a,b,c,d,e,f) = pdims;
-
-            // now grab the elements of the contractions and add them to the sum
-            sum += inv({c,d}) * ( metric_2nd_derivative({a,c,b,d}) +
-                                  metric_2nd_derivative({b,d,a,c}) -
-                                  metric_2nd_derivative({a,d,b,c}) -
-                                  metric_2nd_derivative({b,c,a,d}) );
-
-            sum += inv({c,e}) * conn({d,e,c}) - inv({d,e}) * conn({c,e,d});
+    // TODO: figure out a caching strategy for the metric inverse
+    auto inv = accumulated_inverse();
+    auto conn = connection_as<Accumulator>();
+
+    ricci_type ret(true); // uninitialized
+
+    for_each_index<4,2>([&](size_t u, auto const & dims) {
+        size_t a = dims[0], b = dims[1];
+
+        Accumulator sum = 0;
+
+        // g^{cd} ( ∂_a ∂_c g_{bd} + ∂_b ∂_d g_{ac} - ∂_a ∂_d g_{bc} - ∂_b ∂_c g_{ad} )
+        sum += contract_symmetric<Accumulator>(inv, [&](size_t c, size_t d) -> Accumulator {
+            return Accumulator(metric_2nd_derivative.unchecked(a,c,b,d)) +
+                   metric_2nd_derivative.unchecked(b,d,a,c) -
+                   metric_2nd_derivative.unchecked(a,d,b,c) -
+                   metric_2nd_derivative.unchecked(b,c,a,d);
+        });
+
+        // ( g^{ce} Γ^d_{ec} - g^{de} Γ^c_{ed} ) ( Γ^e_{ad} - Γ^e_{ab} )
+        for(size_t c = 0; c < 4; ++c)
+        for(size_t d = 0; d < 4; ++d)
+        for(size_t e = 0; e < 4; ++e) {
+            sum += (Accumulator(inv.unchecked(c,e)) * conn.unchecked(d,e,c) - Accumulator(inv.unchecked(d,e)) * conn.unchecked(c,e,d)) *
+                   (Accumulator(conn.unchecked(e,a,d)) - conn.unchecked(e,a,b));
         }
 
-        return 0.5 * sum;
+        ret[u] = 0.5 * sum;
     });
 
-
-    // A will hold the inner first parenthetical
-    Tensor<float,4,Covariant,Covariant,Covariant,Covariant> A(false);
-
-
-
-    auto abeg = A.begin();
-    std::transform(std::execution::par_unseq, abeg, A.end(), abeg, [&](float & v) -> float {
-        size_t u = &v - abeg; // get the index to this element
-
-        // calculate the indices in this tensor
-        auto dims = A.dimension(u);
-
-        // name each of the indices
-        size_t a, b, c, d;
-        tie(a,b,c,d) = dims;
-
-        return 0.5 * (metric_2nd_derivative({a,c,b,d}) + 
-                      metric_2nd_derivative({b,d,a,c}) - 
-                      metric_2nd_derivative({a,d,b,c}) - 
-                      metric_2nd_derivative({b,c,a,d}));
-    });
-
-
-
     return ret;
 }
 
@@ -231,27 +256,104 @@ ricci_type GRElement::ricci2() const {
 calculates the metric parameters from the metric and derivative
 Γ^l_{jk} = \frac{1}{2} g^{lr} \( ∂_k g_{rj} + ∂_j g_{rk} - ∂_r g_{jk} \)
 */
-connection_type GRElement::connection() const {
+template<typename T, typename Accumulator>
+typename BasicGRElement<T,Accumulator>::connection_type BasicGRElement<T,Accumulator>::connection() const {
+    return connection_as<T>();
+}
+
+template<typename T, typename Accumulator>
+PackedTensor<Accumulator,4,symmetry<2>,Contravariant,Contravariant> BasicGRElement<T,Accumulator>::accumulated_inverse() const {
+    if constexpr(std::is_same_v<T,Accumulator>) {
+        return invert(metric);
+    } else {
+        basic_metric_type<Accumulator> g(false); // uninitialized
+        for(size_t i = 0; i < g.size(); ++i) g[i] = metric[i];
+        return invert(g);
+    }
+}
+
+template<typename T, typename Accumulator>
+template<typename U>
+basic_connection_type<U> BasicGRElement<T,Accumulator>::connection_as() const {
+    GRAVITATE_TRACE_SCOPE("curvature", "connection");
+
     // TODO: figure out a caching strategy for the metric inverse
-    auto inv = invert(metric);
+    auto inv = accumulated_inverse();
     
-    Tensor<float,4,Covariant,Covariant,Covariant> christoffel(false); // uninitialized
-
-    auto beg = christoffel.begin();
+    // Γ_{rkj} is symmetric in k and j, so only one of each pair is calculated
+    PackedTensor<Accumulator,4,symmetry<1,2>,Covariant,Covariant,Covariant> christoffel(false); // uninitialized
 
     // first calculate the inside of the parents
-    std::transform(std::execution::par_unseq, beg, christoffel.end(), beg, [&](float v) -> float {
-        size_t d = &v - beg; // get the index to this element
+    christoffel.for_each_slot([&](size_t u, auto const & p, size_t) {
+        size_t r = p[0], k = p[1], j = p[2];
 
-        // turn this into index into a set of indices
-        auto p = christoffel.dimension(d);
-        size_t k = get<0>(p), r = get<1>(p), j = get<2>(p);
+        christoffel[u] = 0.5 * (Accumulator(metric_derivative({k, r, j})) + metric_derivative({j, r, k}) - metric_derivative({r, j, k}));
+    });
 
-        return 0.5 * (metric_derivative({k, r, j}) + metric_derivative({j, r, k}) - metric_derivative({r, j, k}));
+    // raise the first index with the metric inverse
+    basic_connection_type<U> ret(false); // uninitialized
+    ret.for_each_slot([&](size_t u, auto const & p, size_t) {
+        size_t l = p[0], k = p[1], j = p[2];
+
+        Accumulator sum = 0;
+        for(size_t r = 0; r < 4; ++r) {
+            sum += inv.unchecked(l, r) * christoffel.unchecked(r, k, j);
+        }
+        ret[u] = sum;
     });
+    return ret;
+}
+
+/* The float curvature kernels compiled once per instruction set level, the
+   Tensor code they are built from inlined into each copy.  The member
+   functions GRElement::connection(), ricci() and ricci2() are compiled for the
+   baseline of the build only, so code that evaluates many elements has to call
+   through the table, curvature_kernels().ricci(e) rather than e.ricci(), to
+   get the widest vectors cpu_level() allows.  The levels agree to within a
+   couple of float ulps of the largest component, the rounding of fused
+   multiply adds. */
+struct CurvatureKernels {
+    char const * isa;
+    connection_type (*connection)(GRElement const & e);
+    ricci_type (*ricci)(GRElement const & e);
+    ricci_type (*ricci2)(GRElement const & e);
+};
+
+inline connection_type connection_portable(GRElement const & e) { return e.connection(); }
+inline ricci_type ricci_portable(GRElement const & e) { return e.ricci(); }
+inline ricci_type ricci2_portable(GRElement const & e) { return e.ricci2(); }
+
+#ifdef GRAVITATE_X86
+GRAVITATE_TARGET_AVX2 inline connection_type connection_avx2(GRElement const & e) { return e.connection(); }
+GRAVITATE_TARGET_AVX2 inline ricci_type ricci_avx2(GRElement const & e) { return e.ricci(); }
+GRAVITATE_TARGET_AVX2 inline ricci_type ricci2_avx2(GRElement const & e) { return e.ricci2(); }
+
+GRAVITATE_TARGET_AVX512 inline connection_type connection_avx512(GRElement const & e) { return e.connection(); }
+GRAVITATE_TARGET_AVX512 inline ricci_type ricci_avx512(GRElement const & e) { return e.ricci(); }
+GRAVITATE_TARGET_AVX512 inline ricci_type ricci2_avx512(GRElement const & e) { return e.ricci2(); }
+#endif
+
+// every implementation cpu_level() allows, the best last
+inline std::vector<CurvatureKernels> const & curvature_implementations() {
+    static std::vector<CurvatureKernels> const implementations = [] {
+        std::vector<CurvatureKernels> k;
+        k.push_back({ "portable", connection_portable, ricci_portable, ricci2_portable });
+#ifdef GRAVITATE_X86
+        if(cpu_supports(CpuLevel::avx2)) {
+            k.push_back({ "avx2", connection_avx2, ricci_avx2, ricci2_avx2 });
+        }
+        if(cpu_supports(CpuLevel::avx512)) {
+            k.push_back({ "avx512", connection_avx512, ricci_avx512, ricci2_avx512 });
+        }
+#endif
+        return k;
+    }();
+    return implementations;
+}
 
-    // multiply with contraction with the metric inverse
-    return inv.multiplyAndContract<1,3>(christoffel);
+inline CurvatureKernels const & curvature_kernels() {
+    static CurvatureKernels const & kernels = curvature_implementations().back();
+    return kernels;
 }
 
 
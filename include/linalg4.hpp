@@ -0,0 +1,502 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "cpu_dispatch.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/*
+4x4 linear algebra on Tensor<float,4,...>: inverse, determinant, matrix
+product and raising or lowering the index of a vector.
+
+There are four implementations behind one table of function pointers:
+  portable  plain scalar code, the reference
+  simd      4 wide GCC/Clang vector extensions, which is SSE on x86-64 and
+            NEON on ARM, with the inverse done as 2x2 blocks in registers
+  avx2      the simd kernels compiled with GRAVITATE_TARGET_AVX2, so VEX
+            encoded and with fused multiply adds, plus an 8 wide batched
+            inverse
+  avx512    the same compiled with GRAVITATE_TARGET_AVX512, with a 16 wide
+            batched inverse
+A single 4x4 matrix is one 4 wide vector per column at every level, the wider
+registers only pay off in the batched inverse.  linalg4_kernels() picks the
+best one cpu_level() allows the first time it is called.  Storage is Tensor storage, element (a, b) at a + 4 b.  The inverse and
+determinant do not depend on that choice since inverting commutes with
+transposing.
+
+invert_soa inverts a batch of matrices stored structure of arrays, component c
+of matrix i at in[c * stride + i], one matrix per vector lane.  A singular
+matrix comes out zero, as the Tensor invert() gives it.
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GRAVITATE_VECTOR_EXTENSIONS 1
+#endif
+
+// the kernels below are instantiated for several targets, inlining them makes
+// each copy use the instructions of the function it is called from
+#ifdef GRAVITATE_VECTOR_EXTENSIONS
+#define GRAVITATE_KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define GRAVITATE_KERNEL_INLINE inline
+#endif
+
+struct Linalg4Kernels {
+    char const * isa;
+    // false and out untouched if m is singular
+    bool (*invert)(float const * m, float * out);
+    float (*determinant)(float const * m);
+    // out = a b as 4x4 matrices, out must not alias a or b
+    void (*multiply)(float const * a, float const * b, float * out);
+    // out = a v
+    void (*multiply_vector)(float const * a, float const * v, float * out);
+    // returns the number of singular matrices, whose outputs are zero
+    size_t (*invert_soa)(float const * in, float * out, size_t count, size_t stride);
+};
+
+/* adjugate (transposed cofactors) and determinant of a 4x4 matrix, where V is
+   float or a vector of floats holding one matrix per lane */
+template<typename V>
+GRAVITATE_KERNEL_INLINE void adjugate4(V const * m, V * inv, V * det)
+{
+    inv[0] = m[5]  * m[10] * m[15] - 
+             m[5]  * m[11] * m[14] - 
+             m[9]  * m[6]  * m[15] + 
+             m[9]  * m[7]  * m[14] +
+             m[13] * m[6]  * m[11] - 
+             m[13] * m[7]  * m[10];
+
+    inv[4] = -m[4]  * m[10] * m[15] + 
+              m[4]  * m[11] * m[14] + 
+              m[8]  * m[6]  * m[15] - 
+              m[8]  * m[7]  * m[14] - 
+              m[12] * m[6]  * m[11] + 
+              m[12] * m[7]  * m[10];
+
+    inv[8] = m[4]  * m[9] * m[15] - 
+             m[4]  * m[11] * m[13] - 
+             m[8]  * m[5] * m[15] + 
+             m[8]  * m[7] * m[13] + 
+             m[12] * m[5] * m[11] - 
+             m[12] * m[7] * m[9];
+
+    inv[12] = -m[4]  * m[9] * m[14] + 
+               m[4]  * m[10] * m[13] +
+               m[8]  * m[5] * m[14] - 
+               m[8]  * m[6] * m[13] - 
+               m[12] * m[5] * m[10] + 
+               m[12] * m[6] * m[9];
+
+    inv[1] = -m[1]  * m[10] * m[15] + 
+              m[1]  * m[11] * m[14] + 
+              m[9]  * m[2] * m[15] - 
+              m[9]  * m[3] * m[14] - 
+              m[13] * m[2] * m[11] + 
+              m[13] * m[3] * m[10];
+
+    inv[5] = m[0]  * m[10] * m[15] - 
+             m[0]  * m[11] * m[14] - 
+             m[8]  * m[2] * m[15] + 
+             m[8]  * m[3] * m[14] + 
+             m[12] * m[2] * m[11] - 
+             m[12] * m[3] * m[10];
+
+    inv[9] = -m[0]  * m[9] * m[15] + 
+              m[0]  * m[11] * m[13] + 
+              m[8]  * m[1] * m[15] - 
+              m[8]  * m[3] * m[13] - 
+              m[12] * m[1] * m[11] + 
+              m[12] * m[3] * m[9];
+
+    inv[13] = m[0]  * m[9] * m[14] - 
+              m[0]  * m[10] * m[13] - 
+              m[8]  * m[1] * m[14] + 
+              m[8]  * m[2] * m[13] + 
+              m[12] * m[1] * m[10] - 
+              m[12] * m[2] * m[9];
+
+    inv[2] = m[1]  * m[6] * m[15] - 
+             m[1]  * m[7] * m[14] - 
+             m[5]  * m[2] * m[15] + 
+             m[5]  * m[3] * m[14] + 
+             m[13] * m[2] * m[7] - 
+             m[13] * m[3] * m[6];
+
+    inv[6] = -m[0]  * m[6] * m[15] + 
+              m[0]  * m[7] * m[14] + 
+              m[4]  * m[2] * m[15] - 
+              m[4]  * m[3] * m[14] - 
+              m[12] * m[2] * m[7] + 
+              m[12] * m[3] * m[6];
+
+    inv[10] = m[0]  * m[5] * m[15] - 
+              m[0]  * m[7] * m[13] - 
+              m[4]  * m[1] * m[15] + 
+              m[4]  * m[3] * m[13] + 
+              m[12] * m[1] * m[7] - 
+              m[12] * m[3] * m[5];
+
+    inv[14] = -m[0]  * m[5] * m[14] + 
+               m[0]  * m[6] * m[13] + 
+               m[4]  * m[1] * m[14] - 
+               m[4]  * m[2] * m[13] - 
+               m[12] * m[1] * m[6] + 
+               m[12] * m[2] * m[5];
+
+    inv[3] = -m[1] * m[6] * m[11] + 
+              m[1] * m[7] * m[10] + 
+              m[5] * m[2] * m[11] - 
+              m[5] * m[3] * m[10] - 
+              m[9] * m[2] * m[7] + 
+              m[9] * m[3] * m[6];
+
+    inv[7] = m[0] * m[6] * m[11] - 
+             m[0] * m[7] * m[10] - 
+             m[4] * m[2] * m[11] + 
+             m[4] * m[3] * m[10] + 
+             m[8] * m[2] * m[7] - 
+             m[8] * m[3] * m[6];
+
+    inv[11] = -m[0] * m[5] * m[11] + 
+               m[0] * m[7] * m[9] + 
+               m[4] * m[1] * m[11] - 
+               m[4] * m[3] * m[9] - 
+               m[8] * m[1] * m[7] + 
+               m[8] * m[3] * m[5];
+
+    inv[15] = m[0] * m[5] * m[10] - 
+              m[0] * m[6] * m[9] - 
+              m[4] * m[1] * m[10] + 
+              m[4] * m[2] * m[9] + 
+              m[8] * m[1] * m[6] - 
+              m[8] * m[2] * m[5];
+
+    *det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+}
+
+template<typename Number>
+bool invert(const Number * m, Number * invOut)
+{
+    Number inv[16], det;
+    adjugate4(m, inv, &det);
+
+    if (det == 0)
+        return false;
+
+    det = 1.0 / det;
+
+    for (int i = 0; i < 16; i++)
+        invOut[i] = inv[i] * det;
+
+    return true;
+}
+
+
+inline bool invert4_portable(float const * m, float * out) {
+    return invert(m, out);
+}
+
+inline float determinant4_portable(float const * m) {
+    float inv[16], det;
+    adjugate4(m, inv, &det);
+    return det;
+}
+
+inline void multiply4_portable(float const * a, float const * b, float * out) {
+    for(size_t c = 0; c < 4; ++c)
+    for(size_t r = 0; r < 4; ++r) {
+        float sum = 0;
+        for(size_t k = 0; k < 4; ++k) {
+            sum += a[r + 4 * k] * b[k + 4 * c];
+        }
+        out[r + 4 * c] = sum;
+    }
+}
+
+inline void multiply_vector4_portable(float const * a, float const * v, float * out) {
+    for(size_t r = 0; r < 4; ++r) {
+        float sum = 0;
+        for(size_t k = 0; k < 4; ++k) {
+            sum += a[r + 4 * k] * v[k];
+        }
+        out[r] = sum;
+    }
+}
+
+// inverts lanes matrices at once with V holding one matrix per lane, the rest one at a time
+template<typename V, size_t lanes>
+GRAVITATE_KERNEL_INLINE size_t invert_soa_lanes(float const * in, float * out, size_t count, size_t stride) {
+    size_t singular = 0;
+    size_t i = 0;
+    for(; i + lanes <= count; i += lanes) {
+        V m[16], inv[16], det;
+        for(size_t c = 0; c < 16; ++c) {
+            std::memcpy(&m[c], in + c * stride + i, sizeof(V));
+        }
+        adjugate4(m, inv, &det);
+        // zero rather than infinite where det is 0, selected per lane
+        V r = det != 0 ? 1.f / det : V{};
+        for(size_t c = 0; c < 16; ++c) {
+            V o = inv[c] * r;
+            std::memcpy(out + c * stride + i, &o, sizeof(V));
+        }
+        for(size_t l = 0; l < lanes; ++l) {
+            singular += det[l] == 0;
+        }
+    }
+    for(; i < count; ++i) {
+        float m[16], inv[16], det;
+        for(size_t c = 0; c < 16; ++c) m[c] = in[c * stride + i];
+        adjugate4(m, inv, &det);
+        singular += det == 0;
+        float r = det != 0 ? 1.f / det : 0.f;
+        for(size_t c = 0; c < 16; ++c) out[c * stride + i] = inv[c] * r;
+    }
+    return singular;
+}
+
+inline size_t invert_soa4_portable(float const * in, float * out, size_t count, size_t stride) {
+    size_t singular = 0;
+    for(size_t i = 0; i < count; ++i) {
+        float m[16], inv[16], det;
+        for(size_t c = 0; c < 16; ++c) m[c] = in[c * stride + i];
+        adjugate4(m, inv, &det);
+        singular += det == 0;
+        float r = det != 0 ? 1.f / det : 0.f;
+        for(size_t c = 0; c < 16; ++c) out[c * stride + i] = inv[c] * r;
+    }
+    return singular;
+}
+
+
+#ifdef GRAVITATE_VECTOR_EXTENSIONS
+
+typedef float float4_v __attribute__((vector_size(16)));
+
+#define GRAVITATE_SWIZZLE(v, x, y, z, w) __builtin_shufflevector(v, v, x, y, z, w)
+// x and y from a, z and w from b
+#define GRAVITATE_SHUFFLE(a, b, x, y, z, w) __builtin_shufflevector(a, b, x, y, (z) + 4, (w) + 4)
+
+inline float4_v load4(float const * p) { float4_v v; std::memcpy(&v, p, sizeof(v)); return v; }
+inline void store4(float * p, float4_v v) { std::memcpy(p, &v, sizeof(v)); }
+
+// products of 2x2 matrices held row major in one vector, # is the adjugate
+inline float4_v mat2_mul(float4_v a, float4_v b) {      // a b
+    return a * GRAVITATE_SWIZZLE(b, 0,3,0,3) + GRAVITATE_SWIZZLE(a, 1,0,3,2) * GRAVITATE_SWIZZLE(b, 2,1,2,1);
+}
+inline float4_v mat2_adj_mul(float4_v a, float4_v b) {  // a# b
+    return GRAVITATE_SWIZZLE(a, 3,3,0,0) * b - GRAVITATE_SWIZZLE(a, 1,1,2,2) * GRAVITATE_SWIZZLE(b, 2,3,0,1);
+}
+inline float4_v mat2_mul_adj(float4_v a, float4_v b) {  // a b#
+    return a * GRAVITATE_SWIZZLE(b, 3,0,3,0) - GRAVITATE_SWIZZLE(a, 1,0,3,2) * GRAVITATE_SWIZZLE(b, 2,1,2,1);
+}
+
+/* block inverse of M = [A B; C D] with 2x2 blocks, following the usual SSE
+   formulation: the adjugate blocks are
+     X# = |D| A - B (D# C)      Y# = |B| C - D (A# B)#
+     Z# = |C| B - A (D# C)#     W# = |A| D - C (A# B)
+   and |M| = |A||D| + |B||C| - tr((A# B)(D# C)) */
+struct Block4 {
+    float4_v x, y, z, w;
+    float det;
+};
+
+inline Block4 block_adjugate4(float const * m) {
+    float4_v r0 = load4(m), r1 = load4(m + 4), r2 = load4(m + 8), r3 = load4(m + 12);
+
+    float4_v a = GRAVITATE_SHUFFLE(r0, r1, 0,1,0,1);
+    float4_v b = GRAVITATE_SHUFFLE(r0, r1, 2,3,2,3);
+    float4_v c = GRAVITATE_SHUFFLE(r2, r3, 0,1,0,1);
+    float4_v d = GRAVITATE_SHUFFLE(r2, r3, 2,3,2,3);
+
+    // |A| |B| |C| |D|
+    float4_v dets = GRAVITATE_SHUFFLE(r0, r2, 0,2,0,2) * GRAVITATE_SHUFFLE(r1, r3, 1,3,1,3)
+                  - GRAVITATE_SHUFFLE(r0, r2, 1,3,1,3) * GRAVITATE_SHUFFLE(r1, r3, 0,2,0,2);
+    float4_v det_a = GRAVITATE_SWIZZLE(dets, 0,0,0,0);
+    float4_v det_b = GRAVITATE_SWIZZLE(dets, 1,1,1,1);
+    float4_v det_c = GRAVITATE_SWIZZLE(dets, 2,2,2,2);
+    float4_v det_d = GRAVITATE_SWIZZLE(dets, 3,3,3,3);
+
+    float4_v d_c = mat2_adj_mul(d, c);
+    float4_v a_b = mat2_adj_mul(a, b);
+
+    Block4 r;
+    r.x = det_d * a - mat2_mul(b, d_c);
+    r.w = det_a * d - mat2_mul(c, a_b);
+    r.y = det_b * c - mat2_mul_adj(d, a_b);
+    r.z = det_c * b - mat2_mul_adj(a, d_c);
+
+    float4_v tr = a_b * GRAVITATE_SWIZZLE(d_c, 0,2,1,3);
+    r.det = dets[0] * dets[3] + dets[1] * dets[2] - ((tr[0] + tr[1]) + (tr[2] + tr[3]));
+    return r;
+}
+
+inline bool invert4_simd(float const * m, float * out) {
+    Block4 b = block_adjugate4(m);
+    if(b.det == 0) {
+        return false;
+    }
+
+    float4_v r = float4_v{ 1.f, -1.f, -1.f, 1.f } / b.det;
+    float4_v x = b.x * r, y = b.y * r, z = b.z * r, w = b.w * r;
+
+    // transpose the blocks back into place while storing
+    store4(out,      GRAVITATE_SHUFFLE(x, y, 3,1,3,1));
+    store4(out + 4,  GRAVITATE_SHUFFLE(x, y, 2,0,2,0));
+    store4(out + 8,  GRAVITATE_SHUFFLE(z, w, 3,1,3,1));
+    store4(out + 12, GRAVITATE_SHUFFLE(z, w, 2,0,2,0));
+    return true;
+}
+
+inline float determinant4_simd(float const * m) {
+    return block_adjugate4(m).det;
+}
+
+// every column of the product is a combination of the columns of a
+inline void multiply4_simd(float const * a, float const * b, float * out) {
+    float4_v a0 = load4(a), a1 = load4(a + 4), a2 = load4(a + 8), a3 = load4(a + 12);
+    for(size_t c = 0; c < 4; ++c) {
+        float const * bc = b + 4 * c;
+        store4(out + 4 * c, a0 * bc[0] + a1 * bc[1] + a2 * bc[2] + a3 * bc[3]);
+    }
+}
+
+inline void multiply_vector4_simd(float const * a, float const * v, float * out) {
+    store4(out, load4(a) * v[0] + load4(a + 4) * v[1] + load4(a + 8) * v[2] + load4(a + 12) * v[3]);
+}
+
+inline size_t invert_soa4_simd(float const * in, float * out, size_t count, size_t stride) {
+    return invert_soa_lanes<float4_v,4>(in, out, count, stride);
+}
+
+#ifdef GRAVITATE_X86
+typedef float float8_v __attribute__((vector_size(32)));
+typedef float float16_v __attribute__((vector_size(64)));
+
+GRAVITATE_TARGET_AVX2 inline bool invert4_avx2(float const * m, float * out) { return invert4_simd(m, out); }
+GRAVITATE_TARGET_AVX2 inline float determinant4_avx2(float const * m) { return determinant4_simd(m); }
+GRAVITATE_TARGET_AVX2 inline void multiply4_avx2(float const * a, float const * b, float * out) { multiply4_simd(a, b, out); }
+GRAVITATE_TARGET_AVX2 inline void multiply_vector4_avx2(float const * a, float const * v, float * out) { multiply_vector4_simd(a, v, out); }
+GRAVITATE_TARGET_AVX2 inline size_t invert_soa4_avx2(float const * in, float * out, size_t count, size_t stride) {
+    return invert_soa_lanes<float8_v,8>(in, out, count, stride);
+}
+
+GRAVITATE_TARGET_AVX512 inline bool invert4_avx512(float const * m, float * out) { return invert4_simd(m, out); }
+GRAVITATE_TARGET_AVX512 inline float determinant4_avx512(float const * m) { return determinant4_simd(m); }
+GRAVITATE_TARGET_AVX512 inline void multiply4_avx512(float const * a, float const * b, float * out) { multiply4_simd(a, b, out); }
+GRAVITATE_TARGET_AVX512 inline void multiply_vector4_avx512(float const * a, float const * v, float * out) { multiply_vector4_simd(a, v, out); }
+GRAVITATE_TARGET_AVX512 inline size_t invert_soa4_avx512(float const * in, float * out, size_t count, size_t stride) {
+    return invert_soa_lanes<float16_v,16>(in, out, count, stride);
+}
+#endif
+
+#endif // GRAVITATE_VECTOR_EXTENSIONS
+
+
+// every implementation this CPU can run, the best last
+inline std::vector<Linalg4Kernels> const & linalg4_implementations() {
+    static std::vector<Linalg4Kernels> const implementations = [] {
+        std::vector<Linalg4Kernels> k;
+        k.push_back({ "portable", invert4_portable, determinant4_portable, multiply4_portable,
+                      multiply_vector4_portable, invert_soa4_portable });
+#ifdef GRAVITATE_VECTOR_EXTENSIONS
+        k.push_back({ "simd", invert4_simd, determinant4_simd, multiply4_simd,
+                      multiply_vector4_simd, invert_soa4_simd });
+#ifdef GRAVITATE_X86
+        if(cpu_supports(CpuLevel::avx2)) {
+            k.push_back({ "avx2", invert4_avx2, determinant4_avx2, multiply4_avx2,
+                          multiply_vector4_avx2, invert_soa4_avx2 });
+        }
+        if(cpu_supports(CpuLevel::avx512)) {
+            k.push_back({ "avx512", invert4_avx512, determinant4_avx512, multiply4_avx512,
+                          multiply_vector4_avx512, invert_soa4_avx512 });
+        }
+#endif
+#endif
+        return k;
+    }();
+    return implementations;
+}
+
+// the kernels used by the Tensor overloads below, chosen once
+inline Linalg4Kernels const & linalg4_kernels() {
+    static Linalg4Kernels const & kernels = linalg4_implementations().back();
+    return kernels;
+}
+
+
+/* other scalar types go to the portable code, which is templated on the
+   scalar, so a double metric is inverted in double */
+template<typename T>
+bool invert4(T const * m, T * out) {
+    if constexpr(std::is_same_v<T,float>) {
+        return linalg4_kernels().invert(m, out);
+    } else {
+        return invert(m, out);
+    }
+}
+
+template<typename T>
+T determinant4(T const * m) {
+    if constexpr(std::is_same_v<T,float>) {
+        return linalg4_kernels().determinant(m);
+    } else {
+        T inv[16], det;
+        adjugate4(m, inv, &det);
+        return det;
+    }
+}
+
+template<typename T, typename A, typename B>
+T determinant(Tensor<T,4,A,B> const & m) {
+    return determinant4(&m[0]);
+}
+
+// the inverse of g_ab is g^ab and the other way around, a singular matrix gives zero
+template<typename T>
+Tensor<T,4,Contravariant,Contravariant> invert(Tensor<T,4,Covariant,Covariant> const & in) {
+    Tensor<T,4,Contravariant,Contravariant> out(true); // uninitialized
+    if(!invert4(&in[0], &out[0])) {
+        out = Tensor<T,4,Contravariant,Contravariant>();
+    }
+    return out;
+}
+
+template<typename T>
+Tensor<T,4,Covariant,Covariant> invert(Tensor<T,4,Contravariant,Contravariant> const & in) {
+    Tensor<T,4,Covariant,Covariant> out(true); // uninitialized
+    if(!invert4(&in[0], &out[0])) {
+        out = Tensor<T,4,Covariant,Covariant>();
+    }
+    return out;
+}
+
+// the inner indices are summed over, so one must be upper and the other lower
+template<typename B, typename C>
+concept contractible_variances = !std::is_same_v<B,C>;
+
+// a_{ab} b^{bc} and friends, the product of two 4x4 tensors over their inner indices
+template<typename A, typename B, typename C, typename D>
+    requires contractible_variances<B,C>
+Tensor<float,4,A,D> matrix_product(Tensor<float,4,A,B> const & a, Tensor<float,4,C,D> const & b) {
+    Tensor<float,4,A,D> out(true); // uninitialized
+    linalg4_kernels().multiply(&a[0], &b[0], &out[0]);
+    return out;
+}
+
+// v^a = g^{ab} v_b
+inline Tensor<float,4,Contravariant> raise(Tensor<float,4,Covariant> const & v, Tensor<float,4,Contravariant,Contravariant> const & inverse) {
+    Tensor<float,4,Contravariant> out(true); // uninitialized
+    linalg4_kernels().multiply_vector(&inverse[0], &v[0], &out[0]);
+    return out;
+}
+
+// v_a = g_{ab} v^b
+inline Tensor<float,4,Covariant> lower(Tensor<float,4,Contravariant> const & v, Tensor<float,4,Covariant,Covariant> const & metric) {
+    Tensor<float,4,Covariant> out(true); // uninitialized
+    linalg4_kernels().multiply_vector(&metric[0], &v[0], &out[0]);
+    return out;
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "linalg4.hpp"
+#include "tensor_expression.hpp"
+#include "detail/tensor_detail.hpp"
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+Tensors that are symmetric over groups of their indices, stored packed.
+
+symmetry<Ks...> splits the indices into consecutive groups of Ks indices, the
+tensor is unchanged by any permutation inside a group.  Only one component of
+every group is stored, for a group of K indices of dimension N that is
+(N+K-1 choose K) instead of N^K, so a metric takes 10 floats instead of 16 and
+a second derivative of the metric, symmetric in both pairs, 100 instead of 256.
+
+Indices are looked up through compile time tables, so g({1,2}) and g({2,1})
+are the same element and cost a couple of table loads.  Packed slots are laid
+out like Tensor storage with the first group moving fastest, inside a group
+the slot of the sorted indices i0 <= i1 <= ... is sum_m (i_m + m choose m + 1).
+*/
+
+template<size_t ... Ks>
+struct symmetry {};
+
+constexpr size_t binomial(size_t n, size_t k) {
+    if(k > n) return 0;
+    size_t r = 1;
+    for(size_t i = 1; i <= k; ++i) {
+        r = r * (n - k + i) / i;
+    }
+    return r;
+}
+
+// tables of one group of K symmetric indices of dimension N
+template<size_t N, size_t K>
+struct SymmetricGroup {
+    static constexpr size_t full_size = power<N,K>::value;
+    static constexpr size_t size = binomial(N + K - 1, K);
+
+    static constexpr size_t rank(std::array<size_t,K> indices) {
+        // insertion sort, K is tiny
+        for(size_t a = 1; a < K; ++a)
+            for(size_t b = a; b > 0 && indices[b] < indices[b - 1]; --b)
+                std::swap(indices[b], indices[b - 1]);
+
+        size_t slot = 0;
+        for(size_t m = 0; m < K; ++m) {
+            slot += binomial(indices[m] + m, m + 1);
+        }
+        return slot;
+    }
+
+    static constexpr std::array<size_t,K> unflatten(size_t flat) {
+        std::array<size_t,K> indices{};
+        for(size_t m = 0; m < K; ++m, flat /= N) {
+            indices[m] = flat % N;
+        }
+        return indices;
+    }
+
+    // slot of every combination of indices, in Tensor storage order
+    static constexpr std::array<size_t,full_size> slot_of = [] {
+        std::array<size_t,full_size> t{};
+        for(size_t f = 0; f < full_size; ++f) t[f] = rank(unflatten(f));
+        return t;
+    }();
+
+    // the sorted indices stored in every slot
+    static constexpr std::array<std::array<size_t,K>,size> indices_of = [] {
+        std::array<std::array<size_t,K>,size> t{};
+        for(size_t f = 0; f < full_size; ++f) {
+            auto i = unflatten(f);
+            bool sorted = true;
+            for(size_t m = 1; m < K; ++m) sorted = sorted && i[m - 1] <= i[m];
+            if(sorted) t[slot_of[f]] = i;
+        }
+        return t;
+    }();
+
+    // how many index combinations share every slot
+    static constexpr std::array<size_t,size> multiplicity = [] {
+        std::array<size_t,size> t{};
+        for(size_t f = 0; f < full_size; ++f) ++t[slot_of[f]];
+        return t;
+    }();
+};
+
+/* PackedGroups maps the indices of a tensor of degree D, symmetric in groups
+   of Ks indices, to packed offsets and back */
+template<size_t N, size_t D, size_t ... Ks>
+struct PackedGroups {
+    static constexpr size_t degree = D;
+    static constexpr size_t groups = sizeof...(Ks);
+    static constexpr size_t size = (SymmetricGroup<N,Ks>::size * ... * 1);
+
+    static constexpr std::array<size_t,groups> group_size = { Ks... };
+    static constexpr std::array<size_t,groups> group_start = [] {
+        std::array<size_t,groups> t{};
+        for(size_t g = 1; g < groups; ++g) t[g] = t[g - 1] + group_size[g - 1];
+        return t;
+    }();
+    static constexpr std::array<size_t,groups> group_stride = [] {
+        std::array<size_t,groups> t{};
+        std::array<size_t,groups> sizes = { SymmetricGroup<N,Ks>::size... };
+        size_t s = 1;
+        for(size_t g = 0; g < groups; ++g) {
+            t[g] = s;
+            s *= sizes[g];
+        }
+        return t;
+    }();
+
+    template<size_t g>
+    static constexpr size_t group_slot(std::array<size_t,degree> const & indices) {
+        constexpr size_t K = group_size[g];
+        if constexpr(K == 1) {
+            return indices[group_start[g]] * group_stride[g];
+        } else if constexpr(K == 2) {
+            // the closed form of the table for a pair, (lo choose 1) + (hi + 1 choose 2), without a load
+            size_t i = indices[group_start[g]], j = indices[group_start[g] + 1];
+            size_t lo = i < j ? i : j, hi = i + j - lo;
+            return (lo + hi * (hi + 1) / 2) * group_stride[g];
+        } else {
+            size_t flat = 0;
+            for(size_t k = K; k > 0; --k) {
+                flat = flat * N + indices[group_start[g] + k - 1];
+            }
+            return SymmetricGroup<N,K>::slot_of[flat] * group_stride[g];
+        }
+    }
+
+    template<size_t ... Gs>
+    static constexpr size_t offset_impl(std::array<size_t,degree> const & indices, std::index_sequence<Gs...>) {
+        return (size_t(0) + ... + group_slot<Gs>(indices));
+    }
+
+    template<size_t ... Gs>
+    static constexpr std::pair<std::array<size_t,degree>,size_t> slot_impl(size_t s, std::index_sequence<Gs...>) {
+        std::array<size_t,degree> indices{};
+        size_t multiplicity = 1;
+        ([&] {
+            constexpr size_t K = group_size[Gs];
+            size_t slot = s / group_stride[Gs] % SymmetricGroup<N,K>::size;
+            for(size_t k = 0; k < K; ++k) indices[group_start[Gs] + k] = SymmetricGroup<N,K>::indices_of[slot][k];
+            multiplicity *= SymmetricGroup<N,K>::multiplicity[slot];
+        }(), ...);
+        return { indices, multiplicity };
+    }
+
+    static constexpr size_t offset(std::array<size_t,degree> const & indices) {
+        return offset_impl(indices, std::make_index_sequence<groups>{});
+    }
+};
+
+// the indices and multiplicity of every packed slot, tabulated once the mapping is complete
+template<size_t N, size_t D, size_t ... Ks>
+struct PackedLayout : PackedGroups<N,D,Ks...> {
+    typedef PackedGroups<N,D,Ks...> groups_type;
+    using groups_type::degree;
+    using groups_type::groups;
+    using groups_type::size;
+
+    static constexpr std::array<std::array<size_t,degree>,size> slot_indices = [] {
+        std::array<std::array<size_t,degree>,size> t{};
+        for(size_t s = 0; s < size; ++s) t[s] = groups_type::slot_impl(s, std::make_index_sequence<groups>{}).first;
+        return t;
+    }();
+    static constexpr std::array<size_t,size> slot_multiplicity = [] {
+        std::array<size_t,size> t{};
+        for(size_t s = 0; s < size; ++s) t[s] = groups_type::slot_impl(s, std::make_index_sequence<groups>{}).second;
+        return t;
+    }();
+};
+
+template<typename T, size_t N, typename Symmetry, typename ... Variances>
+class PackedTensor;
+
+template<typename T, size_t N, size_t ... Ks, typename ... Variances>
+class PackedTensor<T,N,symmetry<Ks...>,Variances...> {
+public:
+    typedef PackedTensor<T,N,symmetry<Ks...>,Variances...> this_type;
+    typedef this_type tensor_type;
+    typedef Tensor<T,N,Variances...> unpacked_type;
+    typedef PackedLayout<N,sizeof...(Variances),Ks...> layout;
+    typedef T element_type;
+    typedef std::array<T,layout::size> data_type;
+    typedef typename data_type::iterator iterator;
+    typedef typename data_type::const_iterator const_iterator;
+    typedef typename index_type<Variances...>::type index_tuple;
+    typedef tensor_execution<T,std::tuple_size_v<data_type>> execution;
+
+    constexpr static size_t dimensions = N;
+    constexpr static size_t degree = sizeof...(Variances);
+    constexpr static size_t groups = sizeof...(Ks);
+    constexpr static size_t size() { return std::tuple_size_v<data_type>; }
+    constexpr static size_t full_size() { return unpacked_type::size(); }
+
+    static_assert((Ks + ... + 0) == degree, "the symmetric groups must cover every index");
+
+    PackedTensor() { data_.fill(0); }
+    PackedTensor(bool) {} // don't initialize data_
+    PackedTensor(data_type const & data) : data_(data) {}
+    // keeps one component of every symmetric set, the tensor is assumed to be symmetric
+    explicit PackedTensor(unpacked_type const & full);
+    template<tensor_expression_node_of<this_type> E>
+    PackedTensor(E const & expression) { assign(expression); }
+    template<tensor_expression_node_of<this_type> E>
+    this_type & operator=(E const & expression) { return assign(expression); }
+
+    unpacked_type unpack() const;
+
+    // packed offset of a full set of indices
+    static constexpr size_t offset(std::array<size_t,degree> const & indices) {
+        return layout::offset(indices);
+    }
+
+    bool operator==(this_type const & other) const { return data_ == other.data_; }
+    bool operator!=(this_type const & other) const { return !(*this == other); }
+
+    this_type & operator+=(this_type const & other) { return assign(*this + other); }
+    this_type & operator-=(this_type const & other) { return assign(*this - other); }
+    this_type & operator*=(T scalar) { return assign(*this * scalar); }
+    this_type & operator/=(T scalar) { return assign(*this / scalar); }
+
+    T & operator[](size_t index) { return data_[index]; }
+    T const & operator[](size_t index) const { return data_[index]; }
+    T & at(size_t index) { return data_.at(index); }
+    T const & at(size_t index) const { return data_.at(index); }
+
+    T & get(index_tuple index) { return data_[checked_offset(index)]; }
+    T const & get(index_tuple index) const { return data_[checked_offset(index)]; }
+
+    T & operator()(index_tuple index) { return data_[offset(to_array(index))]; }
+    T const & operator()(index_tuple index) const { return data_[offset(to_array(index))]; }
+
+    template<typename ... Is>
+    T & unchecked(Is ... is) { return data_[offset({size_t(is)...})]; }
+    template<typename ... Is>
+    T const & unchecked(Is ... is) const { return data_[offset({size_t(is)...})]; }
+
+    // representative (sorted within each group) indices and multiplicity of every packed slot
+    static constexpr auto const & slot_indices = layout::slot_indices;
+    static constexpr auto const & slot_multiplicity = layout::slot_multiplicity;
+
+    // calls f(slot, indices, multiplicity) once for every stored component
+    template<typename Function>
+    static void for_each_slot(Function && f) {
+        for(size_t s = 0; s < size(); ++s) {
+            f(s, slot_indices[s], slot_multiplicity[s]);
+        }
+    }
+
+    iterator begin() { return data_.begin(); }
+    const_iterator begin() const { return data_.begin(); }
+    iterator end() { return data_.end(); }
+    const_iterator end() const { return data_.end(); }
+
+    void print(std::ostream & os) const { unpack().print(os); }
+
+private:
+    data_type data_;
+
+    // indices inside a group must agree on their variance
+    static constexpr bool groups_share_variance = [] {
+        std::array<bool,degree> contravariant = { std::is_same_v<Variances,Contravariant>... };
+        for(size_t g = 0; g < groups; ++g)
+            for(size_t k = 1; k < layout::group_size[g]; ++k)
+                if(contravariant[layout::group_start[g] + k] != contravariant[layout::group_start[g]]) return false;
+        return true;
+    }();
+    static_assert(groups_share_variance, "symmetric indices must all be covariant or all contravariant");
+
+    static constexpr std::array<size_t,degree> to_array(index_tuple const & index) {
+        return std::apply([](auto ... is) { return std::array<size_t,degree>{ size_t(is)... }; }, index);
+    }
+
+    static size_t checked_offset(index_tuple const & index) {
+        auto indices = to_array(index);
+        for(auto i : indices) {
+            if(i >= N) throw std::out_of_range("PackedTensor index out of range");
+        }
+        return offset(indices);
+    }
+
+    template<typename E>
+    this_type & assign(E const & expression) {
+        constexpr size_t n = size(); // gcc drops the loop annotation on a call in the condition
+        GRAVITATE_ELEMENTWISE_LOOP
+        for(size_t i = 0; i < n; ++i) {
+            data_[i] = expression[i];
+        }
+        return *this;
+    }
+};
+
+template<typename T, size_t N, typename Symmetry, typename ... Variances>
+struct is_tensor<PackedTensor<T,N,Symmetry,Variances...>> : std::true_type {};
+
+template<typename T, size_t N, size_t ... Ks, typename ... Variances>
+PackedTensor<T,N,symmetry<Ks...>,Variances...>::PackedTensor(unpacked_type const & full) {
+    for(size_t s = 0; s < size(); ++s) {
+        data_[s] = std::apply([&](auto ... is) { return full.unchecked(is...); }, slot_indices[s]);
+    }
+}
+
+template<typename T, size_t N, size_t ... Ks, typename ... Variances>
+typename PackedTensor<T,N,symmetry<Ks...>,Variances...>::unpacked_type
+PackedTensor<T,N,symmetry<Ks...>,Variances...>::unpack() const {
+    unpacked_type full(true); // uninitialized
+    for_each_index<N,degree>([&](size_t u, std::array<size_t,degree> const & indices) {
+        full[u] = data_[offset(indices)];
+    });
+    return full;
+}
+
+/*
+sum over c and d of s(c, d) x(c, d) for a tensor s symmetric in a pair of
+indices, visiting every unordered pair once: s multiplies x(c, d) + x(d, c)
+instead of each term separately, 10 instead of 16 products in 4 dimensions.
+*/
+template<typename Accumulator = void, typename T, size_t N, typename Variance, typename Function>
+std::conditional_t<std::is_void_v<Accumulator>,T,Accumulator>
+contract_symmetric(PackedTensor<T,N,symmetry<2>,Variance,Variance> const & s, Function && x) {
+    typedef PackedTensor<T,N,symmetry<2>,Variance,Variance> packed_type;
+
+    // the sum is kept in T unless a wider Accumulator is asked for
+    std::conditional_t<std::is_void_v<Accumulator>,T,Accumulator> sum = 0;
+    for(size_t slot = 0; slot < packed_type::size(); ++slot) {
+        size_t c = packed_type::slot_indices[slot][0], d = packed_type::slot_indices[slot][1];
+        sum += s[slot] * (c == d ? x(c, c) : x(c, d) + x(d, c));
+    }
+    return sum;
+}
+
+// the inverse of a symmetric matrix is symmetric
+template<typename T>
+PackedTensor<T,4,symmetry<2>,Contravariant,Contravariant>
+invert(PackedTensor<T,4,symmetry<2>,Covariant,Covariant> const & in) {
+    return PackedTensor<T,4,symmetry<2>,Contravariant,Contravariant>(invert(in.unpack()));
+}
+
+template<typename T>
+PackedTensor<T,4,symmetry<2>,Covariant,Covariant>
+invert(PackedTensor<T,4,symmetry<2>,Contravariant,Contravariant> const & in) {
+    return PackedTensor<T,4,symmetry<2>,Covariant,Covariant>(invert(in.unpack()));
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "packed_tensor.hpp"
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+Raising and lowering any index of a Tensor with the metric.
+
+    raise<K>(t, inverse)    t^{..a..} = g^{ab} t_{..b..}, index K covariant
+    lower<K>(t, metric)     t_{..a..} = g_{ab} t^{..b..}, index K contravariant
+
+The result is t with only index K changed, where it was, unlike
+inverse.multiplyAndContract<1,K+2>(t) which builds the index space of the
+product and moves the new index to the front.  Every output element is one
+N term dot product along index K: for the elements of t below K the stride is
+N^K and contiguous, so the loop over them is a plain vector loop, and for
+K = 0 the N terms are adjacent.
+
+The metric is a dense Tensor or a packed symmetric one, with both indices of
+the variance being produced.  Several indices go in one call,
+raise<0,2>(t, inverse), which reads the metric once and applies one index
+after the other.  That is the fused form: each pass is N^(degree+1) multiply
+adds, a single sum over every raised index at once would be N^(degree+m) for m
+indices.
+*/
+
+// the tensor type with index K changed to Variance
+template<size_t K, typename Variance, typename TensorType, typename = std::make_index_sequence<TensorType::degree>>
+struct replace_variance;
+
+template<size_t K, typename Variance, typename T, size_t N, typename ... Variances, size_t ... Is>
+struct replace_variance<K,Variance,Tensor<T,N,Variances...>,std::index_sequence<Is...>> {
+    static_assert(K < sizeof...(Variances), "index out of range");
+    typedef Tensor<T,N,std::conditional_t<Is == K, Variance, Variances>...> type;
+};
+
+// the metric, or its inverse when Variance is Contravariant, dense or packed
+template<typename Metric, typename T, size_t N, typename Variance>
+concept metric_tensor = std::is_same_v<Metric, Tensor<T,N,Variance,Variance>>
+                     || std::is_same_v<Metric, PackedTensor<T,N,symmetry<2>,Variance,Variance>>;
+
+// g(a, b) at a + N b, unpacked once for all the passes
+template<typename T, size_t N, typename Metric>
+std::array<T,N * N> metric_components(Metric const & metric) {
+    std::array<T,N * N> g;
+    for(size_t b = 0; b < N; ++b)
+        for(size_t a = 0; a < N; ++a)
+            g[a + N * b] = metric.unchecked(a, b);
+    return g;
+}
+
+// one pass, index K contracted with the second index of g and replaced by its first
+template<size_t K, typename Variance, typename T, size_t N, typename ... Variances>
+typename replace_variance<K,Variance,Tensor<T,N,Variances...>>::type
+apply_metric(Tensor<T,N,Variances...> const & t, std::array<T,N * N> const & g) {
+    typedef std::tuple_element_t<K,std::tuple<Variances...>> from_variance;
+    static_assert(!std::is_same_v<from_variance,Variance>, "the index already has that variance");
+
+    typedef typename replace_variance<K,Variance,Tensor<T,N,Variances...>>::type result_type;
+    constexpr size_t inner = power<N,K>::value;
+    constexpr size_t outer = result_type::size() / (inner * N);
+
+    result_type out(true); // uninitialized
+    for(size_t o = 0; o < outer; ++o) {
+        T const * in = &t[o * N * inner];
+        for(size_t a = 0; a < N; ++a) {
+            T * dst = &out[(o * N + a) * inner];
+            GRAVITATE_ELEMENTWISE_LOOP
+            for(size_t i = 0; i < inner; ++i) {
+                T sum = 0;
+                for(size_t b = 0; b < N; ++b) {
+                    sum += g[a + N * b] * in[b * inner + i];
+                }
+                dst[i] = sum;
+            }
+        }
+    }
+    return out;
+}
+
+template<typename Variance, size_t K, size_t ... Ks, typename T, size_t N, typename ... Variances>
+auto apply_metric_indices(Tensor<T,N,Variances...> const & t, std::array<T,N * N> const & g) {
+    if constexpr(sizeof...(Ks) == 0) {
+        return apply_metric<K,Variance>(t, g);
+    } else {
+        return apply_metric_indices<Variance,Ks...>(apply_metric<K,Variance>(t, g), g);
+    }
+}
+
+// t with indices K, Ks... raised by the inverse metric
+template<size_t K, size_t ... Ks, typename T, size_t N, typename ... Variances, typename Metric>
+    requires metric_tensor<Metric,T,N,Contravariant>
+auto raise(Tensor<T,N,Variances...> const & t, Metric const & inverse) {
+    return apply_metric_indices<Contravariant,K,Ks...>(t, metric_components<T,N>(inverse));
+}
+
+// t with indices K, Ks... lowered by the metric
+template<size_t K, size_t ... Ks, typename T, size_t N, typename ... Variances, typename Metric>
+    requires metric_tensor<Metric,T,N,Covariant>
+auto lower(Tensor<T,N,Variances...> const & t, Metric const & metric) {
+    return apply_metric_indices<Covariant,K,Ks...>(t, metric_components<T,N>(metric));
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "cpu_dispatch.hpp"
+
+#ifdef GRAVITATE_X86
+#include <immintrin.h>
+#endif
+
+/*
+Reduced precision storage for tensors that are computed in fp32.
+
+fp16 (IEEE binary16) and bf16 (the upper half of a binary32) are storage
+types only, there is no arithmetic on them.  CompactTensor<Storage,TensorType>
+holds the elements of a Tensor or PackedTensor in one of them and converts the
+whole tensor at once on store() and load(), so blocks can live in memory and on
+disk at half the size while every kernel still sees floats.
+
+Conversions round to nearest even.  Bulk fp16 conversion uses F16C at the avx2
+level and AVX-512F at avx512 when cpu_level() allows them, picked once like the
+linalg4 kernels; bf16 conversion is a shift and an add that the compiler
+vectorises on its own.
+
+fp16 keeps 11 significant bits and covers 6e-8 to 65504, bf16 keeps 8 bits
+with the exponent range of float.
+*/
+
+struct fp16 {
+    uint16_t bits;
+};
+
+struct bf16 {
+    uint16_t bits;
+};
+
+constexpr fp16 to_fp16(float f) {
+    uint32_t x = std::bit_cast<uint32_t>(f);
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    if(abs >= 0x7f800000) { // inf stays inf, nan stays a quiet nan
+        return { uint16_t(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 | ((abs >> 13) & 0x3ff) : 0)) };
+    }
+    if(abs >= 0x477ff000) { // rounds past 65504
+        return { uint16_t(sign | 0x7c00) };
+    }
+    if(abs < 0x38800000) { // subnormal in fp16, let the float adder do the rounding
+        return { uint16_t(sign | (std::bit_cast<uint32_t>(std::bit_cast<float>(abs) + 0.5f) - 0x3f000000)) };
+    }
+    // rebias the exponent and round the 13 dropped bits to nearest even
+    abs += 0xc8000fff + ((abs >> 13) & 1);
+    return { uint16_t(sign | (abs >> 13)) };
+}
+
+constexpr float to_float(fp16 h) {
+    uint32_t sign = uint32_t(h.bits & 0x8000) << 16;
+    uint32_t exponent = (h.bits >> 10) & 0x1f;
+    uint32_t mantissa = h.bits & 0x3ff;
+
+    if(exponent == 0) {
+        float v = float(mantissa) * 0x1p-24f;
+        return sign ? -v : v;
+    }
+    if(exponent == 0x1f) {
+        return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+    }
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+constexpr bf16 to_bf16(float f) {
+    uint32_t x = std::bit_cast<uint32_t>(f);
+    if((x & 0x7fffffff) > 0x7f800000) { // keep nans quiet rather than rounding them to inf
+        return { uint16_t((x >> 16) | 0x40) };
+    }
+    x += 0x7fff + ((x >> 16) & 1);
+    return { uint16_t(x >> 16) };
+}
+
+constexpr float to_float(bf16 b) {
+    return std::bit_cast<float>(uint32_t(b.bits) << 16);
+}
+
+
+inline void to_fp16_portable(float const * in, fp16 * out, size_t n) {
+    for(size_t i = 0; i < n; ++i) out[i] = to_fp16(in[i]);
+}
+inline void from_fp16_portable(fp16 const * in, float * out, size_t n) {
+    for(size_t i = 0; i < n; ++i) out[i] = to_float(in[i]);
+}
+inline void to_bf16_portable(float const * in, bf16 * out, size_t n) {
+    for(size_t i = 0; i < n; ++i) out[i] = to_bf16(in[i]);
+}
+inline void from_bf16_portable(bf16 const * in, float * out, size_t n) {
+    for(size_t i = 0; i < n; ++i) out[i] = to_float(in[i]);
+}
+
+#ifdef GRAVITATE_X86
+__attribute__((target("avx,f16c")))
+inline void to_fp16_f16c(float const * in, fp16 * out, size_t n) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), h);
+    }
+    to_fp16_portable(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx,f16c")))
+inline void from_fp16_f16c(fp16 const * in, float * out, size_t n) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+    }
+    from_fp16_portable(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+inline void to_fp16_avx512(float const * in, fp16 * out, size_t n) {
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        // the maskz forms, the plain ones trip gcc 12's uninitialized warning in its own headers
+        __m256i h = _mm512_maskz_cvtps_ph(__mmask16(-1), _mm512_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), h);
+    }
+    to_fp16_portable(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+inline void from_fp16_avx512(fp16 const * in, float * out, size_t n) {
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m256i h = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + i));
+        _mm512_storeu_ps(out + i, _mm512_maskz_cvtph_ps(__mmask16(-1), h));
+    }
+    from_fp16_portable(in + i, out + i, n - i);
+}
+#endif
+
+struct PrecisionKernels {
+    char const * isa;
+    void (*to_fp16)(float const * in, fp16 * out, size_t n);
+    void (*from_fp16)(fp16 const * in, float * out, size_t n);
+    void (*to_bf16)(float const * in, bf16 * out, size_t n);
+    void (*from_bf16)(bf16 const * in, float * out, size_t n);
+};
+
+// every implementation this CPU can run, the best last
+inline std::vector<PrecisionKernels> const & precision_implementations() {
+    static std::vector<PrecisionKernels> const implementations = [] {
+        std::vector<PrecisionKernels> k;
+        k.push_back({ "portable", to_fp16_portable, from_fp16_portable, to_bf16_portable, from_bf16_portable });
+#ifdef GRAVITATE_X86
+        if(cpu_supports(CpuLevel::avx2)) {
+            k.push_back({ "f16c", to_fp16_f16c, from_fp16_f16c, to_bf16_portable, from_bf16_portable });
+        }
+        if(cpu_supports(CpuLevel::avx512)) {
+            k.push_back({ "avx512", to_fp16_avx512, from_fp16_avx512, to_bf16_portable, from_bf16_portable });
+        }
+#endif
+        return k;
+    }();
+    return implementations;
+}
+
+inline PrecisionKernels const & precision_kernels() {
+    static PrecisionKernels const & kernels = precision_implementations().back();
+    return kernels;
+}
+
+inline void convert(float const * in, fp16 * out, size_t n) { precision_kernels().to_fp16(in, out, n); }
+inline void convert(fp16 const * in, float * out, size_t n) { precision_kernels().from_fp16(in, out, n); }
+inline void convert(float const * in, bf16 * out, size_t n) { precision_kernels().to_bf16(in, out, n); }
+inline void convert(bf16 const * in, float * out, size_t n) { precision_kernels().from_bf16(in, out, n); }
+
+
+// a float Tensor or PackedTensor kept as Storage, converted as a whole on load and store
+template<typename Storage, typename TensorType>
+class CompactTensor {
+public:
+    static_assert(std::is_same_v<typename TensorType::element_type, float>, "compact tensors hold float tensors");
+
+    typedef TensorType tensor_type;
+    typedef Storage storage_type;
+
+    static constexpr size_t size() { return TensorType::size(); }
+
+    CompactTensor() : data_{} {} // all zero bits is +0 in both formats
+    explicit CompactTensor(tensor_type const & t) { store(t); }
+
+    void store(tensor_type const & t) { convert(&t[0], data_.data(), size()); }
+    tensor_type load() const {
+        tensor_type ret(false); // uninitialized
+        convert(data_.data(), &ret[0], size());
+        return ret;
+    }
+
+    Storage * data() { return data_.data(); }
+    Storage const * data() const { return data_.data(); }
+    float operator[](size_t index) const { return to_float(data_[index]); }
+
+private:
+    std::array<Storage,TensorType::size()> data_;
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/* BlockSlab is a fixed pool of aligned frames for the resident blocks of a
+   BlockStorage.  Frames are handed out as shared_ptrs whose deleter puts the
+   frame back on the free list, so a block that is evicted while a wrapper
+   still holds it stays valid and its frame is reused once the last reference
+   is gone.  Memory is only returned when the slab itself is destroyed.
+
+   The shared_ptr control blocks come from a second pool of the same number of
+   slots, through the allocator argument of the shared_ptr constructor, so a
+   cache miss in steady state does not touch the heap at all.  Control blocks
+   are pooled apart from the frames because a weak_ptr keeps its control block
+   alive after the block itself is gone, and because a block sharing its frame
+   with one would no longer sit at the start of a cache line.
+
+   When more blocks are alive than there are frames (wrappers outliving
+   evictions) the slab falls back to the heap rather than failing. */
+template<typename Block>
+class BlockSlab : public std::enable_shared_from_this<BlockSlab<Block>> {
+public:
+    // a cache line, which also covers every SIMD width we target
+    static constexpr size_t alignment = std::max<size_t>(64, alignof(Block));
+    static constexpr size_t frame_size = (sizeof(Block) + alignment - 1) / alignment * alignment;
+    static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+    static std::shared_ptr<BlockSlab> create(size_t frames, bool huge_pages = false) {
+        return std::shared_ptr<BlockSlab>(new BlockSlab(frames, huge_pages));
+    }
+    BlockSlab(BlockSlab const &) = delete;
+    ~BlockSlab();
+
+    // value initialized block, like std::make_shared<Block>()
+    std::shared_ptr<Block> make() { return allocate(true); }
+    // default initialized block for callers that overwrite it anyway
+    std::shared_ptr<Block> make_for_overwrite() { return allocate(false); }
+
+    bool owns(Block const * block) const;
+    size_t frames() const { return frames_; }
+    size_t free_frames() const;
+    size_t free_control_blocks() const;
+    size_t heap_fallbacks() const;
+    bool huge_pages() const { return huge_pages_; }
+
+private:
+    // room for libstdc++'s and libc++'s control block with the deleter and allocator below
+    static constexpr size_t control_size = 64;
+
+    // the control block holds the allocator, which keeps the slab alive until the control block is freed
+    struct FrameDeleter {
+        BlockSlab * slab;
+        void operator()(Block * block) const {
+            block->~Block();
+            slab->release(block);
+        }
+    };
+
+    template<typename T>
+    struct ControlAllocator {
+        typedef T value_type;
+
+        std::shared_ptr<BlockSlab> slab;
+
+        ControlAllocator(std::shared_ptr<BlockSlab> slab) : slab(std::move(slab)) {}
+        template<typename U>
+        ControlAllocator(ControlAllocator<U> const & other) : slab(other.slab) {}
+
+        T * allocate(size_t n) { return static_cast<T *>(slab->allocate_control(n * sizeof(T))); }
+        void deallocate(T * p, size_t) { slab->release_control(p); }
+
+        template<typename U>
+        bool operator==(ControlAllocator<U> const & other) const { return slab == other.slab; }
+    };
+
+    BlockSlab(size_t frames, bool huge_pages);
+    std::shared_ptr<Block> allocate(bool value_initialize);
+    void release(Block * block);
+    void * allocate_control(size_t bytes);
+    void release_control(void * p);
+
+    size_t frames_;
+    size_t bytes_;
+    bool huge_pages_;
+    bool mapped_;
+    char * memory_;
+    std::vector<void *> free_;
+    char * control_memory_;
+    std::vector<void *> free_control_;
+    size_t heap_fallbacks_;
+    mutable std::mutex mutex_;
+};
+
+template<typename Block>
+BlockSlab<Block>::BlockSlab(size_t frames, bool huge_pages)
+    : frames_(std::max<size_t>(frames, 1)), bytes_(frames_ * frame_size), huge_pages_(false), mapped_(false),
+      memory_(nullptr), control_memory_(nullptr), heap_fallbacks_(0)
+{
+    control_memory_ = static_cast<char *>(std::aligned_alloc(control_size, frames_ * control_size));
+    if(control_memory_ == nullptr) {
+        throw std::bad_alloc();
+    }
+
+#ifdef __linux__
+    if(huge_pages) {
+        size_t mapped_bytes = (bytes_ + huge_page_size - 1) / huge_page_size * huge_page_size;
+
+        // explicit huge pages need a reserved pool, fall back to asking for transparent ones
+        void * p = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED) {
+            huge_pages_ = true;
+        } else {
+            p = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p != MAP_FAILED) {
+                huge_pages_ = madvise(p, mapped_bytes, MADV_HUGEPAGE) == 0;
+            }
+        }
+        if(p != MAP_FAILED) {
+            bytes_ = mapped_bytes;
+            mapped_ = true;
+            memory_ = static_cast<char *>(p);
+        }
+    }
+#endif
+    if(memory_ == nullptr) {
+        memory_ = static_cast<char *>(std::aligned_alloc(alignment, bytes_));
+        if(memory_ == nullptr) {
+            std::free(control_memory_);
+            throw std::bad_alloc();
+        }
+    }
+
+    // hand out the lowest frames first
+    free_.reserve(frames_);
+    free_control_.reserve(frames_);
+    for(size_t f = frames_; f > 0; --f) {
+        free_.push_back(memory_ + (f - 1) * frame_size);
+        free_control_.push_back(control_memory_ + (f - 1) * control_size);
+    }
+}
+
+template<typename Block>
+BlockSlab<Block>::~BlockSlab()
+{
+    std::free(control_memory_);
+#ifdef __linux__
+    if(mapped_) {
+        munmap(memory_, bytes_);
+        return;
+    }
+#endif
+    std::free(memory_);
+}
+
+template<typename Block>
+std::shared_ptr<Block> BlockSlab<Block>::allocate(bool value_initialize)
+{
+    void * frame = nullptr;
+    {
+        std::unique_lock<std::mutex> guard(mutex_);
+        if(free_.empty()) {
+            ++heap_fallbacks_;
+        } else {
+            frame = free_.back();
+            free_.pop_back();
+        }
+    }
+
+    if(frame == nullptr) {
+        return value_initialize ? std::make_shared<Block>() : std::make_shared_for_overwrite<Block>();
+    }
+
+    Block * block;
+    try {
+        block = value_initialize ? new (frame) Block() : new (frame) Block;
+    } catch(...) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        free_.push_back(frame);
+        throw;
+    }
+    return std::shared_ptr<Block>(block, FrameDeleter{this}, ControlAllocator<Block>(this->shared_from_this()));
+}
+
+template<typename Block>
+void * BlockSlab<Block>::allocate_control(size_t bytes)
+{
+    if(bytes <= control_size) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        if(!free_control_.empty()) {
+            void * p = free_control_.back();
+            free_control_.pop_back();
+            return p;
+        }
+    }
+    return ::operator new(bytes);
+}
+
+template<typename Block>
+void BlockSlab<Block>::release_control(void * p)
+{
+    auto c = static_cast<char *>(p);
+    if(c >= control_memory_ && c < control_memory_ + frames_ * control_size) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        free_control_.push_back(p);
+    } else {
+        ::operator delete(p);
+    }
+}
+
+template<typename Block>
+void BlockSlab<Block>::release(Block * block)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    free_.push_back(block);
+}
+
+template<typename Block>
+bool BlockSlab<Block>::owns(Block const * block) const
+{
+    auto p = reinterpret_cast<char const *>(block);
+    return p >= memory_ && p < memory_ + frames_ * frame_size;
+}
+
+template<typename Block>
+size_t BlockSlab<Block>::free_frames() const
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    return free_.size();
+}
+
+template<typename Block>
+size_t BlockSlab<Block>::free_control_blocks() const
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    return free_control_.size();
+}
+
+template<typename Block>
+size_t BlockSlab<Block>::heap_fallbacks() const
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    return heap_fallbacks_;
+}
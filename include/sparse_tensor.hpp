@@ -0,0 +1,220 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "detail/tensor_detail.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+SparseTensor<T,N,Variances...> is a Tensor that knows which of its elements are
+zero.  It keeps the dense elements, so reading any element is still one load,
+plus the storage offsets of the nonzero ones in increasing order.  The
+contractions below only visit nonzero elements (or pairs of them), which is
+what pays off for metrics like Schwarzschild where a handful of the 64 first
+and 256 second derivatives are nonzero.
+
+Elements are written through set() so the list stays in step with the
+values, and a SparseTensor converts to and from Tensor:
+
+    SparseTensor<float,4,Covariant,Covariant,Covariant> s(dense);
+    Tensor<float,4,Covariant,Covariant,Covariant> d = s.dense();
+
+Zero means exactly zero, an element that underflowed to a tiny value counts
+as nonzero.
+*/
+
+// the smallest unsigned type that holds every offset of a tensor with Size elements
+template<size_t Size>
+using sparse_offset_type = std::conditional_t<(Size <= 0x100), uint8_t,
+                           std::conditional_t<(Size <= 0x10000), uint16_t, uint32_t>>;
+
+template<typename T, size_t N, typename ... Variances>
+class SparseTensor {
+public:
+    typedef SparseTensor<T,N,Variances...> this_type;
+    typedef Tensor<T,N,Variances...> tensor_type;
+    typedef T element_type;
+    typedef sparse_offset_type<tensor_type::size()> offset_type;
+    typedef typename index_type_from_size<sizeof...(Variances)>::type index_type;
+
+    static constexpr size_t dimensions = N;
+    static constexpr size_t degree = sizeof...(Variances);
+    static constexpr size_t size() { return tensor_type::size(); }
+
+    SparseTensor() : count_(0) {}
+    explicit SparseTensor(tensor_type const & dense) : dense_(dense), count_(0) {
+        for(size_t i = 0; i < size(); ++i) {
+            if(dense_[i] != 0) nonzero_[count_++] = offset_type(i);
+        }
+    }
+
+    tensor_type const & dense() const { return dense_; }
+
+    size_t nonzeros() const { return count_; }
+    double density() const { return double(count_) / size(); }
+
+    // the k-th nonzero element, in storage order
+    size_t offset(size_t k) const { return nonzero_[k]; }
+    T value(size_t k) const { return dense_[nonzero_[k]]; }
+    std::array<size_t,degree> indices(size_t k) const { return split(nonzero_[k]); }
+
+    T operator[](size_t index) const { return dense_[index]; }
+    T operator()(index_type index) const { return dense_(index); }
+    T get(index_type index) const { return dense_.get(index); }
+
+    // writes one element, keeping the nonzero list sorted
+    void set(index_type index, T value) { set(tensor_type::index(index), value); }
+    void set(size_t index, T value) {
+        if(index >= size()) {
+            throw std::out_of_range("SparseTensor::set");
+        }
+        size_t k = 0;
+        while(k < count_ && nonzero_[k] < index) ++k;
+        bool present = k < count_ && nonzero_[k] == index;
+
+        if(value != 0 && !present) {
+            for(size_t m = count_; m > k; --m) nonzero_[m] = nonzero_[m - 1];
+            nonzero_[k] = offset_type(index);
+            ++count_;
+        } else if(value == 0 && present) {
+            for(size_t m = k; m + 1 < count_; ++m) nonzero_[m] = nonzero_[m + 1];
+            --count_;
+        }
+        dense_[index] = value;
+    }
+
+    // f(offset, indices, value) for every nonzero element
+    template<typename Function>
+    void for_each_nonzero(Function && f) const {
+        for(size_t k = 0; k < count_; ++k) {
+            f(size_t(nonzero_[k]), split(nonzero_[k]), dense_[nonzero_[k]]);
+        }
+    }
+
+    bool operator==(this_type const & other) const { return dense_ == other.dense_; }
+    bool operator!=(this_type const & other) const { return !(*this == other); }
+
+    // indices of a storage offset, the first index moving fastest
+    static constexpr std::array<size_t,degree> split(size_t offset) {
+        std::array<size_t,degree> ret{};
+        for(size_t k = 0; k < degree; ++k, offset /= N) {
+            ret[k] = offset % N;
+        }
+        return ret;
+    }
+
+private:
+    tensor_type dense_;
+    std::array<offset_type,size()> nonzero_;
+    size_t count_;
+};
+
+template<typename T, size_t N, typename ... Variances>
+SparseTensor<T,N,Variances...> sparse(Tensor<T,N,Variances...> const & dense) {
+    return SparseTensor<T,N,Variances...>(dense);
+}
+
+/*
+The product of a tensor with A indices and one with B indices, contracted over
+product index lo < A and hi >= A.  first_offset and second_offset add up to
+where a pair of elements lands in the result.
+*/
+template<size_t N, size_t A, size_t B, size_t lo, size_t hi>
+struct SparseContraction {
+    static_assert(lo < A && hi >= A && hi < A + B, "contract one index of each operand");
+    static constexpr size_t result_degree = A + B - 2;
+    static constexpr std::array<size_t,result_degree> strides = make_strides<N,result_degree>();
+
+    // result stride of product index p, zero for the contracted ones
+    static constexpr size_t stride(size_t p) {
+        if(p == lo || p == hi) return 0;
+        return strides[p - (p > lo) - (p > hi)];
+    }
+
+    static constexpr size_t first_offset(std::array<size_t,A> const & ia) {
+        size_t off = 0;
+        for(size_t p = 0; p < A; ++p) off += ia[p] * stride(p);
+        return off;
+    }
+    static constexpr size_t second_offset(std::array<size_t,B> const & ib) {
+        size_t off = 0;
+        for(size_t p = 0; p < B; ++p) off += ib[p] * stride(A + p);
+        return off;
+    }
+};
+
+// a.multiplyAndContract<i,j>(b) visiting only pairs of nonzero elements
+template<size_t i, size_t j, typename T, size_t N, typename ... AV, typename ... BV>
+auto multiply_and_contract(SparseTensor<T,N,AV...> const & a, SparseTensor<T,N,BV...> const & b) {
+    constexpr size_t A = sizeof...(AV), B = sizeof...(BV);
+    typedef SparseContraction<N,A,B,(i < j ? i : j),(i < j ? j : i)> layout;
+
+    typedef typename variances_to_tensor<T,N,typename contraction_type<i,j,AV...,BV...>::type>::type result_type;
+
+    result_type ret;
+    a.for_each_nonzero([&](size_t, auto const & ia, T va) {
+        size_t const base = layout::first_offset(ia);
+        b.for_each_nonzero([&](size_t, auto const & ib, T vb) {
+            if(ia[(i < j ? i : j)] == ib[(i < j ? j : i) - A]) {
+                ret[base + layout::second_offset(ib)] += va * vb;
+            }
+        });
+    });
+    return ret;
+}
+
+// a.multiplyAndContract<i,j>(b) visiting only the nonzero elements of a
+template<size_t i, size_t j, typename T, size_t N, typename ... AV, typename ... BV>
+auto multiply_and_contract(SparseTensor<T,N,AV...> const & a, Tensor<T,N,BV...> const & b) {
+    constexpr size_t A = sizeof...(AV), B = sizeof...(BV);
+    constexpr size_t lo = i < j ? i : j, hi = i < j ? j : i;
+    typedef SparseContraction<N,A,B,lo,hi> layout;
+
+    // walk the free indices of b, tracking the offset in b and in the result
+    constexpr auto strides = [] {
+        std::array<std::array<size_t,B - 1>,2> s{};
+        auto b_strides = make_strides<N,B>();
+        for(size_t r = 0, p = 0; r < B - 1; ++r, ++p) {
+            if(p == hi - A) ++p;
+            s[0][r] = b_strides[p];
+            s[1][r] = layout::stride(A + p);
+        }
+        return s;
+    }();
+    constexpr size_t contracted_stride = make_strides<N,B>()[hi - A];
+
+    typedef typename variances_to_tensor<T,N,typename contraction_type<i,j,AV...,BV...>::type>::type result_type;
+
+    result_type ret;
+    a.for_each_nonzero([&](size_t, auto const & ia, T va) {
+        size_t const a_base = layout::first_offset(ia);
+        size_t const b_base = ia[lo] * contracted_stride;
+        for_each_offsets<N,B - 1>(strides, [&](auto const & off, auto const &) {
+            ret[a_base + off[1]] += va * b[b_base + off[0]];
+        });
+    });
+    return ret;
+}
+
+// t.contract<i,j>() visiting only the nonzero elements on the diagonal
+template<size_t i, size_t j, typename T, size_t N, typename ... Variances>
+auto contract(SparseTensor<T,N,Variances...> const & t) {
+    typedef typename variances_to_tensor<T,N,typename contraction_type<i,j,Variances...>::type>::type result_type;
+    constexpr size_t lo = i < j ? i : j, hi = i < j ? j : i;
+    constexpr auto strides = make_strides<N,result_type::degree>();
+
+    result_type ret;
+    t.for_each_nonzero([&](size_t, auto const & it, T v) {
+        if(it[lo] != it[hi]) return;
+        size_t off = 0;
+        for(size_t p = 0, r = 0; p < it.size(); ++p) {
+            if(p != lo && p != hi) off += it[p] * strides[r++];
+        }
+        ret[off] += v;
+    });
+    return ret;
+}
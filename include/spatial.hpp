@@ -0,0 +1,214 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "packed_tensor.hpp"
+
+#include <cmath>
+#include <cstddef>
+
+/*
+Spatial (N = 3) tensors and the 3+1 split of a spacetime metric.
+
+Evolution schemes carry a 3-metric gamma_ij, the extrinsic curvature K_ij, a
+lapse alpha and a shift beta^i instead of g_ab.  The 3x3 inverse and
+determinant here are closed form cofactor expansions, with no pivoting and
+no recursion over minors, on dense Tensors and on the 6 component packed
+symmetric ones.  A singular matrix gives a zero inverse, as in linalg4.
+
+    g_00 = -alpha^2 + beta_i beta^i    g_0i = beta_i    g_ij = gamma_ij
+
+with beta_i = gamma_ij beta^j.  split_metric and join_metric convert between
+the two and inverse_metric builds g^ab from the split without a 4x4 inverse.
+*/
+
+template<typename T> using basic_spatial_vector_type = Tensor<T,3,Contravariant>;
+template<typename T> using basic_spatial_covector_type = Tensor<T,3,Covariant>;
+template<typename T> using basic_spatial_metric_type = PackedTensor<T,3,symmetry<2>,Covariant,Covariant>;
+template<typename T> using basic_inverse_spatial_metric_type = PackedTensor<T,3,symmetry<2>,Contravariant,Contravariant>;
+template<typename T> using basic_extrinsic_curvature_type = PackedTensor<T,3,symmetry<2>,Covariant,Covariant>;
+
+typedef basic_spatial_vector_type<float>         spatial_vector_type;
+typedef basic_spatial_covector_type<float>       spatial_covector_type;
+typedef basic_spatial_metric_type<float>         spatial_metric_type;
+typedef basic_inverse_spatial_metric_type<float> inverse_spatial_metric_type;
+typedef basic_extrinsic_curvature_type<float>    extrinsic_curvature_type;
+
+/* adjugate and determinant of a 3x3 matrix, element (a, b) at a + 3 b.  The
+   inverse commutes with transposing, so the row major formula applies. */
+template<typename T>
+constexpr T adjugate3(T const * m, T * adj) {
+    adj[0] = m[4] * m[8] - m[5] * m[7];
+    adj[1] = m[2] * m[7] - m[1] * m[8];
+    adj[2] = m[1] * m[5] - m[2] * m[4];
+    adj[3] = m[5] * m[6] - m[3] * m[8];
+    adj[4] = m[0] * m[8] - m[2] * m[6];
+    adj[5] = m[2] * m[3] - m[0] * m[5];
+    adj[6] = m[3] * m[7] - m[4] * m[6];
+    adj[7] = m[1] * m[6] - m[0] * m[7];
+    adj[8] = m[0] * m[4] - m[1] * m[3];
+    return m[0] * adj[0] + m[1] * adj[3] + m[2] * adj[6];
+}
+
+/* the same for a symmetric 3x3 matrix in packed slots xx, xy, yy, xz, yz, zz,
+   whose adjugate is symmetric too */
+template<typename T>
+constexpr T adjugate3_symmetric(T const * s, T * adj) {
+    adj[0] = s[2] * s[5] - s[4] * s[4];
+    adj[1] = s[3] * s[4] - s[1] * s[5];
+    adj[2] = s[0] * s[5] - s[3] * s[3];
+    adj[3] = s[1] * s[4] - s[3] * s[2];
+    adj[4] = s[1] * s[3] - s[0] * s[4];
+    adj[5] = s[0] * s[2] - s[1] * s[1];
+    return s[0] * adj[0] + s[1] * adj[1] + s[3] * adj[3];
+}
+
+// 1 / det, or 0 for a singular matrix so the inverse comes out zero
+template<typename T>
+constexpr T reciprocal_or_zero(T det) {
+    return det != 0 ? T(1) / det : T(0);
+}
+
+template<typename T, typename A, typename B>
+constexpr T determinant(Tensor<T,3,A,B> const & m) {
+    return m[0] * (m[4] * m[8] - m[5] * m[7])
+         + m[1] * (m[5] * m[6] - m[3] * m[8])
+         + m[2] * (m[3] * m[7] - m[4] * m[6]);
+}
+
+template<typename T, typename Variance>
+constexpr T determinant(PackedTensor<T,3,symmetry<2>,Variance,Variance> const & s) {
+    return s[0] * (s[2] * s[5] - s[4] * s[4])
+         + s[1] * (s[3] * s[4] - s[1] * s[5])
+         + s[3] * (s[1] * s[4] - s[3] * s[2]);
+}
+
+template<typename T, typename A, typename B>
+T invert3(Tensor<T,3,A,A> const & in, Tensor<T,3,B,B> & out) {
+    T det = adjugate3(&in[0], &out[0]);
+    T r = reciprocal_or_zero(det);
+    for(size_t i = 0; i < 9; ++i) out[i] *= r;
+    return det;
+}
+
+template<typename T, typename A, typename B>
+T invert3(PackedTensor<T,3,symmetry<2>,A,A> const & in, PackedTensor<T,3,symmetry<2>,B,B> & out) {
+    T det = adjugate3_symmetric(&in[0], &out[0]);
+    T r = reciprocal_or_zero(det);
+    for(size_t i = 0; i < 6; ++i) out[i] *= r;
+    return det;
+}
+
+// the inverse of gamma_ij is gamma^ij and the other way around
+template<typename T>
+Tensor<T,3,Contravariant,Contravariant> invert(Tensor<T,3,Covariant,Covariant> const & in) {
+    Tensor<T,3,Contravariant,Contravariant> out(true); // uninitialized
+    invert3(in, out);
+    return out;
+}
+
+template<typename T>
+Tensor<T,3,Covariant,Covariant> invert(Tensor<T,3,Contravariant,Contravariant> const & in) {
+    Tensor<T,3,Covariant,Covariant> out(true); // uninitialized
+    invert3(in, out);
+    return out;
+}
+
+template<typename T>
+basic_inverse_spatial_metric_type<T> invert(basic_spatial_metric_type<T> const & in) {
+    basic_inverse_spatial_metric_type<T> out(false); // uninitialized
+    invert3(in, out);
+    return out;
+}
+
+template<typename T>
+basic_spatial_metric_type<T> invert(basic_inverse_spatial_metric_type<T> const & in) {
+    basic_spatial_metric_type<T> out(false); // uninitialized
+    invert3(in, out);
+    return out;
+}
+
+// s v for a packed symmetric s, whichever way the indices go
+template<typename T, typename A, typename B>
+Tensor<T,3,B> multiply_symmetric3(PackedTensor<T,3,symmetry<2>,B,B> const & s, Tensor<T,3,A> const & v) {
+    Tensor<T,3,B> out(true); // uninitialized
+    out[0] = s[0] * v[0] + s[1] * v[1] + s[3] * v[2];
+    out[1] = s[1] * v[0] + s[2] * v[1] + s[4] * v[2];
+    out[2] = s[3] * v[0] + s[4] * v[1] + s[5] * v[2];
+    return out;
+}
+
+// v^i = gamma^ij v_j
+template<typename T>
+basic_spatial_vector_type<T> raise(basic_spatial_covector_type<T> const & v, basic_inverse_spatial_metric_type<T> const & inverse) {
+    return multiply_symmetric3(inverse, v);
+}
+
+// v_i = gamma_ij v^j
+template<typename T>
+basic_spatial_covector_type<T> lower(basic_spatial_vector_type<T> const & v, basic_spatial_metric_type<T> const & metric) {
+    return multiply_symmetric3(metric, v);
+}
+
+
+template<typename T>
+struct BasicSpacetimeSplit {
+    T lapse;
+    basic_spatial_vector_type<T> shift;
+    basic_spatial_metric_type<T> spatial_metric;
+};
+
+typedef BasicSpacetimeSplit<float> SpacetimeSplit;
+
+// lapse, shift and 3-metric of g_ab, time is index 0
+template<typename T>
+BasicSpacetimeSplit<T> split_metric(PackedTensor<T,4,symmetry<2>,Covariant,Covariant> const & g) {
+    BasicSpacetimeSplit<T> ret{ T(0), basic_spatial_vector_type<T>(true), basic_spatial_metric_type<T>(false) };
+
+    basic_spatial_covector_type<T> shift_down(true); // uninitialized
+    for(size_t i = 0; i < 3; ++i) {
+        shift_down[i] = g.unchecked(0, i + 1);
+        for(size_t j = i; j < 3; ++j) {
+            ret.spatial_metric.unchecked(i, j) = g.unchecked(i + 1, j + 1);
+        }
+    }
+    ret.shift = raise(shift_down, invert(ret.spatial_metric));
+
+    T shift_squared = shift_down[0] * ret.shift[0] + shift_down[1] * ret.shift[1] + shift_down[2] * ret.shift[2];
+    ret.lapse = std::sqrt(shift_squared - g.unchecked(0, 0));
+    return ret;
+}
+
+// g_ab from lapse, shift and 3-metric
+template<typename T>
+PackedTensor<T,4,symmetry<2>,Covariant,Covariant> join_metric(BasicSpacetimeSplit<T> const & s) {
+    PackedTensor<T,4,symmetry<2>,Covariant,Covariant> g(false); // uninitialized
+
+    auto shift_down = lower(s.shift, s.spatial_metric);
+    for(size_t i = 0; i < 3; ++i) {
+        g.unchecked(0, i + 1) = shift_down[i];
+        for(size_t j = i; j < 3; ++j) {
+            g.unchecked(i + 1, j + 1) = s.spatial_metric.unchecked(i, j);
+        }
+    }
+    T shift_squared = shift_down[0] * s.shift[0] + shift_down[1] * s.shift[1] + shift_down[2] * s.shift[2];
+    g.unchecked(0, 0) = shift_squared - s.lapse * s.lapse;
+    return g;
+}
+
+/* g^ab from lapse, shift and 3-metric:
+   g^00 = -1 / alpha^2    g^0i = beta^i / alpha^2    g^ij = gamma^ij - beta^i beta^j / alpha^2 */
+template<typename T>
+PackedTensor<T,4,symmetry<2>,Contravariant,Contravariant> inverse_metric(BasicSpacetimeSplit<T> const & s) {
+    PackedTensor<T,4,symmetry<2>,Contravariant,Contravariant> inv(false); // uninitialized
+
+    auto gamma_inverse = invert(s.spatial_metric);
+    T r = T(1) / (s.lapse * s.lapse);
+    inv.unchecked(0, 0) = -r;
+    for(size_t i = 0; i < 3; ++i) {
+        inv.unchecked(0, i + 1) = s.shift[i] * r;
+        for(size_t j = i; j < 3; ++j) {
+            inv.unchecked(i + 1, j + 1) = gamma_inverse.unchecked(i, j) - s.shift[i] * s.shift[j] * r;
+        }
+    }
+    return inv;
+}
@@ -2,6 +2,8 @@
 
 #include "tuple_splice.hpp"
 #include "detail/tensor_detail.hpp"
+#include "tensor_expression.hpp"
+#include "tensor_storage.hpp"
 
 #include <array>
 #include <tuple>
@@ -32,6 +34,29 @@ struct index_type {
 template<typename T, size_t N, typename ... Variances>
 class Tensor;
 
+// element count from which elementwise tensor operations go to the parallel backend
+#ifndef GRAVITATE_TENSOR_PARALLEL_THRESHOLD
+#define GRAVITATE_TENSOR_PARALLEL_THRESHOLD 65536
+#endif
+
+/* tensor_execution picks the std::execution policy for the elementwise
+   operations of a tensor holding Size elements of type T.  Curvature tensors
+   are tiny and are evaluated from inside our own parallel loops, so below the
+   threshold they are only vectorised on the calling thread.  Specialise it to
+   change the policy of one element type or size. */
+template<typename T, size_t Size>
+struct tensor_execution {
+    static constexpr bool parallel = Size >= GRAVITATE_TENSOR_PARALLEL_THRESHOLD;
+
+    static constexpr auto const & policy() {
+        if constexpr(parallel) {
+            return std::execution::par_unseq;
+        } else {
+            return std::execution::unseq;
+        }
+    }
+};
+
 template<typename T, size_t N, typename ConractionType>
 struct variances_to_tensor;
 
@@ -46,88 +71,133 @@ template<typename T, size_t N, typename ... Variances>
 class Tensor {
 public:
     typedef Tensor<T,N,Variances...> this_type;
+    typedef this_type tensor_type;
     typedef T element_type;
-    typedef std::array<T,TensorSize<N,Variances...>::value> data_type;
+    typedef std::array<T,TensorSize<N,Variances...>::value> array_type;
+    // std::array for small tensors, see tensor_storage.hpp
+    typedef typename tensor_storage<T,TensorSize<N,Variances...>::value>::type data_type;
     typedef TensorHelper<T,N,sizeof...(Variances)> helper_type;
-    typedef data_type::iterator iterator;
-    typedef data_type::const_iterator const_iterator;
+    typedef typename data_type::iterator iterator;
+    typedef typename data_type::const_iterator const_iterator;
+    typedef tensor_execution<T,TensorSize<N,Variances...>::value> execution;
     // using index_type = TensorHelper<T,N,sizeof...(Variances)>::index_type;
 
     constexpr static size_t dimensions = N;
     constexpr static size_t degree = sizeof...(Variances);
     constexpr static size_t size() { return TensorSize<N,Variances...>::value; }
-
-    Tensor();
-    Tensor(bool) {}; // don't initialize data_
-    Tensor(data_type const & data);
-    Tensor(data_type && data);
-    Tensor(Tensor const &);
-    Tensor(Tensor &&);
-    this_type & operator=(this_type const &);
-    this_type & operator=(this_type &&);
-    ~Tensor();
+    // a tensor with inline storage is trivially copyable, its bytes are its elements
+    constexpr static bool inline_storage = std::is_same_v<data_type,array_type>;
+
+    constexpr Tensor();
+    constexpr Tensor(bool) {}; // don't initialize data_
+    constexpr Tensor(array_type const & data);
+    constexpr Tensor(array_type && data);
+    constexpr Tensor(Tensor const &) requires inline_storage = default;
+    constexpr Tensor(Tensor const & other) requires (!inline_storage) { *this = other; }
+    constexpr Tensor(Tensor &&) requires inline_storage = default;
+    constexpr Tensor(Tensor && other) requires (!inline_storage) : data_(std::move(other.data_)) {}
+    // evaluates an elementwise expression such as (a + b) * 0.5f in one pass
+    template<tensor_expression_node_of<this_type> E>
+    constexpr Tensor(E const & expression) { assign(expression); }
+    constexpr this_type & operator=(this_type const &) requires inline_storage = default;
+    constexpr this_type & operator=(this_type const &) requires (!inline_storage);
+    constexpr this_type & operator=(this_type &&) requires inline_storage = default;
+    constexpr this_type & operator=(this_type && other) requires (!inline_storage) { data_ = std::move(other.data_); return *this; }
+    template<tensor_expression_node_of<this_type> E>
+    constexpr this_type & operator=(E const & expression) { assign(expression); return *this; }
+    constexpr ~Tensor() = default;
+
+    // compile time strides of each index, the first index moves fastest
+    static constexpr std::array<size_t,degree> strides = helper_type::strides;
 
     template<typename Tuple>
-    static size_t index(Tuple sizes) { return helper_type::index(sizes); }
-    static auto dimension(size_t index) { return helper_type::dimension(index); }
+    static constexpr size_t index(Tuple sizes) { return helper_type::index(sizes); }
+    static constexpr auto dimension(size_t index) { return helper_type::dimension(index); }
 
-    bool operator==(this_type const &) const;
-    bool operator!=(this_type const & other) const { return !(*this == other); }
+    constexpr bool operator==(this_type const &) const;
+    constexpr bool operator!=(this_type const & other) const { return !(*this == other); }
 
-    this_type & operator+=(this_type const &);
-    this_type & operator-=(this_type const &);
-    this_type & operator*=(T);
-    this_type & operator/=(T);
-    this_type operator+(this_type const &) const;
-    this_type operator-(this_type const &) const;
-    this_type operator*(T) const;
-    this_type operator/(T) const;
+    constexpr this_type & operator+=(this_type const &);
+    constexpr this_type & operator-=(this_type const &);
+    constexpr this_type & operator*=(T);
+    constexpr this_type & operator/=(T);
+    template<tensor_expression_node_of<this_type> E>
+    constexpr this_type & operator+=(E const & expression) { return assign(*this + expression); }
+    template<tensor_expression_node_of<this_type> E>
+    constexpr this_type & operator-=(E const & expression) { return assign(*this - expression); }
+
+    // +, -, unary - and scalar * and / are the lazy operators in tensor_expression.hpp
 
     template<typename ... SecondVariances>
-    Tensor<T,N,Variances...,SecondVariances...> operator*(Tensor<T,N,SecondVariances...> const & other) const;
+    constexpr Tensor<T,N,Variances...,SecondVariances...> operator*(Tensor<T,N,SecondVariances...> const & other) const;
 
     template<size_t i, size_t j, typename ... SecondVariances>
-    typename variances_to_tensor<T,N,typename contraction_type<i,j,Variances...,SecondVariances...>::type>::type
+    constexpr typename variances_to_tensor<T,N,typename contraction_type<i,j,Variances...,SecondVariances...>::type>::type
     multiplyAndContract(Tensor<T,N,SecondVariances...> const & other) const;
 
     // returns a tensor with the multiplicative inverse of all elements
-    Tensor<T,N,Variances...> invert() const;
+    constexpr Tensor<T,N,Variances...> invert() const;
 
-    T & operator[](size_t index) { return data_[index]; }
-    T const & operator[](size_t index) const { return data_[index]; }
-    T & at(size_t index) { return data_.at(index); }
-    T const & at(size_t index) const { return data_.at(index); }
+    constexpr T & operator[](size_t index) { return data_[index]; }
+    constexpr T const & operator[](size_t index) const { return data_[index]; }
+    constexpr T & at(size_t index) { return data_.at(index); }
+    constexpr T const & at(size_t index) const { return data_.at(index); }
 
-    T & get(typename index_type<Variances...>::type index) {
+    // bounds checked element access
+    constexpr T & get(typename index_type<Variances...>::type index) {
         return data_.at(helper_type::index(index));
     }
-    T const & get(typename index_type<Variances...>::type index) const {
+    constexpr T const & get(typename index_type<Variances...>::type index) const {
         return data_.at(helper_type::index(index));
     }
 
-    T & operator()(typename index_type<Variances...>::type index) { return get(index); }
-    T const & operator()(typename index_type<Variances...>::type index) const { return get(index); }
+    // unchecked element access for hot loops, the offset is a single multiply-add per index
+    constexpr T & operator()(typename index_type<Variances...>::type index) { return data_[helper_type::index(index)]; }
+    constexpr T const & operator()(typename index_type<Variances...>::type index) const { return data_[helper_type::index(index)]; }
+
+    template<typename ... Is>
+    constexpr T & unchecked(Is ... is) { return data_[offset_of(std::make_index_sequence<degree>{}, is...)]; }
+    template<typename ... Is>
+    constexpr T const & unchecked(Is ... is) const { return data_[offset_of(std::make_index_sequence<degree>{}, is...)]; }
 
     template<size_t i, size_t j>
-    auto contract() const;
+    constexpr auto contract() const;
 
 private:
     data_type data_;
 
-    // stride of this contraction in the original tensor
-    // i realize that's confusion
-    //TODO: figure out a better place for this static function, maybe the contraction helper?
-    // although it only depends externally on N...  Maybe we just take it out of this class altogether?
-    template<size_t i, size_t j>
-    constexpr static size_t stride() {
-        return power<N,i>::value + power<N,j>::value;
+    template<typename E>
+    constexpr this_type & assign(E const & expression) {
+        ensure_elements(data_);
+        if constexpr(expression_reads_view<E>()) {
+            // one offset per leaf, so views are read along their strides
+            std::array<std::array<size_t,degree>,expression_leaves<E>() + 1> leaf_strides{};
+            leaf_strides[0] = strides;
+            expression_leaf_strides(expression, leaf_strides, 1);
+            for_each_offsets<N,degree>(leaf_strides, [&](auto const & off, auto const &) {
+                data_[off[0]] = expression_element_at(expression, off, 1);
+            });
+        } else {
+            constexpr size_t n = size(); // gcc drops the loop annotation on a call in the condition
+            GRAVITATE_ELEMENTWISE_LOOP
+            for(size_t i = 0; i < n; ++i) {
+                data_[i] = expression[i];
+            }
+        }
+        return *this;
+    }
+
+    template<size_t ... Ks, typename ... Is>
+    static constexpr size_t offset_of(std::index_sequence<Ks...>, Is ... is) {
+        static_assert(sizeof...(Is) == degree, "one index per tensor index");
+        return (size_t(0) + ... + (size_t(is) * power<N,Ks>::value));
     }
 
 public:
-    typename data_type::iterator begin() { return data_.begin(); }
-    typename data_type::const_iterator begin() const { return data_.begin(); }
-    typename data_type::iterator end() { return data_.end(); }
-    typename data_type::const_iterator end() const { return data_.end(); }
+    constexpr typename data_type::iterator begin() { return data_.begin(); }
+    constexpr typename data_type::const_iterator begin() const { return data_.begin(); }
+    constexpr typename data_type::iterator end() { return data_.end(); }
+    constexpr typename data_type::const_iterator end() const { return data_.end(); }
 
     void print(std::ostream & os) const;
 };
@@ -145,90 +215,85 @@ struct tensor_stride<N,I,Is...> {
     static constexpr size_t value = power<N,I>::value + tensor_stride<N,Is...>::value;
 };
 
+/* The elementwise members run the std algorithms with the tensor's execution
+   policy, which is not allowed in a constant expression, so there they fall
+   back to plain loops.  Either way the results are the same and constant
+   tensors such as minkowski<float>() fold at compile time. */
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>::Tensor() { 
-    std::fill(std::execution::par_unseq, data_.begin(), data_.end(), 0);
-}
-
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>::Tensor(Tensor<T,N,Variances...> const & other) {
-    std::copy(std::execution::par_unseq, other.data_.begin(), other.data_.end(), data_.begin());
+constexpr Tensor<T,N,Variances...>::Tensor() {
+    if(std::is_constant_evaluated()) {
+        data_ = data_type{};
+    } else {
+        std::fill(execution::policy(), data_.begin(), data_.end(), 0);
+    }
 }
 
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>::Tensor(Tensor<T,N,Variances...> && other) : data_(std::move(other.data_)) {}
-
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>::Tensor(data_type const & data) : data_(data) {}
-
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>::Tensor(data_type && data) : data_(std::move(data)) {}
+constexpr Tensor<T,N,Variances...>::Tensor(array_type const & data) : data_(data) {}
 
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...> & Tensor<T,N,Variances...>::operator=(Tensor<T,N,Variances...> const & other) {
-    std::copy(std::execution::par_unseq, other.data_.begin(), other.data_.end(), data_.begin());
-    return *this;
-}
+constexpr Tensor<T,N,Variances...>::Tensor(array_type && data) : data_(std::move(data)) {}
 
+// only large tensors copy through the execution policy, inline ones are copied as bytes
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...> & Tensor<T,N,Variances...>::operator=(Tensor<T,N,Variances...> && other) {
-    data_ = std::move(other.data_);
+constexpr Tensor<T,N,Variances...> & Tensor<T,N,Variances...>::operator=(Tensor<T,N,Variances...> const & other) requires (!inline_storage) {
+    ensure_elements(data_);
+    std::copy(execution::policy(), other.data_.begin(), other.data_.end(), data_.begin());
     return *this;
 }
 
 template<typename T, size_t N, typename ... Variances>
-bool Tensor<T,N,Variances...>::operator==(Tensor<T,N,Variances...> const & other) const {
-    return std::equal(std::execution::par_unseq, data_.begin(), data_.end(), other.data_.begin());
+constexpr bool Tensor<T,N,Variances...>::operator==(Tensor<T,N,Variances...> const & other) const {
+    if(std::is_constant_evaluated()) {
+        return data_ == other.data_;
+    }
+    return std::equal(execution::policy(), data_.begin(), data_.end(), other.data_.begin());
 }
 
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator+=(this_type const & other) {
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), other.data_.begin(), data_.begin(), std::plus<T>());
+constexpr Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator+=(this_type const & other) {
+    if(std::is_constant_evaluated()) {
+        return assign(*this + other);
+    }
+    ensure_elements(data_);
+    std::transform(execution::policy(), data_.begin(), data_.end(), other.data_.begin(), data_.begin(), std::plus<T>());
     return *this;
 }
 
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator-=(this_type const & other) {
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), other.data_.begin(), data_.begin(), std::minus<T>());
+constexpr Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator-=(this_type const & other) {
+    if(std::is_constant_evaluated()) {
+        return assign(*this - other);
+    }
+    ensure_elements(data_);
+    std::transform(execution::policy(), data_.begin(), data_.end(), other.data_.begin(), data_.begin(), std::minus<T>());
     return *this;
 }
 
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator*=(T scalar) {
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), data_.begin(), 
+constexpr Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator*=(T scalar) {
+    if(std::is_constant_evaluated()) {
+        return assign(*this * scalar);
+    }
+    ensure_elements(data_);
+    std::transform(execution::policy(), data_.begin(), data_.end(), data_.begin(), 
         [&scalar](T const & element) { return element * scalar; }
     );
     return *this;
 }
 
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator/=(T scalar) {
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), data_.begin(), 
+constexpr Tensor<T,N,Variances...>& Tensor<T,N,Variances...>::operator/=(T scalar) {
+    if(std::is_constant_evaluated()) {
+        return assign(*this / scalar);
+    }
+    ensure_elements(data_);
+    std::transform(execution::policy(), data_.begin(), data_.end(), data_.begin(), 
         [&scalar](T const & element) { return element / scalar; }
     );
     return *this;
 }
 
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...> Tensor<T,N,Variances...>::operator+(Tensor<T,N,Variances...> const & other) const {
-    Tensor<T,N,Variances...> result(true); // uninitialized
-
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), other.data_.begin(), result.data_.begin(), 
-        std::plus<T>()
-    );
-    return result;
-}
-
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...> Tensor<T,N,Variances...>::operator-(Tensor<T,N,Variances...> const & other) const {
-    Tensor<T,N,Variances...> result(true); // uninitialized
-
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), other.data_.begin(), result.data_.begin(), 
-        std::minus<T>()
-    );
-    return result;
-}
-
 template<typename Tuple, size_t ... Is>
 void print_tuple(std::ostream & os, Tuple const & t, std::index_sequence<Is...>) {
     os << "(";
@@ -244,33 +309,22 @@ std::ostream & operator<<(std::ostream & os, tuple<Ts...> const & t) {
 
 template<typename T, size_t N, typename ... Variances>
 template<size_t i, size_t j, typename ... SecondVariances>
-typename variances_to_tensor<T,N,typename contraction_type<i,j,Variances...,SecondVariances...>::type>::type
+constexpr typename variances_to_tensor<T,N,typename contraction_type<i,j,Variances...,SecondVariances...>::type>::type
 Tensor<T,N,Variances...>::multiplyAndContract(Tensor<T,N,SecondVariances...> const & other) const {
-    typedef Tensor<T,N,Variances...,SecondVariances...> product_type;
     typedef typename variances_to_tensor<T,N,typename contraction_type<i,j,Variances...,SecondVariances...>::type>::type result_type;
+    typedef ContractionLayout<N,sizeof...(Variances),sizeof...(SecondVariances),i,j> layout;
 
     result_type ret(true); // uninitialized
 
-    auto beg = ret.begin();
-
-    std::transform(std::execution::par_unseq, beg, ret.end(), beg, [&](T const & element) -> T {
-        // get the offset of this element
-        size_t dex = &element - beg;
+    // walk the result while tracking where each element starts in both factors
+    for_each_offsets<N,result_type::degree>(layout::strides(), [&](auto const & off, auto const &) {
+        size_t a = off[1], b = off[2];
 
         T dat = 0;
-
-        for(size_t k = 0; k < N; ++k, dex += stride<i,j>()) {
-            // turn the offset into tensor indices of the product
-            auto dims = product_type::dimension(dex);   
-
-            // split the dimensions into the first and second indices
-            auto ac = tuple_head<sizeof...(Variances)>(dims);
-            auto bc = tuple_tail<sizeof...(Variances)>(dims);
-
-            // add the product to our result
-            dat += get(ac) * other.get(bc);
+        for(size_t k = 0; k < N; ++k, a += layout::first_contracted, b += layout::second_contracted) {
+            dat += data_[a] * other[b];
         }
-        return dat;
+        ret[off[0]] = dat;
     });
 
     return ret;
@@ -278,53 +332,24 @@ Tensor<T,N,Variances...>::multiplyAndContract(Tensor<T,N,SecondVariances...> con
 
 template<typename T, size_t N, typename ... Variances>
 template<typename ... SecondVariances>
-Tensor<T,N,Variances...,SecondVariances...> 
+constexpr Tensor<T,N,Variances...,SecondVariances...> 
 Tensor<T,N,Variances...>::operator*(Tensor<T,N,SecondVariances...> const & other) const {
     typedef Tensor<T,N,Variances...,SecondVariances...> result_type;
 
     result_type ret(true); // uninitialized
 
-    auto beg = ret.begin();
-
-    std::transform(std::execution::par_unseq, beg, ret.end(), beg, [&](T const & element) -> T {
-        // get the offset of this element
-        size_t dex = &element - beg;
-
-        // turn the dex into a tuple of coordinates
-        auto c = result_type::dimension(dex);
-
-        // split the dimensions into the first and second coordinates
-        auto ac = tuple_head<sizeof...(Variances)>(c);
-        auto bc = tuple_tail<sizeof...(Variances)>(c);
-
-        // return the multiple of the elemtents from both tensors
-        return get(ac) * other.get(bc);
-    });
+    // the result is every element of this tensor times every element of the other
+    // and in storage order the first tensor's indices move fastest
+    for(size_t b = 0; b < other.size(); ++b) {
+        T const o = other[b];
+        for(size_t a = 0; a < size(); ++a) {
+            ret[a + b * size()] = data_[a] * o;
+        }
+    }
 
     return ret;
 }
 
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...> Tensor<T,N,Variances...>::operator*(T scalar) const {
-    Tensor<T,N,Variances...> result(true); // uninitialized
-
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), result.data_.begin(), 
-        [&scalar](T const & element) { return element * scalar; }
-    );
-    return result;
-}
-
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...> Tensor<T,N,Variances...>::operator/(T scalar) const {
-    Tensor<T,N,Variances...> result(true); // uninitialized
-
-    std::transform(std::execution::par_unseq, data_.begin(), data_.end(), result.data_.begin(), 
-        [&scalar](T const & element) { return element / scalar; }
-    );
-    return result;
-}
-
-
 template<typename T, size_t N, typename ... Variances>
 void Tensor<T,N,Variances...>::print(std::ostream & os) const {
     PrintHelper<T,N,typename Tensor<T,N,Variances...>::const_iterator,Variances...>::print(os, data_.begin());
@@ -337,46 +362,37 @@ auto uncontract_indices(tuple<Ts...> const & contracted, T val) {
 
 template<typename T, size_t N, typename ... Variances>
 template<size_t i, size_t j>
-auto Tensor<T,N,Variances...>::contract() const {
+constexpr auto Tensor<T,N,Variances...>::contract() const {
     typedef typename variances_to_tensor<T,N,typename contraction_type<i,j,Variances...>::type>::type contracted_type;
-    contracted_type c;
-        
-    std::transform(std::execution::par_unseq, c.begin(), c.end(), c.begin(), [&](auto & element) {
-        // first get the index
-        auto dex = &element - c.begin();
+    typedef ContractionLayout<N,degree,0,i,j> layout;
 
-        // transform the index into tensor indices
-        auto dims = c.dimension(dex);
+    contracted_type c(true); // uninitialized
 
-        // get the tensor index of the uncontracted tensor
-        // t0100::helper_type::index_type uncontracted;
-        // uncontract<0,1>(uncontracted, dims);
-        auto un = uncontract_indices<i,j>(dims, T(0));
-
-        // get the index in the uncontracted
-        // t.index(uncontracted);
-        // auto undims = tuple_splice(dims)
-        auto tdex = index(un);
+    for_each_offsets<N,contracted_type::degree>(layout::strides(), [&](auto const & off, auto const &) {
+        size_t tdex = off[1];
 
         T dat = 0;
-        for(size_t k = 0; k < N; ++k) {
-            dat += operator[](tdex + k * stride<i,j>());
+        for(size_t k = 0; k < N; ++k, tdex += layout::first_contracted) {
+            dat += data_[tdex];
         }
-
-        return dat;
+        c[off[0]] = dat;
     });
 
     return c;
 }
 
 template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...>::~Tensor() {}
-
-template<typename T, size_t N, typename ... Variances>
-Tensor<T,N,Variances...> Tensor<T,N,Variances...>::invert() const {
+constexpr Tensor<T,N,Variances...> Tensor<T,N,Variances...>::invert() const {
     Tensor<T,N,Variances...> ret(false); // don't initialize
 
-    std::transform(std::execution::par_unseq, begin(), end(), ret.begin(), [](T const & d) -> T {
+    if(std::is_constant_evaluated()) {
+        for(size_t i = 0; i < size(); ++i) {
+            ret[i] = 1.0 / data_[i];
+        }
+        return ret;
+    }
+
+    std::transform(execution::policy(), begin(), end(), ret.begin(), [](T const & d) -> T {
         return 1.0 / d;
     });
 
@@ -384,147 +400,35 @@ Tensor<T,N,Variances...> Tensor<T,N,Variances...>::invert() const {
 };
 
 
-template<typename Number>
-bool invert(const Number * m, Number * invOut)
-{
-    Number inv[16], det;
-    int i;
-
-    inv[0] = m[5]  * m[10] * m[15] - 
-             m[5]  * m[11] * m[14] - 
-             m[9]  * m[6]  * m[15] + 
-             m[9]  * m[7]  * m[14] +
-             m[13] * m[6]  * m[11] - 
-             m[13] * m[7]  * m[10];
-
-    inv[4] = -m[4]  * m[10] * m[15] + 
-              m[4]  * m[11] * m[14] + 
-              m[8]  * m[6]  * m[15] - 
-              m[8]  * m[7]  * m[14] - 
-              m[12] * m[6]  * m[11] + 
-              m[12] * m[7]  * m[10];
-
-    inv[8] = m[4]  * m[9] * m[15] - 
-             m[4]  * m[11] * m[13] - 
-             m[8]  * m[5] * m[15] + 
-             m[8]  * m[7] * m[13] + 
-             m[12] * m[5] * m[11] - 
-             m[12] * m[7] * m[9];
-
-    inv[12] = -m[4]  * m[9] * m[14] + 
-               m[4]  * m[10] * m[13] +
-               m[8]  * m[5] * m[14] - 
-               m[8]  * m[6] * m[13] - 
-               m[12] * m[5] * m[10] + 
-               m[12] * m[6] * m[9];
-
-    inv[1] = -m[1]  * m[10] * m[15] + 
-              m[1]  * m[11] * m[14] + 
-              m[9]  * m[2] * m[15] - 
-              m[9]  * m[3] * m[14] - 
-              m[13] * m[2] * m[11] + 
-              m[13] * m[3] * m[10];
-
-    inv[5] = m[0]  * m[10] * m[15] - 
-             m[0]  * m[11] * m[14] - 
-             m[8]  * m[2] * m[15] + 
-             m[8]  * m[3] * m[14] + 
-             m[12] * m[2] * m[11] - 
-             m[12] * m[3] * m[10];
-
-    inv[9] = -m[0]  * m[9] * m[15] + 
-              m[0]  * m[11] * m[13] + 
-              m[8]  * m[1] * m[15] - 
-              m[8]  * m[3] * m[13] - 
-              m[12] * m[1] * m[11] + 
-              m[12] * m[3] * m[9];
-
-    inv[13] = m[0]  * m[9] * m[14] - 
-              m[0]  * m[10] * m[13] - 
-              m[8]  * m[1] * m[14] + 
-              m[8]  * m[2] * m[13] + 
-              m[12] * m[1] * m[10] - 
-              m[12] * m[2] * m[9];
-
-    inv[2] = m[1]  * m[6] * m[15] - 
-             m[1]  * m[7] * m[14] - 
-             m[5]  * m[2] * m[15] + 
-             m[5]  * m[3] * m[14] + 
-             m[13] * m[2] * m[7] - 
-             m[13] * m[3] * m[6];
-
-    inv[6] = -m[0]  * m[6] * m[15] + 
-              m[0]  * m[7] * m[14] + 
-              m[4]  * m[2] * m[15] - 
-              m[4]  * m[3] * m[14] - 
-              m[12] * m[2] * m[7] + 
-              m[12] * m[3] * m[6];
-
-    inv[10] = m[0]  * m[5] * m[15] - 
-              m[0]  * m[7] * m[13] - 
-              m[4]  * m[1] * m[15] + 
-              m[4]  * m[3] * m[13] + 
-              m[12] * m[1] * m[7] - 
-              m[12] * m[3] * m[5];
-
-    inv[14] = -m[0]  * m[5] * m[14] + 
-               m[0]  * m[6] * m[13] + 
-               m[4]  * m[1] * m[14] - 
-               m[4]  * m[2] * m[13] - 
-               m[12] * m[1] * m[6] + 
-               m[12] * m[2] * m[5];
-
-    inv[3] = -m[1] * m[6] * m[11] + 
-              m[1] * m[7] * m[10] + 
-              m[5] * m[2] * m[11] - 
-              m[5] * m[3] * m[10] - 
-              m[9] * m[2] * m[7] + 
-              m[9] * m[3] * m[6];
-
-    inv[7] = m[0] * m[6] * m[11] - 
-             m[0] * m[7] * m[10] - 
-             m[4] * m[2] * m[11] + 
-             m[4] * m[3] * m[10] + 
-             m[8] * m[2] * m[7] - 
-             m[8] * m[3] * m[6];
-
-    inv[11] = -m[0] * m[5] * m[11] + 
-               m[0] * m[7] * m[9] + 
-               m[4] * m[1] * m[11] - 
-               m[4] * m[3] * m[9] - 
-               m[8] * m[1] * m[7] + 
-               m[8] * m[3] * m[5];
-
-    inv[15] = m[0] * m[5] * m[10] - 
-              m[0] * m[6] * m[9] - 
-              m[4] * m[1] * m[10] + 
-              m[4] * m[2] * m[9] + 
-              m[8] * m[1] * m[6] - 
-              m[8] * m[2] * m[5];
-
-    det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
-
-    if (det == 0)
-        return false;
-
-    det = 1.0 / det;
-
-    for (i = 0; i < 16; i++)
-        invOut[i] = inv[i] * det;
-
-    return true;
+// δ^a_b, or δ_a^b with the variances the other way around
+template<typename T, size_t N, typename First = Contravariant, typename Second = Covariant>
+constexpr Tensor<T,N,First,Second> kronecker_delta() {
+    static_assert(!std::is_same_v<First,Second>, "the kronecker delta has one upper and one lower index");
+    Tensor<T,N,First,Second> ret;
+    for(size_t a = 0; a < N; ++a) {
+        ret.unchecked(a, a) = 1;
+    }
+    return ret;
 }
 
-Tensor<float,4,Contravariant,Contravariant> invert(Tensor<float,4,Covariant,Covariant> const & in) {
-    Tensor<float,4,Contravariant,Contravariant> out;
-    invert(&in[0], &out[0]);
-    return out;
+// g_{ab} of flat spacetime, time first with signature (-,+,+,+)
+template<typename T>
+constexpr Tensor<T,4,Covariant,Covariant> minkowski() {
+    Tensor<T,4,Covariant,Covariant> ret;
+    ret.unchecked(0, 0) = -1;
+    for(size_t a = 1; a < 4; ++a) {
+        ret.unchecked(a, a) = 1;
+    }
+    return ret;
 }
 
-
-Tensor<float,4,Covariant,Covariant> invert(Tensor<float,4,Contravariant,Contravariant> const & in) {
-    Tensor<float,4,Covariant,Covariant> out;
-    invert(&in[0], &out[0]);
-    return out;
+// g^{ab} of flat spacetime, numerically the same as g_{ab}
+template<typename T>
+constexpr Tensor<T,4,Contravariant,Contravariant> inverse_minkowski() {
+    Tensor<T,4,Contravariant,Contravariant> ret;
+    ret.unchecked(0, 0) = -1;
+    for(size_t a = 1; a < 4; ++a) {
+        ret.unchecked(a, a) = 1;
+    }
+    return ret;
 }
-
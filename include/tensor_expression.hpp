@@ -0,0 +1,224 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+template<typename T, size_t N, typename ... Variances>
+class Tensor;
+
+/* Elementwise Tensor arithmetic builds expression nodes instead of
+   temporaries.  A node only records its operands, the whole expression is
+   evaluated in a single loop when it is assigned to or used to construct a
+   Tensor, so (a + b) * 0.5f - c reads every operand once and writes the
+   result once.
+
+   Each node carries the tensor_type of its result and binary nodes only exist
+   for operands of the same tensor type, so mixing variances is still a
+   compile error.
+
+   Named tensors are held by reference and temporaries are moved into the
+   node, so an expression kept in an auto variable is valid for as long as
+   the named tensors it uses.  Everything here is constexpr, so expressions
+   over constant tensors fold at compile time. */
+
+template<typename E>
+struct is_tensor : std::false_type {};
+
+template<typename T, size_t N, typename ... Variances>
+struct is_tensor<Tensor<T,N,Variances...>> : std::true_type {};
+
+template<typename E>
+struct is_tensor_expression_node : std::false_type {};
+
+template<typename E>
+concept tensor_expression = is_tensor<std::remove_cvref_t<E>>::value || is_tensor_expression_node<std::remove_cvref_t<E>>::value;
+
+// an unevaluated expression whose result is a Result, used by Tensor to accept expressions
+template<typename E, typename Result>
+concept tensor_expression_node_of = is_tensor_expression_node<std::remove_cvref_t<E>>::value &&
+                                    std::is_same_v<typename std::remove_cvref_t<E>::tensor_type, Result>;
+
+template<typename A, typename B>
+concept same_tensor_type = std::is_same_v<typename std::remove_cvref_t<A>::tensor_type, typename std::remove_cvref_t<B>::tensor_type>;
+
+// how a node stores an operand, named tensors by reference and everything else by value
+template<typename E>
+using expression_operand = std::conditional_t<
+    std::is_lvalue_reference_v<E> && is_tensor<std::remove_cvref_t<E>>::value,
+    std::remove_cvref_t<E> const &,
+    std::remove_cvref_t<E>>;
+
+/* A TensorView is not contiguous, so turning a flat element number into its
+   offset takes a division per index.  Expressions that read a view are
+   evaluated by walking indices instead: every leaf, a Tensor or a view, gets
+   its own offset in one for_each_offsets walk.  expression_leaves counts the
+   leaves, expression_leaf_strides fills in their strides in order and
+   expression_element_at reads the element at the current offsets.  Every
+   expression node other than Tensor provides leaves, reads_view, leaf_strides
+   and element_at for this. */
+template<typename E>
+constexpr size_t expression_leaves() {
+    if constexpr(is_tensor<std::remove_cvref_t<E>>::value) return 1;
+    else return std::remove_cvref_t<E>::leaves;
+}
+
+template<typename E>
+constexpr bool expression_reads_view() {
+    if constexpr(is_tensor<std::remove_cvref_t<E>>::value) return false;
+    else return std::remove_cvref_t<E>::reads_view;
+}
+
+template<typename E, size_t M, size_t S>
+constexpr void expression_leaf_strides(E const & e, std::array<std::array<size_t,M>,S> & strides, size_t first) {
+    if constexpr(is_tensor<E>::value) strides[first] = E::strides;
+    else e.leaf_strides(strides, first);
+}
+
+template<typename E, size_t S>
+constexpr auto expression_element_at(E const & e, std::array<size_t,S> const & offsets, size_t first) {
+    if constexpr(is_tensor<E>::value) return e[offsets[first]];
+    else return e.element_at(offsets, first);
+}
+
+// each element of an expression only reads the same element of its operands,
+// so evaluating into one of them has no loop carried dependency
+#if defined(__clang__)
+#define GRAVITATE_ELEMENTWISE_LOOP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define GRAVITATE_ELEMENTWISE_LOOP _Pragma("GCC ivdep")
+#else
+#define GRAVITATE_ELEMENTWISE_LOOP
+#endif
+
+template<typename Op, typename L, typename R>
+class TensorBinaryExpression {
+public:
+    typedef typename std::remove_cvref_t<L>::tensor_type tensor_type;
+    typedef typename tensor_type::element_type element_type;
+    static constexpr size_t size() { return tensor_type::size(); }
+
+    template<typename A, typename B>
+    constexpr TensorBinaryExpression(A && l, B && r) : l_(std::forward<A>(l)), r_(std::forward<B>(r)) {}
+
+    constexpr element_type operator[](size_t index) const { return Op()(l_[index], r_[index]); }
+
+    static constexpr size_t leaves = expression_leaves<L>() + expression_leaves<R>();
+    static constexpr bool reads_view = expression_reads_view<L>() || expression_reads_view<R>();
+    template<size_t M, size_t S>
+    constexpr void leaf_strides(std::array<std::array<size_t,M>,S> & strides, size_t first) const {
+        expression_leaf_strides(l_, strides, first);
+        expression_leaf_strides(r_, strides, first + expression_leaves<L>());
+    }
+    template<size_t S>
+    constexpr element_type element_at(std::array<size_t,S> const & offsets, size_t first) const {
+        return Op()(expression_element_at(l_, offsets, first), expression_element_at(r_, offsets, first + expression_leaves<L>()));
+    }
+
+private:
+    L l_;
+    R r_;
+};
+
+// an expression combined with the same scalar for every element
+template<typename Op, typename E>
+class TensorScalarExpression {
+public:
+    typedef typename std::remove_cvref_t<E>::tensor_type tensor_type;
+    typedef typename tensor_type::element_type element_type;
+    static constexpr size_t size() { return tensor_type::size(); }
+
+    template<typename A>
+    constexpr TensorScalarExpression(A && e, element_type scalar) : e_(std::forward<A>(e)), scalar_(scalar) {}
+
+    constexpr element_type operator[](size_t index) const { return Op()(e_[index], scalar_); }
+
+    static constexpr size_t leaves = expression_leaves<E>();
+    static constexpr bool reads_view = expression_reads_view<E>();
+    template<size_t M, size_t S>
+    constexpr void leaf_strides(std::array<std::array<size_t,M>,S> & strides, size_t first) const {
+        expression_leaf_strides(e_, strides, first);
+    }
+    template<size_t S>
+    constexpr element_type element_at(std::array<size_t,S> const & offsets, size_t first) const {
+        return Op()(expression_element_at(e_, offsets, first), scalar_);
+    }
+
+private:
+    E e_;
+    element_type scalar_;
+};
+
+template<typename E>
+class TensorNegateExpression {
+public:
+    typedef typename std::remove_cvref_t<E>::tensor_type tensor_type;
+    typedef typename tensor_type::element_type element_type;
+    static constexpr size_t size() { return tensor_type::size(); }
+
+    template<typename A>
+    constexpr TensorNegateExpression(A && e) : e_(std::forward<A>(e)) {}
+
+    constexpr element_type operator[](size_t index) const { return -e_[index]; }
+
+    static constexpr size_t leaves = expression_leaves<E>();
+    static constexpr bool reads_view = expression_reads_view<E>();
+    template<size_t M, size_t S>
+    constexpr void leaf_strides(std::array<std::array<size_t,M>,S> & strides, size_t first) const {
+        expression_leaf_strides(e_, strides, first);
+    }
+    template<size_t S>
+    constexpr element_type element_at(std::array<size_t,S> const & offsets, size_t first) const {
+        return -expression_element_at(e_, offsets, first);
+    }
+
+private:
+    E e_;
+};
+
+template<typename Op, typename L, typename R>
+struct is_tensor_expression_node<TensorBinaryExpression<Op,L,R>> : std::true_type {};
+
+template<typename Op, typename E>
+struct is_tensor_expression_node<TensorScalarExpression<Op,E>> : std::true_type {};
+
+template<typename E>
+struct is_tensor_expression_node<TensorNegateExpression<E>> : std::true_type {};
+
+
+template<tensor_expression L, tensor_expression R>
+    requires same_tensor_type<L,R>
+constexpr auto operator+(L && l, R && r) {
+    return TensorBinaryExpression<std::plus<>,expression_operand<L>,expression_operand<R>>(std::forward<L>(l), std::forward<R>(r));
+}
+
+template<tensor_expression L, tensor_expression R>
+    requires same_tensor_type<L,R>
+constexpr auto operator-(L && l, R && r) {
+    return TensorBinaryExpression<std::minus<>,expression_operand<L>,expression_operand<R>>(std::forward<L>(l), std::forward<R>(r));
+}
+
+template<tensor_expression E>
+constexpr auto operator-(E && e) {
+    return TensorNegateExpression<expression_operand<E>>(std::forward<E>(e));
+}
+
+template<tensor_expression E, typename S>
+    requires std::is_arithmetic_v<S>
+constexpr auto operator*(E && e, S scalar) {
+    return TensorScalarExpression<std::multiplies<>,expression_operand<E>>(std::forward<E>(e), scalar);
+}
+
+template<tensor_expression E, typename S>
+    requires std::is_arithmetic_v<S>
+constexpr auto operator*(S scalar, E && e) {
+    return TensorScalarExpression<std::multiplies<>,expression_operand<E>>(std::forward<E>(e), scalar);
+}
+
+template<tensor_expression E, typename S>
+    requires std::is_arithmetic_v<S>
+constexpr auto operator/(E && e, S scalar) {
+    return TensorScalarExpression<std::divides<>,expression_operand<E>>(std::forward<E>(e), scalar);
+}
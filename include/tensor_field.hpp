@@ -0,0 +1,322 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "tensor_expression.hpp"
+#include "linalg4.hpp"
+#include "detail/tensor_detail.hpp"
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+/*
+TensorField<T,N,Variances...> holds one Tensor per grid point as a structure of
+arrays: component c of every point is contiguous, at component(c)[point].  A
+kernel that does the same thing at every point then runs along those arrays
+and vectorises across points, where an array of Tensors (or of float16s, as
+main.cpp keeps them for OpenCL) would need a gather for every component.
+
+field[p] is a proxy for the tensor at point p.  It indexes like a Tensor,
+accepts Tensors and elementwise expressions, and is itself an expression, so
+
+    Tensor<float,4,Covariant,Covariant> g = field[p];
+    field[p] = g * 2.f + field[q];
+
+work as they would on Tensors.
+
+Each component array is padded to a multiple of a cache line, the padding is
+kept zero so the bulk kernels run over whole vectors without a scalar tail.
+*/
+
+template<typename T, size_t Alignment>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind { typedef AlignedAllocator<U,Alignment> other; };
+
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(AlignedAllocator<U,Alignment> const &) {}
+
+    T * allocate(size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T * p, size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template<typename U>
+    bool operator==(AlignedAllocator<U,Alignment> const &) const { return true; }
+};
+
+// the tensor at one point of a TensorField, Pointer is T * or T const *
+template<typename TensorType, typename Pointer>
+class TensorFieldPoint {
+public:
+    typedef TensorType tensor_type;
+    typedef typename tensor_type::element_type element_type;
+    typedef std::remove_pointer_t<Pointer> & reference;
+
+    static constexpr size_t dimensions = tensor_type::dimensions;
+    static constexpr size_t degree = tensor_type::degree;
+    static constexpr size_t size() { return tensor_type::size(); }
+
+    TensorFieldPoint(Pointer base, size_t stride) : base_(base), stride_(stride) {}
+    TensorFieldPoint(TensorFieldPoint const &) = default;
+
+    // assigning writes the components, a proxy never rebinds to another point
+    TensorFieldPoint & operator=(TensorFieldPoint const & other) { return assign(other); }
+    TensorFieldPoint & operator=(tensor_type const & t) { return assign(t); }
+    template<tensor_expression_node_of<tensor_type> E>
+    TensorFieldPoint & operator=(E const & expression) { return assign(expression); }
+
+    template<tensor_expression E>
+        requires same_tensor_type<E,tensor_type>
+    TensorFieldPoint & operator+=(E const & e) { return assign(*this + e); }
+    template<tensor_expression E>
+        requires same_tensor_type<E,tensor_type>
+    TensorFieldPoint & operator-=(E const & e) { return assign(*this - e); }
+    TensorFieldPoint & operator*=(element_type s) { return assign(*this * s); }
+    TensorFieldPoint & operator/=(element_type s) { return assign(*this / s); }
+
+    reference operator[](size_t c) const { return base_[c * stride_]; }
+
+    // a leaf of expression evaluation, see expression_leaves
+    static constexpr size_t leaves = 1;
+    static constexpr bool reads_view = false;
+    template<size_t M, size_t S>
+    void leaf_strides(std::array<std::array<size_t,M>,S> & strides, size_t first) const {
+        for(size_t k = 0; k < M; ++k) strides[first][k] = tensor_type::strides[k] * stride_;
+    }
+    template<size_t S>
+    reference element_at(std::array<size_t,S> const & offsets, size_t first) const { return base_[offsets[first]]; }
+
+    reference operator()(typename index_type_from_size<degree>::type index) const {
+        return (*this)[tensor_type::index(index)];
+    }
+    reference get(typename index_type_from_size<degree>::type index) const {
+        size_t c = tensor_type::index(index);
+        if(c >= size()) {
+            throw std::out_of_range("TensorFieldPoint::get");
+        }
+        return (*this)[c];
+    }
+    template<typename ... Is>
+    reference unchecked(Is ... is) const {
+        return (*this)[tensor_type::index(typename index_type_from_size<degree>::type(is...))];
+    }
+
+    tensor_type tensor() const { return tensor_type(*this); }
+
+    bool operator==(tensor_type const & t) const {
+        for(size_t c = 0; c < size(); ++c) {
+            if((*this)[c] != t[c]) return false;
+        }
+        return true;
+    }
+    bool operator!=(tensor_type const & t) const { return !(*this == t); }
+
+private:
+    Pointer base_;
+    size_t stride_;
+
+    template<typename E>
+    TensorFieldPoint & assign(E const & e) {
+        // through a Tensor, so an expression reading this point sees the old values
+        tensor_type t(e);
+        for(size_t c = 0; c < size(); ++c) {
+            base_[c * stride_] = t[c];
+        }
+        return *this;
+    }
+};
+
+template<typename TensorType, typename Pointer>
+struct is_tensor_expression_node<TensorFieldPoint<TensorType,Pointer>> : std::true_type {};
+
+
+template<typename T, size_t N, typename ... Variances>
+class TensorField {
+public:
+    typedef TensorField<T,N,Variances...> this_type;
+    typedef Tensor<T,N,Variances...> tensor_type;
+    typedef T element_type;
+    typedef TensorFieldPoint<tensor_type,T *> reference;
+    typedef TensorFieldPoint<tensor_type,T const *> const_reference;
+
+    static constexpr size_t alignment = 64;
+    static constexpr size_t lanes = alignment / sizeof(T);
+    static constexpr size_t dimensions = N;
+    static constexpr size_t degree = sizeof...(Variances);
+    static constexpr size_t components() { return tensor_type::size(); }
+
+    // points zero tensors
+    explicit TensorField(size_t points = 0)
+        : points_(points), stride_((points + lanes - 1) / lanes * lanes), data_(components() * stride_, T(0)) {}
+
+    explicit TensorField(std::vector<tensor_type> const & tensors) : TensorField(tensors.size()) {
+        for(size_t p = 0; p < points_; ++p) {
+            (*this)[p] = tensors[p];
+        }
+    }
+
+    size_t points() const { return points_; }
+    // distance between the same point in consecutive components
+    size_t stride() const { return stride_; }
+
+    T * data() { return data_.data(); }
+    T const * data() const { return data_.data(); }
+    T * component(size_t c) { return data_.data() + c * stride_; }
+    T const * component(size_t c) const { return data_.data() + c * stride_; }
+
+    reference operator[](size_t p) { return reference(data_.data() + p, stride_); }
+    const_reference operator[](size_t p) const { return const_reference(data_.data() + p, stride_); }
+    reference at(size_t p) { check_point(p); return (*this)[p]; }
+    const_reference at(size_t p) const { check_point(p); return (*this)[p]; }
+
+    std::vector<tensor_type> tensors() const {
+        std::vector<tensor_type> ret;
+        ret.reserve(points_);
+        for(size_t p = 0; p < points_; ++p) {
+            ret.emplace_back((*this)[p]);
+        }
+        return ret;
+    }
+
+    // from and to an array of structs, components() values per point, such as main.cpp's float16s
+    void load_interleaved(T const * src) {
+        for(size_t p = 0; p < points_; ++p)
+        for(size_t c = 0; c < components(); ++c) {
+            data_[c * stride_ + p] = src[p * components() + c];
+        }
+    }
+    void store_interleaved(T * dst) const {
+        for(size_t p = 0; p < points_; ++p)
+        for(size_t c = 0; c < components(); ++c) {
+            dst[p * components() + c] = data_[c * stride_ + p];
+        }
+    }
+
+    this_type & operator+=(this_type const & other) {
+        check_points(other);
+        return transform(other, [](T a, T b) { return a + b; });
+    }
+    this_type & operator-=(this_type const & other) {
+        check_points(other);
+        return transform(other, [](T a, T b) { return a - b; });
+    }
+    this_type & operator*=(T scalar) { return transform(*this, [scalar](T a, T) { return a * scalar; }); }
+    this_type & operator/=(T scalar) { return transform(*this, [scalar](T a, T) { return a / scalar; }); }
+
+    bool operator==(this_type const & other) const { return points_ == other.points_ && data_ == other.data_; }
+    bool operator!=(this_type const & other) const { return !(*this == other); }
+
+    void check_points(size_t points) const {
+        if(points != points_) {
+            throw std::invalid_argument("TensorField: fields have different numbers of points");
+        }
+    }
+    template<typename Field>
+    void check_points(Field const & other) const { check_points(other.points()); }
+
+private:
+    size_t points_;
+    size_t stride_;
+    std::vector<T,AlignedAllocator<T,alignment>> data_;
+
+    void check_point(size_t p) const {
+        if(p >= points_) {
+            throw std::out_of_range("TensorField::at");
+        }
+    }
+
+    template<typename Op>
+    this_type & transform(this_type const & other, Op op) {
+        T * a = data_.data();
+        T const * b = other.data_.data();
+        size_t const n = data_.size();
+        GRAVITATE_ELEMENTWISE_LOOP
+        for(size_t i = 0; i < n; ++i) {
+            a[i] = op(a[i], b[i]);
+        }
+        return *this;
+    }
+};
+
+template<typename Tensor>
+struct tensor_field_of;
+
+template<typename T, size_t N, typename ... Variances>
+struct tensor_field_of<Tensor<T,N,Variances...>> {
+    typedef TensorField<T,N,Variances...> type;
+};
+
+// out[p] += a[p] * b[p] over all points, the inner loop of the field kernels
+template<typename T>
+inline void field_multiply_add(T * out, T const * a, T const * b, size_t n) {
+    GRAVITATE_ELEMENTWISE_LOOP
+    for(size_t p = 0; p < n; ++p) {
+        out[p] += a[p] * b[p];
+    }
+}
+
+// a.multiplyAndContract<i,j>(b) at every point
+template<size_t i, size_t j, typename T, size_t N, typename ... AV, typename ... BV>
+auto multiply_and_contract(TensorField<T,N,AV...> const & a, TensorField<T,N,BV...> const & b) {
+    typedef decltype(Tensor<T,N,AV...>().template multiplyAndContract<i,j>(Tensor<T,N,BV...>())) result_tensor;
+    typedef typename tensor_field_of<result_tensor>::type result_type;
+    typedef ContractionLayout<N,sizeof...(AV),sizeof...(BV),i,j> layout;
+
+    a.check_points(b);
+    result_type ret(a.points());
+
+    for_each_offsets<N,result_tensor::degree>(layout::strides(), [&](auto const & off, auto const &) {
+        for(size_t k = 0; k < N; ++k) {
+            field_multiply_add(ret.component(off[0]),
+                               a.component(off[1] + k * layout::first_contracted),
+                               b.component(off[2] + k * layout::second_contracted),
+                               ret.stride());
+        }
+    });
+
+    return ret;
+}
+
+// t.contract<i,j>() at every point
+template<size_t i, size_t j, typename T, size_t N, typename ... Variances>
+auto contract(TensorField<T,N,Variances...> const & t) {
+    typedef decltype(Tensor<T,N,Variances...>().template contract<i,j>()) result_tensor;
+    typedef typename tensor_field_of<result_tensor>::type result_type;
+    typedef ContractionLayout<N,sizeof...(Variances),0,i,j> layout;
+
+    result_type ret(t.points());
+
+    for_each_offsets<N,result_tensor::degree>(layout::strides(), [&](auto const & off, auto const &) {
+        T * out = ret.component(off[0]);
+        for(size_t k = 0; k < N; ++k) {
+            T const * in = t.component(off[1] + k * layout::first_contracted);
+            size_t const n = ret.stride();
+            GRAVITATE_ELEMENTWISE_LOOP
+            for(size_t p = 0; p < n; ++p) {
+                out[p] += in[p];
+            }
+        }
+    });
+
+    return ret;
+}
+
+/* inverts the matrix at every point with the batched linalg4 kernel and returns
+   how many were singular, those points come out zero as invert() per point */
+inline size_t invert(TensorField<float,4,Covariant,Covariant> const & in, TensorField<float,4,Contravariant,Contravariant> & out) {
+    in.check_points(out);
+    return linalg4_kernels().invert_soa(in.data(), out.data(), in.points(), in.stride());
+}
+
+inline size_t invert(TensorField<float,4,Contravariant,Contravariant> const & in, TensorField<float,4,Covariant,Covariant> & out) {
+    in.check_points(out);
+    return linalg4_kernels().invert_soa(in.data(), out.data(), in.points(), in.stride());
+}
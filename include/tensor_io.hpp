@@ -0,0 +1,66 @@
+#pragma once
+
+#include "block.hpp"
+#include "tensor.hpp"
+#include "packed_tensor.hpp"
+#include "grblock.hpp"
+#include "reduced_precision.hpp"
+
+#include <cstddef>
+#include <type_traits>
+
+/*
+Tensor blocks for BlockStorage, kept on disk in the same form they have in
+memory so a block is read or written with one call and needs no conversion.
+
+On disk, in native byte order:
+    Tensor<T,N,V...>          its N^degree elements in storage order, the
+                              first index moving fastest
+    PackedTensor              its packed slots in order, see packed_tensor.hpp
+    BasicGRElement<T,A>       metric, inverse, metric_derivative,
+                              inverse_derivative, metric_2nd_derivative one
+                              after the other, 10 + 10 + 40 + 40 + 100 T's
+                              with no padding, 800 bytes for a float GRElement
+    CompactTensor, CompactGRElement
+                              the same with every element as fp16 or bf16
+    std::array<Block,M>       M of the above back to back
+
+Every field starts at a multiple of the size of its element, so a block read
+into (or mapped at) memory aligned for T is a valid object in place.  Tensors
+with heap or arena storage are written element by element instead, since
+their bytes are a pointer.
+*/
+
+template<typename T, size_t N, typename ... Variances>
+    requires Tensor<T,N,Variances...>::inline_storage
+struct is_fixed_layout<Tensor<T,N,Variances...>> : std::true_type {};
+
+template<typename T, size_t N, typename Symmetry, typename ... Variances>
+struct is_fixed_layout<PackedTensor<T,N,Symmetry,Variances...>> : std::true_type {};
+
+template<typename T, typename Accumulator>
+struct is_fixed_layout<BasicGRElement<T,Accumulator>> : std::true_type {};
+
+template<typename Storage, typename TensorType>
+struct is_fixed_layout<CompactTensor<Storage,TensorType>> : std::true_type {};
+
+template<typename Storage>
+struct is_fixed_layout<CompactGRElement<Storage>> : std::true_type {};
+
+// the layout above is the layout of the struct, nothing in between the fields
+static_assert(sizeof(GRElement) == 200 * sizeof(float));
+static_assert(sizeof(DoubleGRElement) == 200 * sizeof(double));
+static_assert(sizeof(CompactGRElement<fp16>) == 200 * sizeof(fp16));
+
+// a Tensor whose elements live behind a pointer, written in storage order
+template<typename T, size_t N, typename ... Variances>
+    requires (!Tensor<T,N,Variances...>::inline_storage)
+struct FixedReadWriter<Tensor<T,N,Variances...>> {
+    typedef Tensor<T,N,Variances...> data_type;
+    void read(istream & is, data_type & t) {
+        is.read(reinterpret_cast<char *>(&t[0]), sizeof(T) * t.size());
+    }
+    void write(ostream & os, data_type const & t) {
+        os.write(reinterpret_cast<const char *>(&t[0]), sizeof(T) * t.size());
+    }
+};
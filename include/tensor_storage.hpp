@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+Where a Tensor keeps its elements.
+
+tensor_storage<T,Size> picks the storage of a Tensor holding Size elements of
+type T, the same way tensor_execution picks its execution policy:
+
+    std::array<T,Size>     inline, the default for anything smaller than
+                           GRAVITATE_TENSOR_ARENA_THRESHOLD bytes
+    HeapStorage<T,Size>    one allocation per tensor
+    ArenaStorage<T,Size>   the default from the threshold up
+
+Inline storage keeps small tensors in registers and on the stack and is the
+only one usable in constant expressions.  A degree 6 tensor in 4 dimensions is
+16KiB of floats, a few of those in a TBB task are enough to run a worker
+thread's stack out, so large tensors live in a thread local bump arena.  Wrap
+the work on one grid point in a TensorArena::Scope:
+
+    tbb::parallel_for(..., [&](size_t p) {
+        TensorArena::Scope scope; // everything allocated below goes at the end
+        ...
+    });
+
+Allocating in a scope moves a pointer, and the end of the scope moves it back,
+so once the arena has grown to the largest grid point there is no malloc left
+in the loop.  A tensor default constructed or built from an expression inside a
+scope must not outlive it.  Copies and moves are constructed on the heap, and
+assigning copies the elements, so a tensor pushed into a container or assigned
+to one declared outside the scope never holds arena memory.  Outside of any
+scope ArenaStorage allocates from the heap like HeapStorage.
+
+Moving a HeapStorage takes its pointer and leaves the source without elements,
+so a move costs no allocation.  Assigning to the source, or writing it through
+ensure_elements as the Tensor operators do, allocates again; reading it before
+that is an error.
+
+Specialise tensor_storage to change the storage of one element type or size.
+*/
+
+// size in bytes from which tensors go to the arena
+#ifndef GRAVITATE_TENSOR_ARENA_THRESHOLD
+#define GRAVITATE_TENSOR_ARENA_THRESHOLD 16384
+#endif
+
+class TensorArena {
+public:
+    static constexpr size_t alignment = 64;
+    static constexpr size_t chunk_size = size_t(1) << 20;
+
+    // rewinds the calling thread's arena to where it was on construction
+    class Scope {
+    public:
+        Scope() : arena_(TensorArena::local()), chunk_(arena_.chunk_), offset_(arena_.offset_) { ++arena_.depth_; }
+        ~Scope() {
+            --arena_.depth_;
+            arena_.chunk_ = chunk_;
+            arena_.offset_ = offset_;
+        }
+        Scope(Scope const &) = delete;
+        Scope & operator=(Scope const &) = delete;
+
+    private:
+        TensorArena & arena_;
+        size_t chunk_;
+        size_t offset_;
+    };
+
+    static TensorArena & local() {
+        static thread_local TensorArena arena;
+        return arena;
+    }
+
+    TensorArena() = default;
+    TensorArena(TensorArena const &) = delete;
+    TensorArena & operator=(TensorArena const &) = delete;
+    ~TensorArena() {
+        for(auto const & c : chunks_) {
+            ::operator delete(c.data, std::align_val_t(alignment));
+        }
+    }
+
+    // whether allocations go to the arena, only inside a Scope
+    bool active() const { return depth_ > 0; }
+
+    void * allocate(size_t bytes) {
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        while(chunk_ < chunks_.size() && offset_ + bytes > chunks_[chunk_].size) {
+            ++chunk_;
+            offset_ = 0;
+        }
+        if(chunk_ == chunks_.size()) {
+            size_t size = std::max(bytes, chunk_size);
+            chunks_.push_back({ static_cast<std::byte *>(::operator new(size, std::align_val_t(alignment))), size });
+            offset_ = 0;
+        }
+        void * p = chunks_[chunk_].data + offset_;
+        offset_ += bytes;
+        return p;
+    }
+
+    // bytes held by the arena, it only grows
+    size_t reserved() const {
+        size_t total = 0;
+        for(auto const & c : chunks_) total += c.size;
+        return total;
+    }
+
+private:
+    struct Chunk {
+        std::byte * data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks_;
+    size_t chunk_ = 0;
+    size_t offset_ = 0;
+    size_t depth_ = 0;
+};
+
+// Size elements behind a pointer, from the heap or, when UseArena is set and a scope is open, the arena
+template<typename T, size_t Size, bool UseArena>
+class AllocatedStorage {
+public:
+    typedef T value_type;
+    typedef T * iterator;
+    typedef T const * const_iterator;
+
+    static constexpr size_t size() { return Size; }
+
+    AllocatedStorage() { acquire(); } // uninitialized, as std::array
+    AllocatedStorage(std::array<T,Size> const & data) {
+        acquire();
+        std::copy(data.begin(), data.end(), data_);
+    }
+    // copies and moves may be kept past the scope they are made in, a container
+    // element for one, so they never take arena memory
+    AllocatedStorage(AllocatedStorage const & other) {
+        acquire(false);
+        std::copy(other.begin(), other.end(), data_);
+    }
+    // the moved from storage keeps its elements (arena) or is left without any (heap)
+    AllocatedStorage(AllocatedStorage && other) noexcept(!UseArena) {
+        if constexpr(UseArena) {
+            acquire(false);
+            std::copy(other.begin(), other.end(), data_);
+        } else {
+            data_ = std::exchange(other.data_, nullptr);
+            owned_ = std::exchange(other.owned_, false);
+        }
+    }
+
+    AllocatedStorage & operator=(AllocatedStorage const & other) {
+        if(this != &other) {
+            if(!data_) acquire();
+            std::copy(other.begin(), other.end(), data_);
+        }
+        return *this;
+    }
+    AllocatedStorage & operator=(AllocatedStorage && other) noexcept {
+        if constexpr(UseArena) {
+            // other may come from a scope that ends before this does, so copy rather than steal
+            return *this = static_cast<AllocatedStorage const &>(other);
+        } else {
+            // a source that was itself moved from has nothing to give
+            if(!other.data_) {
+                ensure_elements();
+                return *this;
+            }
+            std::swap(data_, other.data_);
+            std::swap(owned_, other.owned_);
+            return *this;
+        }
+    }
+
+    // allocates again after a move took the elements, call before writing
+    void ensure_elements() { if(!data_) acquire(); }
+
+    ~AllocatedStorage() {
+        if(owned_) {
+            ::operator delete(data_, std::align_val_t(TensorArena::alignment));
+        }
+    }
+
+    T * data() { return data_; }
+    T const * data() const { return data_; }
+
+    T & operator[](size_t index) { return data_[index]; }
+    T const & operator[](size_t index) const { return data_[index]; }
+    T & at(size_t index) { check(index); return data_[index]; }
+    T const & at(size_t index) const { check(index); return data_[index]; }
+
+    iterator begin() { return data_; }
+    const_iterator begin() const { return data_; }
+    iterator end() { return data_ + Size; }
+    const_iterator end() const { return data_ + Size; }
+
+    bool operator==(AllocatedStorage const & other) const { return std::equal(begin(), end(), other.begin()); }
+
+    // whether the elements are in a TensorArena rather than on the heap
+    bool in_arena() const { return data_ && !owned_; }
+
+private:
+    T * data_ = nullptr;
+    bool owned_ = false;
+
+    void acquire(bool arena_allowed = true) {
+        TensorArena & arena = TensorArena::local();
+        if(UseArena && arena_allowed && arena.active()) {
+            data_ = static_cast<T *>(arena.allocate(sizeof(T) * Size));
+            owned_ = false;
+        } else {
+            data_ = static_cast<T *>(::operator new(sizeof(T) * Size, std::align_val_t(TensorArena::alignment)));
+            owned_ = true;
+        }
+    }
+
+    static void check(size_t index) {
+        if(index >= Size) {
+            throw std::out_of_range("AllocatedStorage::at");
+        }
+    }
+};
+
+// nothing to do for storage that cannot be left empty by a move
+template<typename S>
+constexpr void ensure_elements(S &) {}
+
+template<typename T, size_t Size, bool UseArena>
+void ensure_elements(AllocatedStorage<T,Size,UseArena> & storage) { storage.ensure_elements(); }
+
+template<typename T, size_t Size>
+using HeapStorage = AllocatedStorage<T,Size,false>;
+
+template<typename T, size_t Size>
+using ArenaStorage = AllocatedStorage<T,Size,true>;
+
+template<typename T, size_t Size>
+struct tensor_storage {
+    static constexpr bool arena = Size * sizeof(T) >= GRAVITATE_TENSOR_ARENA_THRESHOLD;
+
+    typedef std::conditional_t<arena, ArenaStorage<T,Size>, std::array<T,Size>> type;
+};
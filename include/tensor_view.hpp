@@ -0,0 +1,264 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "tensor_expression.hpp"
+#include "detail/tensor_detail.hpp"
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+TensorView<T,N,Variances...> is a Tensor that does not own its elements.  It is
+a pointer plus one stride per index, so it can wrap memory that belongs to
+someone else (a BlockStorage frame, a mapped OpenCL buffer, a Tensor) and
+derive further views without copying:
+
+    auto dg = view(metric_derivative);   // TensorView<float,4,Cov,Cov,Cov>
+    auto d0 = dg.fix<0>(0);              // d_0 g_bc, TensorView<float,4,Cov,Cov>
+    auto t = d0.permute<1,0>();          // d_0 g_cb
+
+Views keep their variance types, read and write through to the memory they
+wrap, and are elementwise expressions, so Tensor t = a_view + b; and
+a_view = b * 2.f; work as they do on Tensors.  Those walk the view's strides
+with for_each_offsets; operator[] takes an element number in Tensor storage
+order and has to decode it, so it is for single elements, not loops.  T is const for a read only
+view.  A view is only valid as long as the memory it wraps.
+*/
+
+template<typename T, size_t N, typename ... Variances>
+class TensorView;
+
+// the TensorView with element T over the variances in a tuple
+template<typename T, size_t N, typename Tuple>
+struct tensor_view_of;
+
+template<typename T, size_t N, typename ... Variances>
+struct tensor_view_of<T,N,tuple<Variances...>> {
+    typedef TensorView<T,N,Variances...> type;
+};
+
+template<typename T, size_t N, typename ... Variances>
+class TensorView {
+public:
+    typedef TensorView<T,N,Variances...> this_type;
+    typedef Tensor<std::remove_const_t<T>,N,Variances...> tensor_type;
+    typedef std::remove_const_t<T> element_type;
+
+    static constexpr size_t dimensions = N;
+    static constexpr size_t degree = sizeof...(Variances);
+    static constexpr size_t size() { return tensor_type::size(); }
+
+    typedef std::array<size_t,degree> strides_type;
+    typedef typename index_type_from_size<degree>::type index_type;
+
+    // contiguous memory in Tensor's layout
+    explicit TensorView(T * data) : data_(data), strides_(tensor_type::strides) {}
+    TensorView(T * data, strides_type const & strides) : data_(data), strides_(strides) {}
+
+    TensorView(tensor_type & t) requires (!std::is_const_v<T>) : TensorView(&t[0]) {}
+    TensorView(tensor_type const & t) requires std::is_const_v<T> : TensorView(&t[0]) {}
+    // a writable view can always be read
+    TensorView(TensorView<element_type,N,Variances...> const & other) requires std::is_const_v<T>
+        : data_(other.data()), strides_(other.strides()) {}
+    TensorView(this_type const &) = default;
+
+    // assigning writes the elements, a view never rebinds to other memory
+    this_type & operator=(this_type const & other) { return assign(other); }
+    this_type & operator=(tensor_type const & t) { return assign(t); }
+    template<tensor_expression_node_of<tensor_type> E>
+    this_type & operator=(E const & expression) { return assign(expression); }
+
+    template<tensor_expression E>
+        requires same_tensor_type<E,tensor_type>
+    this_type & operator+=(E const & e) { return assign(*this + e); }
+    template<tensor_expression E>
+        requires same_tensor_type<E,tensor_type>
+    this_type & operator-=(E const & e) { return assign(*this - e); }
+    this_type & operator*=(element_type s) { return assign(*this * s); }
+    this_type & operator/=(element_type s) { return assign(*this / s); }
+
+    T * data() const { return data_; }
+    strides_type const & strides() const { return strides_; }
+
+    // element in Tensor storage order, the first index moving fastest, one division per index
+    T & operator[](size_t index) const {
+        size_t offset = 0;
+        for(size_t k = 0; k < degree; ++k) {
+            offset += index % N * strides_[k];
+            index /= N;
+        }
+        return data_[offset];
+    }
+
+    // a leaf of expression evaluation, see expression_leaves
+    static constexpr size_t leaves = 1;
+    static constexpr bool reads_view = true;
+    template<size_t M, size_t S>
+    void leaf_strides(std::array<std::array<size_t,M>,S> & strides, size_t first) const { strides[first] = strides_; }
+    template<size_t S>
+    T & element_at(std::array<size_t,S> const & offsets, size_t first) const { return data_[offsets[first]]; }
+
+    T & operator()(index_type index) const {
+        return data_[offset_of(index, std::make_index_sequence<degree>{})];
+    }
+    // bounds checked element access
+    T & get(index_type index) const {
+        std::apply([](auto ... is) {
+            if(((is >= N) || ...)) throw std::out_of_range("TensorView::get");
+        }, index);
+        return (*this)(index);
+    }
+    template<typename ... Is>
+    T & unchecked(Is ... is) const {
+        static_assert(sizeof...(Is) == degree, "one index per tensor index");
+        return (*this)(index_type(size_t(is)...));
+    }
+
+    // the view with index K held at value, one degree lower
+    template<size_t K>
+    auto fix(size_t value) const {
+        static_assert(K < degree, "no such index");
+        return fix_impl<K>(value, std::make_index_sequence<degree - 1>{});
+    }
+
+    // the view whose index r is index Ps[r] of this one
+    template<size_t ... Ps>
+    auto permute() const {
+        static_assert(sizeof...(Ps) == degree, "one position per index");
+        static_assert(is_permutation<Ps...>(), "not a permutation");
+        typedef typename tensor_view_of<T,N,tuple<std::tuple_element_t<Ps,tuple<Variances...>>...>>::type view_type;
+        return view_type(data_, { strides_[Ps]... });
+    }
+
+    tensor_type tensor() const { return tensor_type(*this); }
+
+    bool operator==(tensor_type const & t) const {
+        bool equal = true;
+        for_each_offsets<N,degree,2>({ strides_, tensor_type::strides }, [&](auto const & off, auto const &) {
+            equal = equal && data_[off[0]] == t[off[1]];
+        });
+        return equal;
+    }
+    bool operator!=(tensor_type const & t) const { return !(*this == t); }
+
+private:
+    T * data_;
+    strides_type strides_;
+
+    template<size_t ... Ks>
+    size_t offset_of(index_type const & index, std::index_sequence<Ks...>) const {
+        return (size_t(0) + ... + (std::get<Ks>(index) * strides_[Ks]));
+    }
+
+    template<size_t K, size_t ... Rs>
+    auto fix_impl(size_t value, std::index_sequence<Rs...>) const {
+        typedef typename tensor_view_of<T,N,tuple<std::tuple_element_t<(Rs < K ? Rs : Rs + 1),tuple<Variances...>>...>>::type view_type;
+        return view_type(data_ + value * strides_[K], { strides_[Rs < K ? Rs : Rs + 1]... });
+    }
+
+    template<size_t ... Ps>
+    static constexpr bool is_permutation() {
+        std::array<size_t,sizeof...(Ps)> ps = { Ps... };
+        for(size_t a = 0; a < ps.size(); ++a) {
+            if(ps[a] >= ps.size()) return false;
+            for(size_t b = 0; b < a; ++b) {
+                if(ps[a] == ps[b]) return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename E>
+    this_type & assign(E const & e) {
+        static_assert(!std::is_const_v<T>, "assigning to a read only view");
+        // through a Tensor, so an expression reading overlapping memory sees the old values
+        tensor_type t(e);
+        for_each_offsets<N,degree,2>({ strides_, tensor_type::strides }, [&](auto const & off, auto const &) {
+            data_[off[0]] = t[off[1]];
+        });
+        return *this;
+    }
+};
+
+template<typename T, size_t N, typename ... Variances>
+struct is_tensor_expression_node<TensorView<T,N,Variances...>> : std::true_type {};
+
+template<typename T, size_t N, typename ... Variances>
+TensorView<T,N,Variances...> view(Tensor<T,N,Variances...> & t) {
+    return TensorView<T,N,Variances...>(t);
+}
+
+template<typename T, size_t N, typename ... Variances>
+TensorView<T const,N,Variances...> view(Tensor<T,N,Variances...> const & t) {
+    return TensorView<T const,N,Variances...>(t);
+}
+
+/* a.multiplyAndContract<i,j>(b) over views, reading the operands in place.  The
+   loop is the one in Tensor::multiplyAndContract with the views' strides. */
+template<size_t i, size_t j, typename TA, typename TB, size_t N, typename ... AV, typename ... BV>
+auto multiply_and_contract(TensorView<TA,N,AV...> const & a, TensorView<TB,N,BV...> const & b) {
+    typedef std::remove_const_t<TA> T;
+    static_assert(std::is_same_v<T,std::remove_const_t<TB>>, "views of different element types");
+    typedef typename variances_to_tensor<T,N,typename contraction_type<i,j,AV...,BV...>::type>::type result_type;
+    constexpr size_t A = sizeof...(AV);
+    constexpr size_t lo = i < j ? i : j, hi = i < j ? j : i;
+
+    auto first_stride = [&](size_t p) -> size_t { return p < A ? a.strides()[p] : 0; };
+    auto second_stride = [&](size_t p) -> size_t { return p < A ? 0 : b.strides()[p - A]; };
+
+    std::array<std::array<size_t,result_type::degree>,3> strides{};
+    strides[0] = make_strides<N,result_type::degree>();
+    for(size_t r = 0, p = 0; r < result_type::degree; ++r, ++p) {
+        while(p == lo || p == hi) ++p;
+        strides[1][r] = first_stride(p);
+        strides[2][r] = second_stride(p);
+    }
+    size_t const first_contracted = first_stride(lo) + first_stride(hi);
+    size_t const second_contracted = second_stride(lo) + second_stride(hi);
+
+    result_type ret(true); // uninitialized
+    for_each_offsets<N,result_type::degree>(strides, [&](auto const & off, auto const &) {
+        TA * pa = a.data() + off[1];
+        TB * pb = b.data() + off[2];
+
+        T dat = 0;
+        for(size_t k = 0; k < N; ++k, pa += first_contracted, pb += second_contracted) {
+            dat += *pa * *pb;
+        }
+        ret[off[0]] = dat;
+    });
+
+    return ret;
+}
+
+// t.contract<i,j>() over a view
+template<size_t i, size_t j, typename T, size_t N, typename ... Variances>
+auto contract(TensorView<T,N,Variances...> const & t) {
+    typedef typename variances_to_tensor<std::remove_const_t<T>,N,typename contraction_type<i,j,Variances...>::type>::type result_type;
+    constexpr size_t lo = i < j ? i : j, hi = i < j ? j : i;
+
+    std::array<std::array<size_t,result_type::degree>,2> strides{};
+    strides[0] = make_strides<N,result_type::degree>();
+    for(size_t r = 0, p = 0; r < result_type::degree; ++r, ++p) {
+        while(p == lo || p == hi) ++p;
+        strides[1][r] = t.strides()[p];
+    }
+    size_t const contracted = t.strides()[lo] + t.strides()[hi];
+
+    result_type ret(true); // uninitialized
+    for_each_offsets<N,result_type::degree>(strides, [&](auto const & off, auto const &) {
+        T * pt = t.data() + off[1];
+
+        std::remove_const_t<T> dat = 0;
+        for(size_t k = 0; k < N; ++k, pt += contracted) {
+            dat += *pt;
+        }
+        ret[off[0]] = dat;
+    });
+
+    return ret;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+/* Scoped spans written to per-thread ring buffers and exported as Chrome
+   trace JSON (chrome://tracing, ui.perfetto.dev).
+
+   Spans are only compiled in when GRAVITATE_ENABLE_TRACE is defined, otherwise
+   GRAVITATE_TRACE_SCOPE expands to nothing and write_chrome_trace writes an
+   empty trace, so callers never need their own #ifdefs. */
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#define GRAVITATE_TRACE_CONCAT_INNER(a, b) a##b
+#define GRAVITATE_TRACE_CONCAT(a, b) GRAVITATE_TRACE_CONCAT_INNER(a, b)
+
+#ifdef GRAVITATE_ENABLE_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    char const * category;
+    char const * name;
+    uint64_t begin_ns;
+    uint64_t duration_ns;
+};
+
+/* TraceBuffer is a single producer ring of the most recent events of one thread */
+class TraceBuffer {
+public:
+    static constexpr size_t capacity = 1 << 16;
+
+    TraceBuffer(uint32_t thread_id) : thread_id_(thread_id), events_(capacity), head_(0) {}
+
+    void push(TraceEvent const & event) {
+        auto h = head_.load(std::memory_order_relaxed);
+        events_[h % capacity] = event;
+        head_.store(h + 1, std::memory_order_release);
+    }
+
+    uint32_t thread_id() const { return thread_id_; }
+    uint64_t head() const { return head_.load(std::memory_order_acquire); }
+    TraceEvent const & operator[](uint64_t i) const { return events_[i % capacity]; }
+    void clear() { head_.store(0, std::memory_order_release); }
+
+private:
+    uint32_t thread_id_;
+    std::vector<TraceEvent> events_;
+    std::atomic<uint64_t> head_;
+};
+
+/* TraceRegistry owns every thread's buffer so events survive the thread that wrote them */
+class TraceRegistry {
+public:
+    static TraceRegistry & instance() {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    TraceBuffer & local() {
+        thread_local std::shared_ptr<TraceBuffer> buffer = create();
+        return *buffer;
+    }
+
+    uint64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch_).count();
+    }
+
+    template<typename Function>
+    void for_each_buffer(Function f) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        for(auto const & b : buffers_) {
+            f(*b);
+        }
+    }
+
+private:
+    TraceRegistry() : epoch_(std::chrono::steady_clock::now()) {}
+
+    std::shared_ptr<TraceBuffer> create() {
+        std::unique_lock<std::mutex> guard(mutex_);
+        buffers_.push_back(std::make_shared<TraceBuffer>((uint32_t)buffers_.size() + 1));
+        return buffers_.back();
+    }
+
+    std::chrono::steady_clock::time_point epoch_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers_;
+};
+
+/* TraceScope records one complete ("X") event covering its lifetime */
+class TraceScope {
+public:
+    TraceScope(char const * category, char const * name)
+        : category_(category), name_(name), begin_ns_(TraceRegistry::instance().now_ns()) {}
+    ~TraceScope() {
+        auto & registry = TraceRegistry::instance();
+        registry.local().push(TraceEvent{category_, name_, begin_ns_, registry.now_ns() - begin_ns_});
+    }
+    TraceScope(TraceScope const &) = delete;
+    TraceScope & operator=(TraceScope const &) = delete;
+
+private:
+    char const * category_;
+    char const * name_;
+    uint64_t begin_ns_;
+};
+
+#define GRAVITATE_TRACE_SCOPE(category, name) \
+    TraceScope GRAVITATE_TRACE_CONCAT(trace_scope_, __LINE__)(category, name)
+
+// chrome trace timestamps are fractional microseconds
+inline void write_trace_microseconds(std::ostream & os, uint64_t ns) {
+    auto r = ns % 1000;
+    os << ns / 1000 << "." << r / 100 << (r / 10) % 10 << r % 10;
+}
+
+// call while the traced threads are quiet, a buffer that wraps during the
+// export can hand out a partly overwritten event
+inline void write_chrome_trace(std::ostream & os) {
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    TraceRegistry::instance().for_each_buffer([&](TraceBuffer const & b) {
+        uint64_t end = b.head();
+        uint64_t begin = end > TraceBuffer::capacity ? end - TraceBuffer::capacity : 0;
+        for(uint64_t i = begin; i < end; ++i) {
+            auto const & e = b[i];
+            os << (first ? "\n" : ",\n");
+            os << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\""
+               << ",\"ts\":";
+            write_trace_microseconds(os, e.begin_ns);
+            os << ",\"dur\":";
+            write_trace_microseconds(os, e.duration_ns);
+            os << ",\"pid\":1,\"tid\":" << b.thread_id() << "}";
+            first = false;
+        }
+    });
+    os << "\n]}\n";
+}
+
+inline void clear_trace() {
+    TraceRegistry::instance().for_each_buffer([](TraceBuffer & b) { b.clear(); });
+}
+
+#else
+
+#define GRAVITATE_TRACE_SCOPE(category, name) ((void)0)
+
+inline void write_chrome_trace(std::ostream & os) {
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[]}\n";
+}
+
+inline void clear_trace() {}
+
+#endif
+
+inline void write_chrome_trace(std::string const & path) {
+    std::ofstream os(path, std::ios::out | std::ios::trunc);
+    if(!os) {
+        std::stringstream ss;
+        ss << "Could not open trace file: " << path;
+        throw std::runtime_error(ss.str());
+    }
+    write_chrome_trace(os);
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+What the benchmarks share: the command line and the CSV and JSON output.
+
+Each benchmark's Result turns itself into a BenchRow, its fields by name in
+column order, and BenchArgs parses --csv path and --json path plus the
+benchmark's own numeric flags:
+
+    BenchArgs args;
+    size_t work = 1 << 12;
+    args.option("--work", work);
+    if(!args.parse(ac, av)) return -1;
+    ...
+    args.write(results);    // calls Result::row() for every result
+
+The CSV has a header line with the field names, the JSON is an array of one
+object per row, strings quoted and numbers as written by an ostream.
+*/
+
+class BenchRow {
+public:
+    template<typename T>
+    BenchRow & add(char const * name, T const & value) {
+        std::ostringstream os;
+        os << value;
+        fields_.push_back({ name, os.str(), std::is_convertible_v<T const &, std::string_view> });
+        return *this;
+    }
+
+    std::string header() const {
+        std::string ret;
+        for(auto const & f : fields_) ret += (ret.empty() ? "" : ",") + f.name;
+        return ret;
+    }
+
+    std::string csv() const {
+        std::string ret;
+        for(size_t i = 0; i < fields_.size(); ++i) ret += (i == 0 ? "" : ",") + fields_[i].value;
+        return ret;
+    }
+
+    std::string json() const {
+        std::string ret = "{";
+        for(size_t i = 0; i < fields_.size(); ++i) {
+            auto const & f = fields_[i];
+            ret += (i == 0 ? "\"" : ", \"") + f.name + "\": ";
+            ret += f.quoted ? "\"" + f.value + "\"" : f.value;
+        }
+        return ret + "}";
+    }
+
+private:
+    struct Field {
+        std::string name;
+        std::string value;
+        bool quoted;
+    };
+    std::vector<Field> fields_;
+};
+
+inline void write_csv(std::ostream & os, std::vector<BenchRow> const & rows) {
+    if(rows.empty()) return;
+    os << rows.front().header() << "\n";
+    for(auto const & r : rows) os << r.csv() << "\n";
+}
+
+inline void write_json(std::ostream & os, std::vector<BenchRow> const & rows) {
+    os << "[";
+    for(size_t i = 0; i < rows.size(); ++i) {
+        os << (i == 0 ? "\n" : ",\n") << "  " << rows[i].json();
+    }
+    os << "\n]\n";
+}
+
+class BenchArgs {
+public:
+    std::string csv_path, json_path;
+
+    // --name N sets value, which keeps its default when the flag is not given
+    template<typename T>
+    BenchArgs & option(std::string name, T & value) {
+        static_assert(std::is_integral_v<T>, "benchmark flags are counts");
+        options_.push_back({ std::move(name), [&value](std::string const & arg) {
+            if constexpr(std::is_signed_v<T>) value = T(std::stoll(arg));
+            else value = T(std::stoull(arg));
+        } });
+        return *this;
+    }
+
+    // false, after printing the usage, on an unknown flag or one without its value
+    bool parse(int ac, char * av[]) {
+        for(int i = 1; i < ac; i++) {
+            std::string arg = av[i];
+            bool known = false;
+            if(i + 1 < ac) {
+                if(arg == "--csv") { csv_path = av[++i]; known = true; }
+                else if(arg == "--json") { json_path = av[++i]; known = true; }
+                else for(auto const & o : options_) {
+                    if(arg == o.name) {
+                        o.set(av[++i]);
+                        known = true;
+                        break;
+                    }
+                }
+            }
+            if(!known) {
+                std::cerr << usage(av[0]) << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string usage(std::string const & program) const {
+        std::string ret = "usage: " + program + " [--csv path] [--json path]";
+        for(auto const & o : options_) ret += " [" + o.name + " N]";
+        return ret;
+    }
+
+    // the results to the files given on the command line, if any
+    template<typename Result>
+    void write(std::vector<Result> const & results) const {
+        std::vector<BenchRow> rows;
+        for(auto const & r : results) rows.push_back(r.row());
+        if(!csv_path.empty()) {
+            std::ofstream os(csv_path);
+            write_csv(os, rows);
+        }
+        if(!json_path.empty()) {
+            std::ofstream os(json_path);
+            write_json(os, rows);
+        }
+    }
+
+private:
+    struct Option {
+        std::string name;
+        std::function<void(std::string const &)> set;
+    };
+    std::vector<Option> options_;
+};
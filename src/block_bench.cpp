@@ -0,0 +1,298 @@
+#include "block.hpp"
+#include "grblock.hpp"
+#include "tensor_io.hpp"
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+block_bench measures BlockStorage throughput and latency percentiles for a
+matrix of access patterns, block types, cache sizes and thread counts.
+
+The stencil4d pattern runs on the largest side^4 grid with at most --keys
+points and only creates those keys.
+
+A single thread increments a value of every block it gets, which writes the
+block back on release.  With more threads the patterns hit the same keys from
+several threads and a block has no lock of its own, so those rows only read
+(access "read" rather than "write") and nothing is written back.
+
+usage: block_bench [--csv path] [--json path] [--threads N] [--keys N] [--ops N]
+*/
+
+using std::cout;
+using std::endl;
+
+struct BigData {
+    std::array<int,1024> data;
+    BigData() {}
+};
+
+template<> struct FixedReadWriter<BigData> {
+    void read(std::istream & is, BigData & v) {
+        is.read(reinterpret_cast<char *>(&v.data[0]), sizeof(int) * 1024);
+    }
+    void write(std::ostream & os, const BigData & v) {
+        os.write(reinterpret_cast<const char *>(&v.data[0]), sizeof(int) * 1024);
+    }
+};
+
+// touch one value of each block type so the access cannot be optimised away
+int & first_value(int & v) { return v; }
+int & first_value(BigData & v) { return v.data[0]; }
+float & first_value(GRElement & v) { return v.metric[0]; }
+int first_value(int const & v) { return v; }
+int first_value(BigData const & v) { return v.data[0]; }
+float first_value(GRElement const & v) { return v.metric[0]; }
+
+template<typename Block> char const * block_name();
+template<> char const * block_name<int>() { return "int"; }
+template<> char const * block_name<BigData>() { return "BigData"; }
+template<> char const * block_name<GRElement>() { return "GRElement"; }
+
+
+enum class Pattern { sequential, uniform, zipfian, stencil4d };
+
+char const * pattern_name(Pattern p) {
+    switch(p) {
+    case Pattern::sequential: return "sequential";
+    case Pattern::uniform: return "uniform";
+    case Pattern::zipfian: return "zipfian";
+    case Pattern::stencil4d: return "stencil4d";
+    }
+    return "";
+}
+
+// the side of the largest side^4 grid that fits in keys
+int stencil_side(int keys) {
+    int side = 1;
+    while((side + 1) * (side + 1) * (side + 1) * (side + 1) <= keys) ++side;
+    return side;
+}
+
+/* builds the key sequence one thread will request */
+class KeyStream {
+public:
+    KeyStream(Pattern pattern, int keys, int thread, std::vector<double> const & zipf_cdf, std::vector<int> const & zipf_keys)
+        : pattern_(pattern), keys_(keys), rng_(thread * 7919 + 17), zipf_cdf_(zipf_cdf), zipf_keys_(zipf_keys),
+          next_(thread * keys / 8), side_(stencil_side(keys)), neighbour_(0)
+    { }
+
+    int next() {
+        switch(pattern_) {
+        case Pattern::sequential:
+            return next_++ % keys_;
+        case Pattern::uniform:
+            return std::uniform_int_distribution<int>(0, keys_ - 1)(rng_);
+        case Pattern::zipfian: {
+            double u = std::uniform_real_distribution<double>(0, 1)(rng_);
+            auto r = std::lower_bound(zipf_cdf_.begin(), zipf_cdf_.end(), u) - zipf_cdf_.begin();
+            return zipf_keys_[std::min<size_t>(r, keys_ - 1)];
+        }
+        case Pattern::stencil4d:
+            return stencil();
+        }
+        return 0;
+    }
+
+private:
+    // visit every point of a side^4 periodic grid followed by its 8 face neighbours
+    int stencil() {
+        int p = next_ % (side_ * side_ * side_ * side_);
+        int c[4] = { p % side_, (p / side_) % side_, (p / side_ / side_) % side_, p / side_ / side_ / side_ };
+        if(neighbour_ > 0) {
+            int axis = (neighbour_ - 1) / 2;
+            int dir = (neighbour_ - 1) % 2 == 0 ? 1 : side_ - 1;
+            c[axis] = (c[axis] + dir) % side_;
+        }
+        if(++neighbour_ == 9) {
+            neighbour_ = 0;
+            ++next_;
+        }
+        return c[0] + side_ * (c[1] + side_ * (c[2] + side_ * c[3]));
+    }
+
+    Pattern pattern_;
+    int keys_;
+    std::mt19937_64 rng_;
+    std::vector<double> const & zipf_cdf_;
+    std::vector<int> const & zipf_keys_;
+    int next_;
+    int side_;
+    int neighbour_;
+};
+
+struct Result {
+    std::string pattern;
+    std::string block;
+    std::string access;
+    size_t block_bytes;
+    size_t cache_blocks;
+    int threads;
+    size_t ops;
+    double seconds;
+    double ops_per_second;
+    double mb_per_second;
+    uint64_t p50_ns, p90_ns, p99_ns, max_ns;
+    double hit_rate;
+
+    BenchRow row() const {
+        return BenchRow().add("pattern", pattern).add("block", block).add("access", access).add("block_bytes", block_bytes)
+            .add("cache_blocks", cache_blocks).add("threads", threads).add("ops", ops).add("seconds", seconds)
+            .add("ops_per_second", ops_per_second).add("mb_per_second", mb_per_second).add("p50_ns", p50_ns)
+            .add("p90_ns", p90_ns).add("p99_ns", p99_ns).add("max_ns", max_ns).add("hit_rate", hit_rate);
+    }
+};
+
+uint64_t percentile(std::vector<uint64_t> const & sorted, double p) {
+    if(sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1)))];
+}
+
+template<typename Block>
+Result run(Pattern pattern, int keys, size_t cache_blocks, int threads, size_t ops,
+           std::vector<double> const & zipf_cdf, std::vector<int> const & zipf_keys)
+{
+    auto path = std::filesystem::temp_directory_path() / "block_bench.blk";
+    std::filesystem::remove(path);
+
+    // the stencil only visits the side^4 grid, every key it asks for has to exist
+    if(pattern == Pattern::stencil4d) {
+        int side = stencil_side(keys);
+        keys = side * side * side * side;
+    }
+
+    Result result;
+    {
+        BlockStorage<int,Block> blocks(path, cache_blocks);
+
+        // create every block up front so the timed part never grows the file
+        for(int k = 0; k < keys; k++) {
+            first_value(*blocks.get(k)) = k;
+        }
+        auto hits0 = blocks.cache_hits();
+        auto misses0 = blocks.cache_misses();
+
+        std::vector<std::vector<uint64_t>> latencies(threads);
+        std::vector<double> sinks(threads);
+        std::vector<std::thread> workers;
+        bool write = threads == 1;
+
+        auto start = std::chrono::steady_clock::now();
+        for(int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                KeyStream stream(pattern, keys, t, zipf_cdf, zipf_keys);
+                auto & lat = latencies[t];
+                lat.reserve(ops / threads);
+                double sink = 0;
+                for(size_t i = 0; i < ops / threads; i++) {
+                    int k = stream.next();
+                    auto b = std::chrono::steady_clock::now();
+                    {
+                        auto v = blocks.get(k);
+                        if(write) first_value(*v) += 1;
+                        else sink += first_value(v.value());
+                    }
+                    lat.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - b).count());
+                }
+                sinks[t] = sink;
+            });
+        }
+        for(auto & w : workers) w.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // keep the reads alive
+        volatile double kept = std::accumulate(sinks.begin(), sinks.end(), 0.);
+        (void)kept;
+
+        std::vector<uint64_t> all;
+        for(auto & l : latencies) all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+
+        auto hits = blocks.cache_hits() - hits0;
+        auto misses = blocks.cache_misses() - misses0;
+
+        result.pattern = pattern_name(pattern);
+        result.block = block_name<Block>();
+        result.access = write ? "write" : "read";
+        result.block_bytes = sizeof(Block);
+        result.cache_blocks = cache_blocks;
+        result.threads = threads;
+        result.ops = all.size();
+        result.seconds = seconds;
+        result.ops_per_second = all.size() / seconds;
+        result.mb_per_second = all.size() * sizeof(Block) / seconds / (1024. * 1024.);
+        result.p50_ns = percentile(all, 0.5);
+        result.p90_ns = percentile(all, 0.9);
+        result.p99_ns = percentile(all, 0.99);
+        result.max_ns = all.empty() ? 0 : all.back();
+        result.hit_rate = hits + misses == 0 ? 0 : double(hits) / double(hits + misses);
+    }
+    std::filesystem::remove(path);
+    return result;
+}
+
+int main(int ac, char * av[]) {
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    int keys = 4096; // a fourth power so the stencil covers every key, an 8^4 grid
+    size_t ops = 20000;
+
+    BenchArgs args;
+    args.option("--threads", max_threads).option("--keys", keys).option("--ops", ops);
+    if(!args.parse(ac, av)) return -1;
+
+    // zipf(s = 1) over the keys, scattered so that hot keys are not neighbours on disk
+    std::vector<double> zipf_cdf(keys);
+    double total = 0;
+    for(int k = 0; k < keys; k++) {
+        total += 1. / (k + 1);
+        zipf_cdf[k] = total;
+    }
+    for(auto & c : zipf_cdf) c /= total;
+    std::vector<int> zipf_keys(keys);
+    for(int k = 0; k < keys; k++) zipf_keys[k] = k;
+    std::shuffle(zipf_keys.begin(), zipf_keys.end(), std::mt19937(42));
+
+    std::vector<size_t> cache_sizes = { 1, 16, 256, (size_t)keys };
+    cache_sizes.erase(std::remove_if(cache_sizes.begin(), cache_sizes.end(), [&](size_t c) { return c > (size_t)keys; }), cache_sizes.end());
+    cache_sizes.erase(std::unique(cache_sizes.begin(), cache_sizes.end()), cache_sizes.end());
+    std::vector<int> thread_counts;
+    for(int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    std::vector<Result> results;
+    cout << std::left << std::setw(12) << "pattern" << std::setw(11) << "block" << std::setw(7) << "access" << std::setw(7) << "cache"
+         << std::setw(8) << "threads" << std::setw(13) << "ops/s" << std::setw(10) << "p50 ns"
+         << std::setw(10) << "p99 ns" << "hit rate" << endl;
+
+    for(auto pattern : { Pattern::sequential, Pattern::uniform, Pattern::zipfian, Pattern::stencil4d })
+    for(auto cache : cache_sizes)
+    for(auto threads : thread_counts)
+    for(int b = 0; b < 3; b++) {
+        Result r;
+        switch(b) {
+        case 0: r = run<int>(pattern, keys, cache, threads, ops, zipf_cdf, zipf_keys); break;
+        case 1: r = run<BigData>(pattern, keys, cache, threads, ops, zipf_cdf, zipf_keys); break;
+        case 2: r = run<GRElement>(pattern, keys, cache, threads, ops, zipf_cdf, zipf_keys); break;
+        }
+        cout << std::setw(12) << r.pattern << std::setw(11) << r.block << std::setw(7) << r.access << std::setw(7) << r.cache_blocks
+             << std::setw(8) << r.threads << std::setw(13) << (uint64_t)r.ops_per_second << std::setw(10) << r.p50_ns
+             << std::setw(10) << r.p99_ns << r.hit_rate << endl;
+        results.push_back(r);
+    }
+
+    args.write(results);
+
+    return 0;
+}
@@ -5,6 +5,7 @@
 #include <functional>
 #include <array>
 #include <random>
+#include <thread>
 
 #include <gtest/gtest.h>
 
@@ -173,4 +174,176 @@ TEST(BlockTest, BigData) {
     std::cerr << "file size: " << std::filesystem::file_size(path) << std::endl;
 
     ASSERT_TRUE(valid);
-}
\ No newline at end of file
+}
+
+BlockTask sum_blocks(BlockStorage<int,int> & blocks, tbb::task_arena & arena, int begin, int end, int & sum) {
+    for(int i = begin; i < end; i++) {
+        auto v = co_await blocks.async_get(i, arena);
+        sum += *v;
+    }
+}
+
+TEST(BlockTest, AsyncGet) {
+    auto path = std::filesystem::temp_directory_path() / "block_test_async.blk";
+    auto temp = temp_file(path); // RIAA to remove temp file
+
+    BlockStorage<int,int> blocks(path, 10);
+
+    const int count = 1000;
+    for(int i = 0; i < count; i++) {
+        *blocks.get(i) = i;
+    }
+
+    tbb::task_arena arena;
+
+    // many requests in flight, most of them missing the cache
+    const int tasks = 20;
+    std::vector<int> sums(tasks, 0);
+    std::vector<BlockTask> pending;
+    for(int t = 0; t < tasks; t++) {
+        pending.push_back(sum_blocks(blocks, arena, t * count / tasks, (t + 1) * count / tasks, sums[t]));
+    }
+    for(auto & p : pending) {
+        p.wait();
+    }
+
+    int total = 0;
+    for(auto s : sums) total += s;
+
+    ASSERT_EQ(total, count * (count - 1) / 2);
+    ASSERT_EQ(blocks.cache_hits() + blocks.cache_misses(), 2 * count);
+}
+
+TEST(BlockTest, ConcurrentMisses) {
+    auto path = std::filesystem::temp_directory_path() / "block_test_concurrent.blk";
+    auto temp = temp_file(path); // RIAA to remove temp file
+
+    BlockStorage<int,int> blocks(path, 4);
+
+    const int count = 200;
+    for(int i = 0; i < count; i++) {
+        *blocks.get(i) = i;
+    }
+
+    // the misses read outside the lock, threads sharing keys must still see
+    // each block once it has been read and never half of one
+    const int threads = 8;
+    std::vector<long> sums(threads, 0);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            long sum = 0;
+            for(int i = 0; i < count; i++) {
+                sum += blocks.get((i * 7 + t) % count).value();
+            }
+            sums[t] = sum;
+        });
+    }
+    for(auto & w : workers) {
+        w.join();
+    }
+
+    for(auto s : sums) {
+        ASSERT_EQ(s, count * (count - 1) / 2);
+    }
+    ASSERT_EQ(blocks.cache_hits() + blocks.cache_misses(), count + threads * count);
+}
+
+TEST(BlockTest, Stats) {
+    auto path = std::filesystem::temp_directory_path() / "block_test_stats.blk";
+    auto temp = temp_file(path); // RIAA to remove temp file
+
+    BlockStorage<int,int> blocks(path, 2);
+
+    for(int i = 0; i < 5; i++) {
+        *blocks.get(i) = i;
+    }
+    // only read, so released without a save
+    { auto v = blocks.get(4); ASSERT_EQ(v.value(), 4); }
+    auto before = blocks.stats();
+    // an explicit save of a block that was only read is written but not a write-back
+    { auto v = blocks.get(3); v.save(); }
+
+    auto stats = blocks.stats();
+    ASSERT_EQ(stats[BlockOp::get_miss].count, 5);
+    ASSERT_EQ(stats[BlockOp::get_hit].count, 2);
+    ASSERT_EQ(stats[BlockOp::grow].count, 5);
+    ASSERT_EQ(stats[BlockOp::evict].count, 3);
+    ASSERT_EQ(stats[BlockOp::save].count, 6);
+    ASSERT_EQ(stats.evictions, 3);
+    ASSERT_EQ(stats.write_backs, 5);
+    ASSERT_EQ(stats.bytes_verified, 6 * sizeof(int));
+    ASSERT_EQ(stats.bytes_read, before.bytes_read); // the verify read is not a read
+    ASSERT_EQ(stats.resident, 2);
+    ASSERT_EQ(stats.resident_high_water, 2);
+    ASSERT_GT(stats.file_growths, 0);
+    ASSERT_GE(stats.bytes_written, 11 * sizeof(int));
+
+    std::stringstream json;
+    stats.write_json(json);
+    ASSERT_NE(json.str().find("\"get_miss\": {\"count\": 5"), string::npos);
+
+    std::stringstream prom;
+    stats.write_prometheus(prom);
+    ASSERT_NE(prom.str().find("blockstorage_op_latency_seconds_count{op=\"evict\"} 3"), string::npos);
+    ASSERT_NE(prom.str().find("blockstorage_evictions_total 3"), string::npos);
+}
+
+TEST(BlockTest, SlabReusesFrames) {
+    auto slab = BlockSlab<BigData>::create(2);
+
+    auto a = slab->make();
+    auto b = slab->make_for_overwrite();
+    ASSERT_TRUE(slab->owns(a.get()));
+    ASSERT_TRUE(slab->owns(b.get()));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(a.get()) % BlockSlab<BigData>::alignment, 0);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(b.get()) % BlockSlab<BigData>::alignment, 0);
+    ASSERT_EQ(slab->free_frames(), 0);
+
+    // every frame is taken so this one comes from the heap
+    auto c = slab->make();
+    ASSERT_FALSE(slab->owns(c.get()));
+    ASSERT_EQ(slab->heap_fallbacks(), 1);
+
+    BigData * freed = a.get();
+    a = nullptr;
+    ASSERT_EQ(slab->free_frames(), 1);
+
+    auto d = slab->make();
+    ASSERT_EQ(d.get(), freed);
+
+    // the control blocks come from the slab too, only the heap block's is on the heap
+    ASSERT_EQ(slab->free_control_blocks(), 0);
+    c = nullptr;
+    ASSERT_EQ(slab->free_control_blocks(), 0);
+
+    // a weak_ptr keeps the control block but the frame goes back
+    std::weak_ptr<BigData> weak = d;
+    d = nullptr;
+    ASSERT_EQ(slab->free_frames(), 1);
+    ASSERT_EQ(slab->free_control_blocks(), 0);
+    weak.reset();
+    ASSERT_EQ(slab->free_control_blocks(), 1);
+
+    // and the slab lives as long as any block does
+    std::weak_ptr<BlockSlab<BigData>> weak_slab = slab;
+    slab = nullptr;
+    ASSERT_FALSE(weak_slab.expired());
+    b = nullptr;
+    ASSERT_TRUE(weak_slab.expired());
+}
+
+TEST(BlockTest, SlabHugePages) {
+    auto path = std::filesystem::temp_directory_path() / "block_test_huge_pages.blk";
+    auto temp = temp_file(path); // RIAA to remove temp file
+
+    // huge pages may not be available, the storage has to work either way
+    BlockStorage<int,BigData> blocks(path, 8, true);
+
+    for(int i = 0; i < 100; i++) {
+        *blocks.get(i) = BigData(i);
+    }
+    for(int i = 0; i < 100; i++) {
+        ASSERT_EQ(blocks.get(i)->data[0], i);
+    }
+}
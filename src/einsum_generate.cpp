@@ -0,0 +1,51 @@
+#include "tensor.hpp"
+#include "einsum_codegen.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+/*
+Writes the EinsumLanguage::cpp source of a few einsums to a header, run by the
+build before tensor_test so TensorTest.EinsumGenerated compiles the generated
+code and compares it with einsum on the host.
+
+    einsum_generate <header>
+
+The kernels cover both bodies, one straight line sum per element and the
+loops, with traces, permuted results and several operands.  The tensor types
+here are the ones the test calls them with.
+*/
+
+int main(int argc, char ** argv) {
+    if(argc != 2) {
+        std::cerr << "usage: einsum_generate <header>" << std::endl;
+        return 1;
+    }
+
+    Tensor<float,4,Contravariant,Contravariant> inverse;
+    Tensor<float,4,Covariant,Covariant> metric;
+    Tensor<float,4,Covariant,Covariant,Covariant> conn;
+    Tensor<double,4,Contravariant,Covariant> m;
+
+    EinsumCodegenOptions unrolled{ EinsumLanguage::cpp };
+    EinsumCodegenOptions loops{ EinsumLanguage::cpp, 0 };
+
+    std::filesystem::path path(argv[1]);
+    if(path.has_parent_path()) std::filesystem::create_directories(path.parent_path());
+    std::ofstream out(path);
+    out << "#pragma once\n"
+        << "// generated by einsum_generate, do not edit\n\n"
+        << "namespace einsum_generated {\n\n"
+        << einsum_source<"ab,bc->ac">("inverse_product", unrolled, inverse, metric) << "\n"
+        << einsum_source<"ab,cbd->dac">("permuted", unrolled, inverse, conn) << "\n"
+        << einsum_source<"ab,cd->abcd">("outer", loops, inverse, metric) << "\n"
+        << einsum_source<"aa->">("trace", loops, m) << "\n"
+        << einsum_source<"ab,bc,cd->ad">("chain", loops, m, m, m) << "\n"
+        << "}\n";
+    if(!out) {
+        std::cerr << "einsum_generate: cannot write " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,5 +1,9 @@
 #include "grblock.hpp"
+#include "sparse_tensor.hpp"
+#include "tensor_io.hpp"
+#include "schwarzschild.hpp"
 
+#include <cstring>
 #include <filesystem>
 #include <iostream>
 #include <functional>
@@ -9,56 +13,6 @@
 
 #include <gtest/gtest.h>
 
-// calculates the schwartzchild metric with schwarzschild radius of 1 in relativistic coords
-GRElement Schwarzschild(float r, float theta) {
-    float sin_theta = std::sin(theta);
-    float cos_theta = std::cos(theta);
-
-    // construct the metric
-    metric_type g; // initialize to zero
-    g({0,0}) = 1./r - 1.; // time coord
-    g({1,1}) = r / (r - 1.); // radial coord
-    g({2,2}) = r * r; // theta
-    g({3,3}) = r * r * sin_theta * sin_theta; // phi
-
-    // inverse of a diagonal matrix is the inverse of the diagonals.
-    metric_type inv;
-    inv({0,0}) = r / (1. - r);
-    inv({1,1}) = (r - 1.) / r;
-    inv({2,2}) = 1. / (r * r);
-    inv({3,3}) = 1. / (r * r * sin_theta * sin_theta);
-
-    // calculate the partial derivatives
-    metric_derivative_type dg;
-    dg({1,0,0}) = -1/(r * r); // radial derivative of time coord
-    dg({1,1,1}) = -r / (r - 1) / (r - 1) + 1 / (r - 1); // radial derivative of radial coord
-    dg({1,2,2}) = 2. * r; // radial derivative of theta
-    dg({1,3,3}) = 2. * r * sin_theta * sin_theta; // radial derivative of phi
-
-    dg({2,3,3}) = r * r * 2. * sin_theta * cos_theta; // theta derivative of phi
-
-    // calcluate the partial derivatives of the inverse
-    inverse_derivative_type dinv;
-    dinv({0,0,0}) = (r + 1.) / (1. - r) / (1. - r);
-    dinv({0,1,1}) = (r - 1) / r / r;
-    dinv({0,2,2}) = -2. / (r * r * r);
-    dinv({0,3,3}) = -2. * r *     sin_theta * sin_theta / (r * r * sin_theta * sin_theta) / (r * r * sin_theta * sin_theta);
-    dinv({1,3,3}) = -4. * r * r * sin_theta * cos_theta / (r * r * sin_theta * sin_theta) / (r * r * sin_theta * sin_theta);
-
-
-    // calculate the second derivative
-    metric_2nd_derivative_type d2g;
-    d2g({1,1,0,0}) = 2. / (r * r * r); // radial second derivative of time coord
-    d2g({1,1,1,1}) = 2. * r / (r - 1.) / (r - 1.) / (r - 1.) - 2. / (r - 1.) / (r - 1.); // radial second derivative of radial coord
-    d2g({1,1,2,2}) = 2.; // radial second derivative of theta
-    d2g({1,1,3,3}) = 2. * sin_theta * sin_theta; // radial second derivative of phi
-
-    d2g({2,1,3,3}) = 4. * r * sin_theta * cos_theta; // theta, radial second derivative of theta
-    d2g({2,2,3,3}) = 2. * r * r * ( cos_theta * cos_theta - sin_theta * sin_theta ); // theta second derivative of phi
-
-    return GRElement{g,inv,dg,dinv,d2g};
-}
-
 TEST(GRBlockTest, Schwarzschild) {
     // define the Schwarzschild metric
     auto schwarzschild = Schwarzschild(2., 2.);
@@ -71,4 +25,184 @@ TEST(GRBlockTest, Schwarzschild) {
 
     ASSERT_EQ(ricci({0,0}), 0.);
 
-}
\ No newline at end of file
+}
+TEST(GRBlockTest, FlatSpace) {
+    GRElement flat;
+    flat.metric({0,0}) = -1;
+    flat.metric({1,1}) = 1;
+    flat.metric({2,2}) = 1;
+    flat.metric({3,3}) = 1;
+    flat.inverse = flat.metric;
+
+    ASSERT_EQ(flat.connection(), connection_type());
+    ASSERT_EQ(flat.ricci(), ricci_type());
+    ASSERT_EQ(flat.ricci2(), ricci_type());
+}
+
+TEST(GRBlockTest, SchwarzschildConnection) {
+    float r = 2.;
+    auto schwarzschild = Schwarzschild(r, 2.);
+    auto conn = schwarzschild.connection();
+
+    // Γ^r_{tt} = (1 - 1/r) / (2 r^2) for a unit schwarzschild radius
+    ASSERT_FLOAT_EQ(conn({1,0,0}), (1. - 1. / r) / (2. * r * r));
+    // Γ^θ_{rθ} = Γ^θ_{θr} = 1 / r
+    ASSERT_FLOAT_EQ(conn({2,1,2}), 1. / r);
+    ASSERT_FLOAT_EQ(conn({2,2,1}), 1. / r);
+}
+
+TEST(GRBlockTest, PackedStorage) {
+    // 10 + 10 + 40 + 40 + 100 components instead of 16 + 16 + 64 + 64 + 256
+    static_assert(sizeof(GRElement) == 200 * sizeof(float));
+
+    auto schwarzschild = Schwarzschild(2., 2.);
+
+    // the fixture only sets one ordering of every symmetric pair
+    ASSERT_EQ(schwarzschild.metric_2nd_derivative({1,2,3,3}), schwarzschild.metric_2nd_derivative({2,1,3,3}));
+    ASSERT_EQ(schwarzschild.connection()({2,2,1}), schwarzschild.connection()({2,1,2}));
+}
+
+TEST(GRBlockTest, SparseDerivatives) {
+    auto schwarzschild = Schwarzschild(2., 2.);
+
+    auto dg = sparse(schwarzschild.metric_derivative.unpack());
+    auto dinv = sparse(schwarzschild.inverse_derivative.unpack());
+    auto d2g = sparse(schwarzschild.metric_2nd_derivative.unpack());
+    ASSERT_EQ(dg.nonzeros(), 5u);
+    ASSERT_EQ(dinv.nonzeros(), 5u);
+    // both orderings of the one mixed second derivative
+    ASSERT_EQ(d2g.nonzeros(), 7u);
+
+    // ∂_c g^{cd} ∂_d g_{ab} only visits pairs of nonzero elements
+    auto dense = schwarzschild.inverse_derivative.unpack().contract<0,1>().multiplyAndContract<0,1>(schwarzschild.metric_derivative.unpack());
+    auto sparse_term = multiply_and_contract<0,1>(sparse(contract<0,1>(dinv)), dg);
+    for(size_t i = 0; i < dense.size(); ++i) {
+        ASSERT_FLOAT_EQ(sparse_term[i], dense[i]);
+    }
+}
+
+// the largest error over all components, relative to the largest component
+template<typename Approximate, typename Exact>
+double relative_error(Approximate const & approximate, Exact const & exact) {
+    double error = 0, scale = 0;
+    for(size_t i = 0; i < exact.size(); ++i) {
+        error = std::max<double>(error, std::abs(approximate[i] - exact[i]));
+        scale = std::max<double>(scale, std::abs(exact[i]));
+    }
+    return scale == 0 ? error : error / scale;
+}
+
+template<typename Storage>
+void check_compact_schwarzschild(double storage_bound, double curvature_bound) {
+    auto exact = Schwarzschild(2.5, 1.);
+    CompactGRElement<Storage> compact(exact);
+
+    // through a block file and back
+    std::stringstream file;
+    FixedReadWriter<CompactGRElement<Storage>>().write(file, compact);
+    ASSERT_EQ(file.str().size(), sizeof(GRElement) / 2);
+    CompactGRElement<Storage> read;
+    FixedReadWriter<CompactGRElement<Storage>>().read(file, read);
+    auto e = read.load();
+
+    EXPECT_LE(relative_error(e.metric, exact.metric), storage_bound);
+    EXPECT_LE(relative_error(e.inverse, exact.inverse), storage_bound);
+    EXPECT_LE(relative_error(e.metric_derivative, exact.metric_derivative), storage_bound);
+    EXPECT_LE(relative_error(e.inverse_derivative, exact.inverse_derivative), storage_bound);
+    EXPECT_LE(relative_error(e.metric_2nd_derivative, exact.metric_2nd_derivative), storage_bound);
+
+    // curvature computed in float from the rounded inputs
+    EXPECT_LE(relative_error(e.connection(), exact.connection()), curvature_bound);
+    EXPECT_LE(relative_error(e.ricci2(), exact.ricci2()), curvature_bound);
+}
+
+TEST(GRBlockTest, ReducedPrecisionError) {
+    // half an ulp of storage, and a few ulps after the sums in the curvature kernels
+    check_compact_schwarzschild<fp16>(0x1p-11, 0x1p-8);
+    check_compact_schwarzschild<bf16>(0x1p-8, 0x1p-5);
+}
+
+TEST(GRBlockTest, ScalarTypes) {
+    static_assert(std::is_same_v<DoubleGRElement::ricci_type, Tensor<double,4,Covariant,Covariant>>);
+    static_assert(std::is_same_v<MixedGRElement::connection_type, connection_type>);
+    static_assert(sizeof(MixedGRElement) == sizeof(GRElement));
+
+    // near the horizon the terms of the sums nearly cancel, which is where float loses digits
+    auto single = Schwarzschild(1.05, 1.);
+    auto mixed = element_cast<MixedGRElement>(single);
+    auto exact = element_cast<DoubleGRElement>(single);
+
+    auto check = [](auto const & single, auto const & mixed, auto const & exact) {
+        double single_error = relative_error(single, exact), mixed_error = relative_error(mixed, exact);
+        EXPECT_LE(mixed_error, single_error);
+        // only the final rounding to float is left
+        EXPECT_LE(mixed_error, 0x1p-24);
+    };
+    check(single.connection(), mixed.connection(), exact.connection());
+    check(single.ricci2(), mixed.ricci2(), exact.ricci2());
+    check(single.ricci(), mixed.ricci(), exact.ricci());
+}
+
+TEST(GRBlockTest, FixedLayout) {
+    static_assert(std::is_trivially_copyable_v<GRElement>);
+    static_assert(std::is_trivially_copyable_v<Tensor<float,4,Covariant,Covariant>>);
+    static_assert(fixed_layout<GRElement> && fixed_layout<DoubleGRElement> && fixed_layout<metric_type>);
+    static_assert(!fixed_layout<Tensor<float,4,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant>>);
+
+    // each block is its bytes, in one piece
+    std::array<GRElement,3> elements = { Schwarzschild(2., 1.), Schwarzschild(3., 1.5), Schwarzschild(4., 0.5) };
+    std::stringstream file;
+    FixedReadWriter<std::array<GRElement,3>>().write(file, elements);
+    ASSERT_EQ(file.str().size(), 3 * 200 * sizeof(float));
+    ASSERT_EQ(std::memcmp(file.str().data(), &elements, sizeof(elements)), 0);
+
+    std::array<GRElement,3> read;
+    FixedReadWriter<std::array<GRElement,3>>().read(file, read);
+    for(size_t e = 0; e < 3; ++e) {
+        ASSERT_EQ(read[e].metric, elements[e].metric);
+        ASSERT_EQ(read[e].metric_2nd_derivative, elements[e].metric_2nd_derivative);
+    }
+
+    // the same through a BlockStorage, and a large tensor that is not fixed layout
+    auto path = (std::filesystem::temp_directory_path() / "grblock_test_fixed_layout.blk").string();
+    std::filesystem::remove(path);
+    {
+        BlockStorage<int,GRElement> blocks(path, 2);
+        *blocks.get(0) = elements[1];
+    }
+    {
+        BlockStorage<int,GRElement> blocks(path, 2);
+        ASSERT_EQ(std::memcmp(&*blocks.get(0), &elements[1], sizeof(GRElement)), 0);
+    }
+    std::filesystem::remove(path);
+
+    Tensor<float,4,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant> large, large_read;
+    for(size_t i = 0; i < large.size(); ++i) large[i] = i;
+    std::stringstream large_file;
+    FixedReadWriter<decltype(large)>().write(large_file, large);
+    ASSERT_EQ(large_file.str().size(), large.size() * sizeof(float));
+    FixedReadWriter<decltype(large)>().read(large_file, large_read);
+    ASSERT_EQ(large_read, large);
+}
+
+TEST(GRBlockTest, CpuDispatch) {
+    ASSERT_EQ(parse_cpu_level("avx2"), CpuLevel::avx2);
+    ASSERT_THROW(parse_cpu_level("sse9"), std::invalid_argument);
+    ASSERT_LE(cpu_level(), detected_cpu_level());
+
+    auto const & implementations = curvature_implementations();
+    ASSERT_EQ(implementations.front().isa, std::string("portable"));
+    ASSERT_EQ(&curvature_kernels(), &implementations.back());
+    ASSERT_EQ(implementations.back().isa, std::string(cpu_level_name(cpu_level())));
+
+    // every level computes the same curvature up to the rounding of fused multiply adds,
+    // a couple of float ulps of the largest component (about 1e-7 measured)
+    for(double r : { 3., 1.5, 1.05 }) {
+        auto e = Schwarzschild(r, 0.7);
+        for(auto const & k : implementations) {
+            EXPECT_LE(relative_error(k.connection(e), e.connection()), 1e-6) << k.isa;
+            EXPECT_LE(relative_error(k.ricci(e), e.ricci()), 1e-6) << k.isa;
+            EXPECT_LE(relative_error(k.ricci2(e), e.ricci2()), 1e-6) << k.isa;
+        }
+    }
+}
@@ -0,0 +1,180 @@
+#include "grblock.hpp"
+#include "schwarzschild.hpp"
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+grelement_bench times the curvature kernels of BasicGRElement in each scalar
+mode and measures how far each one is from the same kernel evaluated in long
+double, on the same inputs: float Schwarzschild elements at radii approaching
+the horizon, where the terms of the sums cancel more and more.
+
+    float   GRElement, float storage and float sums, through curvature_kernels()
+            so at the instruction set level cpu_level() allows
+    mixed   MixedGRElement, float storage and double sums
+    double  DoubleGRElement, double storage and double sums
+
+Every mode reads the float inputs, so the error is the arithmetic alone and
+not the rounding of the metric.  The error is the largest over the components,
+relative to the largest component.
+
+usage: grelement_bench [--csv path] [--json path] [--work N]
+*/
+
+using std::cout;
+using std::endl;
+
+typedef BasicGRElement<long double> ReferenceGRElement;
+
+enum class Kernel { connection, ricci, ricci2 };
+
+char const * kernel_name(Kernel k) {
+    static char const * names[] = { "connection", "ricci", "ricci2" };
+    return names[(size_t)k];
+}
+
+template<typename Element>
+char const * mode_name() {
+    if constexpr(std::is_same_v<Element,GRElement>) return "float";
+    else if constexpr(std::is_same_v<Element,MixedGRElement>) return "mixed";
+    else return "double";
+}
+
+// float elements go through the dispatched kernels, the other modes have a single version
+template<typename Element>
+auto connection_of(Element const & e) {
+    if constexpr(std::is_same_v<Element,GRElement>) return curvature_kernels().connection(e);
+    else return e.connection();
+}
+template<typename Element>
+auto ricci_of(Element const & e) {
+    if constexpr(std::is_same_v<Element,GRElement>) return curvature_kernels().ricci(e);
+    else return e.ricci();
+}
+template<typename Element>
+auto ricci2_of(Element const & e) {
+    if constexpr(std::is_same_v<Element,GRElement>) return curvature_kernels().ricci2(e);
+    else return e.ricci2();
+}
+
+// the result of a kernel in long double, whatever it was computed in
+template<typename Element>
+std::vector<long double> evaluate(Kernel kernel, Element const & e) {
+    auto widen = [](auto const & t) {
+        std::vector<long double> ret(t.size());
+        for(size_t i = 0; i < t.size(); ++i) ret[i] = t[i];
+        return ret;
+    };
+    switch(kernel) {
+    case Kernel::connection: return widen(connection_of(e));
+    case Kernel::ricci: return widen(ricci_of(e));
+    case Kernel::ricci2: return widen(ricci2_of(e));
+    }
+    return {};
+}
+
+double relative_error(std::vector<long double> const & approximate, std::vector<long double> const & exact) {
+    long double error = 0, scale = 0;
+    for(size_t i = 0; i < exact.size(); ++i) {
+        error = std::max(error, std::abs(approximate[i] - exact[i]));
+        scale = std::max(scale, std::abs(exact[i]));
+    }
+    return double(scale == 0 ? error : error / scale);
+}
+
+struct Result {
+    std::string kernel;
+    std::string mode;
+    double r;
+    size_t ops;
+    double ns_per_op;
+    double error;
+
+    BenchRow row() const {
+        return BenchRow().add("kernel", kernel).add("mode", mode).add("r", r).add("ops", ops)
+            .add("ns_per_op", ns_per_op).add("relative_error", error);
+    }
+};
+
+template<typename Element>
+Result run(Kernel kernel, double r, std::vector<GRElement> const & inputs, size_t work) {
+    std::vector<Element> elements;
+    for(auto const & e : inputs) elements.push_back(element_cast<Element>(e));
+
+    // the largest error over the batch
+    double error = 0;
+    for(size_t t = 0; t < inputs.size(); ++t) {
+        auto exact = evaluate(kernel, element_cast<ReferenceGRElement>(inputs[t]));
+        error = std::max(error, relative_error(evaluate(kernel, elements[t]), exact));
+    }
+
+    size_t rounds = std::max<size_t>(1, work / elements.size());
+    double sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t round = 0; round < rounds; ++round)
+    for(auto const & e : elements) {
+        switch(kernel) {
+        case Kernel::connection: sink += connection_of(e)[0]; break;
+        case Kernel::ricci: sink += ricci_of(e)[0]; break;
+        case Kernel::ricci2: sink += ricci2_of(e)[0]; break;
+        }
+    }
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // keep the results alive
+    volatile double kept = sink;
+    (void)kept;
+
+    Result ret;
+    ret.kernel = kernel_name(kernel);
+    ret.mode = mode_name<Element>();
+    ret.r = r;
+    ret.ops = rounds * elements.size();
+    ret.ns_per_op = ns / ret.ops;
+    ret.error = error;
+    return ret;
+}
+
+int main(int ac, char * av[]) {
+    size_t work = 1 << 12;
+
+    BenchArgs args;
+    args.option("--work", work);
+    if(!args.parse(ac, av)) return -1;
+
+    std::vector<Result> results;
+    cout << std::left << std::setw(12) << "kernel" << std::setw(8) << "mode" << std::setw(12) << "r"
+         << std::setw(12) << "ns/op" << "relative error" << endl;
+
+    // the horizon is at r = 1
+    for(double r : { 10., 2.5, 1.5, 1.1, 1.01, 1.001 }) {
+        std::vector<GRElement> inputs;
+        for(size_t t = 0; t < 16; ++t) {
+            inputs.push_back(Schwarzschild(r, 0.2 + 0.1 * t));
+        }
+
+        for(auto kernel : { Kernel::connection, Kernel::ricci, Kernel::ricci2 })
+        for(int mode = 0; mode < 3; ++mode) {
+            Result res;
+            switch(mode) {
+            case 0: res = run<GRElement>(kernel, r, inputs, work); break;
+            case 1: res = run<MixedGRElement>(kernel, r, inputs, work); break;
+            case 2: res = run<DoubleGRElement>(kernel, r, inputs, work); break;
+            }
+            cout << std::setw(12) << res.kernel << std::setw(8) << res.mode << std::setw(12) << res.r
+                 << std::setw(12) << res.ns_per_op << res.error << endl;
+            results.push_back(res);
+        }
+    }
+
+    args.write(results);
+
+    return 0;
+}
@@ -1,6 +1,9 @@
 
 // #include "grblock.hpp"
 #include "tensor.hpp"
+#include "linalg4.hpp"
+#include "einsum_codegen.hpp"
+#include "trace.hpp"
 
 #include <iostream>
 #include <algorithm>
@@ -16,6 +19,8 @@
 #include <thread>
 #include <deque>
 #include <filesystem>
+#include <cstdlib>
+#include <cmath>
 
 #ifdef __APPLE__
 #include <OpenCL/cl.h>
@@ -50,137 +55,6 @@ using std::cin;
 using std::flush;
 using std::string;
 
-template<typename Number>
-bool invertMatrix(const Number m[16], Number invOut[16])
-{
-    Number inv[16], det;
-    int i;
-
-    inv[0] = m[5]  * m[10] * m[15] - 
-             m[5]  * m[11] * m[14] - 
-             m[9]  * m[6]  * m[15] + 
-             m[9]  * m[7]  * m[14] +
-             m[13] * m[6]  * m[11] - 
-             m[13] * m[7]  * m[10];
-
-    inv[4] = -m[4]  * m[10] * m[15] + 
-              m[4]  * m[11] * m[14] + 
-              m[8]  * m[6]  * m[15] - 
-              m[8]  * m[7]  * m[14] - 
-              m[12] * m[6]  * m[11] + 
-              m[12] * m[7]  * m[10];
-
-    inv[8] = m[4]  * m[9] * m[15] - 
-             m[4]  * m[11] * m[13] - 
-             m[8]  * m[5] * m[15] + 
-             m[8]  * m[7] * m[13] + 
-             m[12] * m[5] * m[11] - 
-             m[12] * m[7] * m[9];
-
-    inv[12] = -m[4]  * m[9] * m[14] + 
-               m[4]  * m[10] * m[13] +
-               m[8]  * m[5] * m[14] - 
-               m[8]  * m[6] * m[13] - 
-               m[12] * m[5] * m[10] + 
-               m[12] * m[6] * m[9];
-
-    inv[1] = -m[1]  * m[10] * m[15] + 
-              m[1]  * m[11] * m[14] + 
-              m[9]  * m[2] * m[15] - 
-              m[9]  * m[3] * m[14] - 
-              m[13] * m[2] * m[11] + 
-              m[13] * m[3] * m[10];
-
-    inv[5] = m[0]  * m[10] * m[15] - 
-             m[0]  * m[11] * m[14] - 
-             m[8]  * m[2] * m[15] + 
-             m[8]  * m[3] * m[14] + 
-             m[12] * m[2] * m[11] - 
-             m[12] * m[3] * m[10];
-
-    inv[9] = -m[0]  * m[9] * m[15] + 
-              m[0]  * m[11] * m[13] + 
-              m[8]  * m[1] * m[15] - 
-              m[8]  * m[3] * m[13] - 
-              m[12] * m[1] * m[11] + 
-              m[12] * m[3] * m[9];
-
-    inv[13] = m[0]  * m[9] * m[14] - 
-              m[0]  * m[10] * m[13] - 
-              m[8]  * m[1] * m[14] + 
-              m[8]  * m[2] * m[13] + 
-              m[12] * m[1] * m[10] - 
-              m[12] * m[2] * m[9];
-
-    inv[2] = m[1]  * m[6] * m[15] - 
-             m[1]  * m[7] * m[14] - 
-             m[5]  * m[2] * m[15] + 
-             m[5]  * m[3] * m[14] + 
-             m[13] * m[2] * m[7] - 
-             m[13] * m[3] * m[6];
-
-    inv[6] = -m[0]  * m[6] * m[15] + 
-              m[0]  * m[7] * m[14] + 
-              m[4]  * m[2] * m[15] - 
-              m[4]  * m[3] * m[14] - 
-              m[12] * m[2] * m[7] + 
-              m[12] * m[3] * m[6];
-
-    inv[10] = m[0]  * m[5] * m[15] - 
-              m[0]  * m[7] * m[13] - 
-              m[4]  * m[1] * m[15] + 
-              m[4]  * m[3] * m[13] + 
-              m[12] * m[1] * m[7] - 
-              m[12] * m[3] * m[5];
-
-    inv[14] = -m[0]  * m[5] * m[14] + 
-               m[0]  * m[6] * m[13] + 
-               m[4]  * m[1] * m[14] - 
-               m[4]  * m[2] * m[13] - 
-               m[12] * m[1] * m[6] + 
-               m[12] * m[2] * m[5];
-
-    inv[3] = -m[1] * m[6] * m[11] + 
-              m[1] * m[7] * m[10] + 
-              m[5] * m[2] * m[11] - 
-              m[5] * m[3] * m[10] - 
-              m[9] * m[2] * m[7] + 
-              m[9] * m[3] * m[6];
-
-    inv[7] = m[0] * m[6] * m[11] - 
-             m[0] * m[7] * m[10] - 
-             m[4] * m[2] * m[11] + 
-             m[4] * m[3] * m[10] + 
-             m[8] * m[2] * m[7] - 
-             m[8] * m[3] * m[6];
-
-    inv[11] = -m[0] * m[5] * m[11] + 
-               m[0] * m[7] * m[9] + 
-               m[4] * m[1] * m[11] - 
-               m[4] * m[3] * m[9] - 
-               m[8] * m[1] * m[7] + 
-               m[8] * m[3] * m[5];
-
-    inv[15] = m[0] * m[5] * m[10] - 
-              m[0] * m[6] * m[9] - 
-              m[4] * m[1] * m[10] + 
-              m[4] * m[2] * m[9] + 
-              m[8] * m[1] * m[6] - 
-              m[8] * m[2] * m[5];
-
-    det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
-
-    if (det == 0)
-        return false;
-
-    det = 1.0 / det;
-
-    for (i = 0; i < 16; i++)
-        invOut[i] = inv[i] * det;
-
-    return true;
-}
-
 #define BLOCK_SIZE 128
 
 template<typename T>
@@ -219,7 +93,7 @@ public:
         return g[i + j*4];
     }
     bool inv(Metric & out) const {
-        return invertMatrix(g, out.g);
+        return linalg4_kernels().invert(g, out.g);
     }
 
     static Metric identity() {
@@ -602,6 +476,7 @@ struct deriv {
         compute::mapped_view<compute::float16_> & d,
         compute::command_queue & queue
     ) {
+        GRAVITATE_TRACE_SCOPE("opencl", "metricDerivativeKernel");
         cout << "derivative..." << flush;
         auto derivKernel = prog.create_kernel("metricDerivativeKernel");
         derivKernel.set_args(
@@ -630,7 +505,7 @@ struct invertKernel {
         compute::mapped_view<compute::int_> & succ,
         compute::command_queue & queue
     ) {
-        
+        GRAVITATE_TRACE_SCOPE("opencl", "invertMatrixKernel");
         cout << "inverting metric..." << flush;
         auto invertMatrixKernel = prog.create_kernel("invertMatrixKernel");
         invertMatrixKernel.set_args(
@@ -643,8 +518,44 @@ struct invertKernel {
 };
 
 
+// device kernels generated from the same einsum formulas the host code uses
+string generated_kernels() {
+    Tensor<float,4,Contravariant,Contravariant> inverse;
+    Tensor<float,4,Covariant,Covariant> metric;
+    return einsum_source<"ab,bc->ac">("inverseProduct", inverse, metric);
+}
+
+// g^ab g_bc, the identity wherever the inverse succeeded
+struct inverseProductKernel {
+    compute::program prog;
+
+    void operator()(
+        compute::mapped_view<compute::float16_> & inv,
+        compute::mapped_view<compute::float16_> & m,
+        compute::mapped_view<compute::float16_> & product,
+        compute::command_queue & queue
+    ) {
+        GRAVITATE_TRACE_SCOPE("opencl", "inverseProduct_kernel");
+        cout << "checking inverse..." << flush;
+        auto kernel = prog.create_kernel("inverseProduct_kernel");
+        kernel.set_args(
+            inv.get_buffer(),
+            m.get_buffer(),
+            product.get_buffer());
+        queue.enqueue_1d_range_kernel(kernel, 0, m.size(), queue.get_device().max_work_group_size());
+        cout << "done." << endl;
+    }
+};
 
 int main(int ac, char * av[]) {
+    try {
+        cout << "cpu kernels: " << cpu_level_name(cpu_level()) << endl;
+    }
+    catch(std::invalid_argument & e) {
+        cerr << e.what() << endl;
+        return -1;
+    }
+
     compute::device gpu = compute::system::default_device();
 
     compute::context ctx(gpu);
@@ -655,7 +566,7 @@ int main(int ac, char * av[]) {
     std::size_t size = 64;
 
     cout << "compiling kernels... " << flush;
-    auto prog = compute::program::create_with_source(kernels, ctx);
+    auto prog = compute::program::create_with_source(string(kernels) + generated_kernels(), ctx);
     try {
         prog.build();
     } 
@@ -670,6 +581,7 @@ int main(int ac, char * av[]) {
     auto metric = std::vector<compute::float16_>(size * size * size);
     auto inverse = std::vector<compute::float16_>(size * size * size);
     auto success = std::vector<compute::int_>(size * size * size);
+    auto product = std::vector<compute::float16_>(size * size * size);
     auto metric_d = std::vector<compute::float16_>(size * size * size * 4);
     auto metric_dd = std::vector<compute::float16_>(size * size * size * 4 * 2);
     auto ricci = std::vector<compute::float16_>(size * size * size);
@@ -686,6 +598,7 @@ int main(int ac, char * av[]) {
     compute::mapped_view<decltype(metric)::value_type> metric_map(metric.data(), metric.size(), ctx);
     compute::mapped_view<decltype(inverse)::value_type> inverse_map(inverse.data(), inverse.size(), ctx);
     compute::mapped_view<decltype(success)::value_type> success_map(success.data(), success.size(), ctx);
+    compute::mapped_view<decltype(product)::value_type> product_map(product.data(), product.size(), ctx);
     compute::mapped_view<decltype(metric_d)::value_type> metric_d_map(metric_d.data(), metric_d.size(), ctx);
     compute::mapped_view<decltype(metric_dd)::value_type> metric_dd_map(metric_dd.data(), metric_dd.size(), ctx);
     compute::mapped_view<decltype(ricci)::value_type> ricci_map(ricci.data(), ricci.size(), ctx);
@@ -697,13 +610,31 @@ int main(int ac, char * av[]) {
     cout << "done." << endl;
 
     invertKernel{prog}(metric_map, inverse_map, success_map, queue);
+    inverseProductKernel{prog}(inverse_map, metric_map, product_map, queue);
     
-    queue.finish();
+    {
+        // the kernels above only enqueue, the device time shows up here
+        GRAVITATE_TRACE_SCOPE("opencl", "finish");
+        queue.finish();
+    }
 
     for(int i = 0; i < 10; i++) {
         cout << "m: " << metric[i] << ", inv: " << inverse[i] << endl;
     }
 
+    float inverse_error = 0;
+    for(size_t i = 0; i < product.size(); i++) {
+        if(!success[i]) continue;
+        for(size_t k = 0; k < 16; k++) {
+            inverse_error = std::max(inverse_error, std::abs(product[i][k] - (k % 5 == 0)));
+        }
+    }
+    cout << "max |g^ab g_bc - delta^a_c|: " << inverse_error << endl;
+
+    if(char const * trace_path = std::getenv("GRAVITATE_TRACE_OUTPUT")) {
+        write_chrome_trace(string(trace_path));
+    }
+
     int a;
     cout << "pausing... " << flush;
     std::cin >> a;
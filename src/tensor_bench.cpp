@@ -0,0 +1,380 @@
+#include "tensor.hpp"
+#include "grblock.hpp"
+#include "schwarzschild.hpp"
+#include "raise_lower.hpp"
+#include "linalg4.hpp"
+#include "bench_common.hpp"
+
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <chrono>
+#include <execution>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+tensor_bench measures the Tensor operations, in 4 dimensions for degrees 1 to 6
+(and the degree 8 tensor that is the first to go parallel), both on a single
+thread and nested inside a tbb::parallel_for over a batch of tensors, which is
+how GRElements are evaluated.
+
+The elementwise operations run under each execution policy: "tensor" is
+whatever tensor_execution picks for that tensor, the others run the same
+algorithm with a fixed std::execution policy ("par_unseq" is what every
+operation used before tensor_execution existed).  contract<0,1>,
+multiplyAndContract with a matrix, the outer product with a vector, raising
+the last index with the metric and the GRElement curvature kernels on the Schwarzschild fixture have no policy of
+their own and only run as "tensor".  The curvature kernels are the ones
+curvature_kernels() picks, GRAVITATE_ISA selects another level.
+
+"reciprocal" is the elementwise Tensor::invert(), "invert_metric" and
+"invert_metric_packed" the 4x4 inverse of the Schwarzschild metrics, dense and
+packed symmetric, through the linalg4_kernels() level cpu_level() allows.
+
+FLOP rates count one per add, multiply or divide the operation needs at
+minimum, they are left at 0 for the 4x4 inverse and the curvature kernels,
+which have no closed form count.
+
+usage: tensor_bench [--csv path] [--json path] [--work N]
+*/
+
+using std::cout;
+using std::endl;
+
+enum class Op { construct, copy, add, equal, scale, reciprocal, contract, multiply_and_contract, outer, raise,
+                invert_metric, invert_metric_packed, connection, ricci, ricci2 };
+enum class Policy { tensor, seq, unseq, par_unseq };
+enum class Context { serial, nested };
+
+char const * op_name(Op op) {
+    static char const * names[] = { "construct", "copy", "add", "equal", "scale", "reciprocal",
+                                    "contract", "multiply_and_contract", "outer", "raise",
+                                    "invert_metric", "invert_metric_packed", "connection", "ricci", "ricci2" };
+    return names[(size_t)op];
+}
+char const * policy_name(Policy p) {
+    static char const * names[] = { "tensor", "seq", "unseq", "par_unseq" };
+    return names[(size_t)p];
+}
+char const * context_name(Context c) {
+    static char const * names[] = { "serial", "nested" };
+    return names[(size_t)c];
+}
+
+// the member function, as used by the rest of the code
+template<typename Tensor>
+void apply(Op op, Tensor & a, Tensor const & b, float & sink) {
+    switch(op) {
+    case Op::construct: std::destroy_at(&a); std::construct_at(&a); break;
+    case Op::copy: a = b; break;
+    case Op::add: a += b; break;
+    case Op::equal: sink += (a == b); break;
+    case Op::scale: a *= 1.0001f; break;
+    case Op::reciprocal: a = b.invert(); break;
+    default: break;
+    }
+    sink += a[0];
+}
+
+// the same algorithm with a fixed policy
+template<typename Tensor, typename ExecutionPolicy>
+void apply(Op op, ExecutionPolicy const & policy, Tensor & a, Tensor const & b, float & sink) {
+    switch(op) {
+    case Op::construct: std::fill(policy, a.begin(), a.end(), 0); break;
+    case Op::copy: std::copy(policy, b.begin(), b.end(), a.begin()); break;
+    case Op::add: std::transform(policy, a.begin(), a.end(), b.begin(), a.begin(), std::plus<float>()); break;
+    case Op::equal: sink += std::equal(policy, a.begin(), a.end(), b.begin()); break;
+    case Op::scale: std::transform(policy, a.begin(), a.end(), a.begin(), [](float v) { return v * 1.0001f; }); break;
+    case Op::reciprocal: std::transform(policy, b.begin(), b.end(), a.begin(), [](float v) { return 1.f / v; }); break;
+    default: break;
+    }
+    sink += a[0];
+}
+
+template<typename Tensor>
+void apply(Op op, Policy policy, Tensor & a, Tensor const & b, float & sink) {
+    switch(policy) {
+    case Policy::tensor: apply(op, a, b, sink); break;
+    case Policy::seq: apply(op, std::execution::seq, a, b, sink); break;
+    case Policy::unseq: apply(op, std::execution::unseq, a, b, sink); break;
+    case Policy::par_unseq: apply(op, std::execution::par_unseq, a, b, sink); break;
+    }
+}
+
+// the minimum arithmetic of an elementwise operation
+size_t elementwise_flops(Op op, size_t elements) {
+    switch(op) {
+    case Op::add: case Op::scale: case Op::reciprocal: return elements;
+    default: return 0;
+    }
+}
+
+struct Result {
+    std::string op;
+    size_t dimensions;
+    size_t degree;
+    size_t elements;
+    std::string policy;
+    std::string context;
+    size_t ops;
+    double ns_per_op;
+    size_t flops_per_op;
+    double gflops;
+
+    BenchRow row() const {
+        return BenchRow().add("op", op).add("dimensions", dimensions).add("degree", degree).add("elements", elements)
+            .add("policy", policy).add("context", context).add("ops", ops).add("ns_per_op", ns_per_op)
+            .add("flops_per_op", flops_per_op).add("gflops", gflops);
+    }
+};
+
+// times f(t) over a batch of `batch` items for `rounds` rounds, serially or from a tbb::parallel_for
+template<typename Function>
+double time_batch(Context context, size_t batch, size_t rounds, Function && f) {
+    auto start = std::chrono::steady_clock::now();
+    for(size_t r = 0; r < rounds; ++r) {
+        if(context == Context::serial) {
+            for(size_t t = 0; t < batch; ++t) f(t);
+        } else {
+            tbb::parallel_for(size_t(0), batch, [&](size_t t) { f(t); });
+        }
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+Result make_result(Op op, Policy policy, Context context, size_t dimensions, size_t degree, size_t elements,
+                   size_t ops, double ns, size_t flops_per_op) {
+    Result r;
+    r.op = op_name(op);
+    r.dimensions = dimensions;
+    r.degree = degree;
+    r.elements = elements;
+    r.policy = policy_name(policy);
+    r.context = context_name(context);
+    r.ops = ops;
+    r.ns_per_op = ns / ops;
+    r.flops_per_op = flops_per_op;
+    r.gflops = flops_per_op / r.ns_per_op;
+    return r;
+}
+
+// keep the results alive
+void keep(std::vector<float> const & sinks) {
+    volatile float sink = std::accumulate(sinks.begin(), sinks.end(), 0.f);
+    (void)sink;
+}
+
+template<typename Tensor>
+Result run(Op op, Policy policy, Context context, size_t work) {
+    // enough tensors to spread over the pool, and roughly `work` elements touched in total
+    size_t batch = std::max<size_t>(64, (1 << 20) / Tensor::size());
+    size_t rounds = std::max<size_t>(1, work / (batch * Tensor::size()));
+
+    std::vector<Tensor> as(batch), bs(batch);
+    for(size_t t = 0; t < batch; ++t) {
+        for(size_t i = 0; i < Tensor::size(); ++i) {
+            as[t][i] = 1 + (t + i) % 7;
+            bs[t][i] = 1 + (t * 3 + i) % 5;
+        }
+    }
+
+    std::vector<float> sinks(batch);
+    double ns = time_batch(context, batch, rounds, [&](size_t t) {
+        apply(op, policy, as[t], bs[t], sinks[t]);
+    });
+    keep(sinks);
+
+    return make_result(op, policy, context, Tensor::dimensions, Tensor::degree, Tensor::size(),
+                       rounds * batch, ns, elementwise_flops(op, Tensor::size()));
+}
+
+// contract<0,1>, multiplyAndContract<0,degree> with a matrix, the outer product with a vector or raise<degree-1>
+template<typename Operand>
+Result run_product(Op op, Context context, size_t work) {
+    typedef Tensor<float,Operand::dimensions,Covariant,Contravariant> matrix_type;
+    typedef Tensor<float,Operand::dimensions,Covariant> vector_type;
+    typedef Tensor<float,Operand::dimensions,Contravariant,Contravariant> inverse_type;
+    constexpr size_t N = Operand::dimensions;
+
+    size_t batch = std::max<size_t>(64, (1 << 20) / Operand::size());
+    size_t rounds = std::max<size_t>(1, work / (batch * Operand::size()));
+
+    std::vector<Operand> as(batch);
+    matrix_type m;
+    vector_type v;
+    inverse_type inverse;
+    for(size_t t = 0; t < batch; ++t) {
+        for(size_t i = 0; i < Operand::size(); ++i) as[t][i] = 1 + (t + i) % 7;
+    }
+    for(size_t i = 0; i < m.size(); ++i) m[i] = 1 + i % 5;
+    for(size_t i = 0; i < v.size(); ++i) v[i] = 1 + i % 3;
+    for(size_t i = 0; i < inverse.size(); ++i) inverse[i] = 1 + (i % N + i / N) % 4;
+
+    std::vector<float> sinks(batch);
+    size_t flops = 0;
+    double ns = 0;
+    switch(op) {
+    case Op::contract:
+        if constexpr(Operand::degree >= 2) {
+            // N^(degree-2) sums of N terms
+            flops = Operand::size() / (N * N) * (N - 1);
+            ns = time_batch(context, batch, rounds, [&](size_t t) { sinks[t] += as[t].template contract<0,1>()[0]; });
+        }
+        break;
+    case Op::multiply_and_contract:
+        // N^degree results, each N multiplies and N - 1 adds
+        flops = Operand::size() * (2 * N - 1);
+        ns = time_batch(context, batch, rounds, [&](size_t t) {
+            sinks[t] += as[t].template multiplyAndContract<0,Operand::degree>(m)[0];
+        });
+        break;
+    case Op::outer:
+        flops = Operand::size() * N;
+        ns = time_batch(context, batch, rounds, [&](size_t t) { sinks[t] += (as[t] * v)[0]; });
+        break;
+    case Op::raise:
+        if constexpr(Operand::degree >= 2) {
+            // the same count as multiplyAndContract, without building the product
+            flops = Operand::size() * (2 * N - 1);
+            ns = time_batch(context, batch, rounds, [&](size_t t) {
+                sinks[t] += raise<Operand::degree - 1>(as[t], inverse)[0];
+            });
+        }
+        break;
+    default:
+        break;
+    }
+    keep(sinks);
+
+    return make_result(op, Policy::tensor, context, N, Operand::degree, Operand::size(), rounds * batch, ns, flops);
+}
+
+// invert(metric) on the Schwarzschild metrics, one radius per element of the batch
+Result run_metric_inverse(Op op, Context context, size_t work) {
+    size_t batch = 1024;
+    size_t rounds = std::max<size_t>(1, work / (batch * 16));
+
+    std::vector<metric_type> packed;
+    std::vector<Tensor<float,4,Covariant,Covariant>> dense;
+    for(size_t t = 0; t < batch; ++t) {
+        packed.push_back(Schwarzschild(1.5 + 8. * t / batch, 0.2 + 2.7 * (t % 64) / 64).metric);
+        dense.push_back(packed.back().unpack());
+    }
+
+    std::vector<float> sinks(batch);
+    double ns = time_batch(context, batch, rounds, [&](size_t t) {
+        if(op == Op::invert_metric) sinks[t] += invert(dense[t])[0];
+        else sinks[t] += invert(packed[t])[0];
+    });
+    keep(sinks);
+
+    size_t elements = op == Op::invert_metric ? dense[0].size() : packed[0].size();
+    return make_result(op, Policy::tensor, context, 4, 2, elements, rounds * batch, ns, 0);
+}
+
+// the curvature kernels on the Schwarzschild fixture of grblock_test.cpp, one angle per element of the batch
+Result run_curvature(Op op, Context context, size_t work) {
+    size_t batch = 64;
+    size_t rounds = std::max<size_t>(1, work / (batch * 4096));
+
+    std::vector<GRElement> elements;
+    for(size_t t = 0; t < batch; ++t) {
+        elements.push_back(Schwarzschild(2.5, 0.2 + 2.7 * t / batch));
+    }
+
+    // the kernels compiled for the level cpu_level() allows, as the grid loops call them
+    CurvatureKernels const & kernels = curvature_kernels();
+
+    std::vector<float> sinks(batch);
+    double ns = time_batch(context, batch, rounds, [&](size_t t) {
+        switch(op) {
+        case Op::connection: sinks[t] += kernels.connection(elements[t])[0]; break;
+        case Op::ricci: sinks[t] += kernels.ricci(elements[t])[0]; break;
+        case Op::ricci2: sinks[t] += kernels.ricci2(elements[t])[0]; break;
+        default: break;
+        }
+    });
+    keep(sinks);
+
+    size_t elements_out = op == Op::connection ? connection_type::size() : ricci_type::size();
+    return make_result(op, Policy::tensor, context, 4, op == Op::connection ? 3 : 2, elements_out, rounds * batch, ns, 0);
+}
+
+// Tensor<float,4,...> of degree D, its first index upper so contract<0,1> applies
+template<size_t D, typename = std::make_index_sequence<D - 1>>
+struct bench_tensor;
+
+template<size_t D, size_t ... Is>
+struct bench_tensor<D,std::index_sequence<Is...>> {
+    typedef Tensor<float,4,Contravariant,typename replace_type<std::integral_constant<size_t,Is>,Covariant>::type...> type;
+};
+
+// the smallest 4 dimensional tensor that tensor_execution sends to the parallel backend by default
+typedef Tensor<float,4,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant> large_type;
+
+void print(Result const & r) {
+    cout << std::setw(22) << r.op << std::setw(7) << r.degree << std::setw(10) << r.elements << std::setw(11) << r.policy
+         << std::setw(9) << r.context << std::setw(14) << r.ns_per_op << r.gflops << endl;
+}
+
+template<size_t ... Ds>
+void run_degrees(std::index_sequence<Ds...>, std::vector<Result> & results, size_t work) {
+    // every elementwise operation under every policy
+    for(auto op : { Op::construct, Op::copy, Op::add, Op::equal, Op::scale, Op::reciprocal })
+    for(auto context : { Context::serial, Context::nested })
+    for(auto policy : { Policy::tensor, Policy::seq, Policy::unseq, Policy::par_unseq }) {
+        for(auto r : { run<typename bench_tensor<Ds>::type>(op, policy, context, work)..., run<large_type>(op, policy, context, work) }) {
+            print(r);
+            results.push_back(r);
+        }
+    }
+
+    for(auto op : { Op::contract, Op::multiply_and_contract, Op::outer, Op::raise })
+    for(auto context : { Context::serial, Context::nested }) {
+        for(auto r : { run_product<typename bench_tensor<Ds>::type>(op, context, work)... }) {
+            if(r.flops_per_op == 0) continue; // contract or raise of a vector
+            print(r);
+            results.push_back(r);
+        }
+    }
+}
+
+int main(int ac, char * av[]) {
+    size_t work = 1 << 22;
+
+    BenchArgs args;
+    args.option("--work", work);
+    if(!args.parse(ac, av)) return -1;
+
+    std::vector<Result> results;
+    cout << std::left << std::setw(22) << "op" << std::setw(7) << "degree" << std::setw(10) << "elements" << std::setw(11) << "policy"
+         << std::setw(9) << "context" << std::setw(14) << "ns/op" << "GFLOP/s" << endl;
+
+    run_degrees(std::index_sequence<1,2,3,4,5,6>{}, results, work);
+
+    for(auto op : { Op::invert_metric, Op::invert_metric_packed })
+    for(auto context : { Context::serial, Context::nested }) {
+        Result r = run_metric_inverse(op, context, work);
+        print(r);
+        results.push_back(r);
+    }
+
+    for(auto op : { Op::connection, Op::ricci, Op::ricci2 })
+    for(auto context : { Context::serial, Context::nested }) {
+        Result r = run_curvature(op, context, work);
+        print(r);
+        results.push_back(r);
+    }
+
+    args.write(results);
+
+    return 0;
+}
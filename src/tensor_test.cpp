@@ -1,9 +1,22 @@
 #include "tensor.hpp"
+#include "tensor_storage.hpp"
+#include "einsum.hpp"
+#include "einsum_codegen.hpp"
+#include "packed_tensor.hpp"
+#include "linalg4.hpp"
+#include "tensor_field.hpp"
+#include "tensor_view.hpp"
+#include "sparse_tensor.hpp"
+#include "reduced_precision.hpp"
+#include "spatial.hpp"
+#include "raise_lower.hpp"
+#include "einsum_generated.hpp" // written by einsum_generate at build time
 
 #include <filesystem>
 #include <iostream>
 #include <functional>
 #include <array>
+#include <cmath>
 #include <random>
 #include <type_traits>
 
@@ -206,6 +219,232 @@ TEST(TensorTest, Indexing2) {
     }
 }
 
+TEST(TensorTest, CompileTimeIndexing) {
+    typedef Tensor<float,4,Covariant,Covariant,Covariant> t3;
+
+    static_assert(t3::strides[0] == 1);
+    static_assert(t3::strides[1] == 4);
+    static_assert(t3::strides[2] == 16);
+    static_assert(t3::index(tuple<size_t,size_t,size_t>(1,2,3)) == 1 + 2*4 + 3*16);
+    static_assert(t3::dimension(1 + 2*4 + 3*16) == tuple<size_t,size_t,size_t>(1,2,3));
+    static_assert(Tensor<float,4>::index(tuple<>()) == 0);
+
+    t3 t;
+    for(size_t i = 0; i < t.size(); ++i) t[i] = i;
+
+    for(size_t a = 0; a < 4; ++a)
+    for(size_t b = 0; b < 4; ++b)
+    for(size_t c = 0; c < 4; ++c) {
+        ASSERT_EQ(t.unchecked(a, b, c), t.get({a, b, c}));
+        ASSERT_EQ(t({a, b, c}), t.get({a, b, c}));
+        ASSERT_EQ(t3::dimension(t3::index(tuple<size_t,size_t,size_t>(a, b, c))), (tuple<size_t,size_t,size_t>(a, b, c)));
+    }
+
+    ASSERT_THROW(t.get({3, 3, 4}), std::out_of_range);
+}
+
+TEST(TensorTest, ExecutionPolicy) {
+    // curvature sized tensors stay on the calling thread, only huge ones go parallel
+    static_assert(!Tensor<float,4,Covariant,Covariant>::execution::parallel);
+    static_assert(!Tensor<float,4,Contravariant,Covariant,Covariant,Covariant>::execution::parallel);
+    static_assert(tensor_execution<float,GRAVITATE_TENSOR_PARALLEL_THRESHOLD>::parallel);
+    static_assert(std::is_same_v<std::remove_cvref_t<decltype(tensor_execution<float,16>::policy())>, std::execution::unsequenced_policy>);
+
+    Tensor<float,4,Covariant,Covariant> a, b;
+    for(size_t i = 0; i < a.size(); ++i) {
+        a[i] = i;
+        b[i] = 2 * i;
+    }
+    a += a;
+    ASSERT_EQ(a, b);
+}
+
+// a small tensor type moved to the heap, to exercise the storage without a large tensor
+template<>
+struct tensor_storage<double,8> {
+    typedef HeapStorage<double,8> type;
+};
+
+TEST(TensorTest, StoragePolicy) {
+    typedef Tensor<float,4,Covariant,Covariant> small;
+    typedef Tensor<float,4,Covariant,Covariant,Covariant,Covariant,Covariant,Covariant> parenthetical;
+    typedef Tensor<double,2,Covariant,Covariant,Covariant> heap;
+    static_assert(std::is_same_v<small::data_type, std::array<float,16>>);
+    static_assert(std::is_same_v<parenthetical::data_type, ArenaStorage<float,4096>>);
+    static_assert(std::is_same_v<heap::data_type, HeapStorage<double,8>>);
+
+    heap h;
+    for(size_t i = 0; i < h.size(); ++i) h[i] = i;
+    heap h2 = h, h3 = std::move(h2);
+    // the heap move takes the elements and allocates nothing for the source
+    static_assert(std::is_nothrow_move_constructible_v<HeapStorage<double,8>>);
+    ASSERT_EQ(h2.begin(), nullptr);
+    h3 *= 2.;
+    ASSERT_EQ(h3, h * 2.);
+    ASSERT_THROW(h3.get({1, 1, 2}), std::out_of_range);
+
+    // outside of a scope arena tensors are heap allocated and can be kept
+    parenthetical kept;
+    ASSERT_FALSE(TensorArena::local().active());
+
+    auto fill = [](parenthetical & t, float v) {
+        for(size_t i = 0; i < t.size(); ++i) t[i] = v + i;
+    };
+    fill(kept, 1);
+
+    size_t reserved = 0;
+    for(size_t point = 0; point < 8; ++point) {
+        TensorArena::Scope scope;
+        parenthetical a, b(true);
+        fill(a, point);
+        b = a + kept;
+        parenthetical c = b - kept;
+        ASSERT_EQ(c, a);
+
+        // kept is assigned, not rebound to arena memory
+        if(point == 3) kept = std::move(c);
+
+        // after the first point the arena has grown as far as it will
+        if(point == 0) reserved = TensorArena::local().reserved();
+        ASSERT_EQ(TensorArena::local().reserved(), reserved);
+    }
+    ASSERT_FALSE(TensorArena::local().active());
+    for(size_t i = 0; i < kept.size(); ++i) {
+        ASSERT_EQ(kept[i], 3.f + i);
+    }
+
+    // a moved from tensor gets elements again when it is written
+    heap moved = std::move(h3);
+    h3 = h;
+    h3 += h;
+    ASSERT_EQ(h3, moved);
+    heap rebound = std::move(h3);
+    h3 = std::move(h2); // both without elements
+    h3 = h + h;
+    ASSERT_EQ(h3, rebound);
+    parenthetical source = kept, target(std::move(source));
+    source = kept;
+    source += kept;
+    ASSERT_EQ(source, target + kept);
+
+    // moves into a container made inside a scope are on the heap and outlive it
+    std::vector<parenthetical> saved;
+    for(size_t point = 0; point < 2; ++point) {
+        TensorArena::Scope scope;
+        parenthetical t;
+        fill(t, 7 + point);
+        saved.push_back(std::move(t));
+        saved.push_back(t);
+        parenthetical overwrite;
+        fill(overwrite, -1);
+    }
+    {
+        TensorArena::Scope scope;
+        parenthetical overwrite;
+        fill(overwrite, -1);
+        for(size_t point = 0; point < 2; ++point) {
+            ASSERT_EQ(saved[2 * point][5], 7.f + point + 5);
+            ASSERT_EQ(saved[2 * point + 1][5], 7.f + point + 5);
+        }
+    }
+
+    // each scope rewinds to where it started, so nested scopes reuse the same memory
+    {
+        TensorArena::Scope outer;
+        parenthetical a;
+        float * first;
+        {
+            TensorArena::Scope inner;
+            parenthetical b;
+            first = &b[0];
+            ASSERT_NE(first, &a[0]);
+        }
+        parenthetical c;
+        ASSERT_EQ(&c[0], first);
+    }
+}
+
+// true when a + b names a valid expression
+template<typename A, typename B>
+concept addable = requires(A a, B b) { a + b; };
+
+TEST(TensorTest, Expressions) {
+    typedef Tensor<float,4,Contravariant,Covariant> mixed;
+    mixed a, b, c;
+    for(size_t i = 0; i < a.size(); ++i) {
+        a[i] = i;
+        b[i] = 3 * i + 1;
+        c[i] = 0.25f * i;
+    }
+
+    // nothing is evaluated until the expression becomes a tensor
+    auto e = (a + b) * 0.5f - c;
+    static_assert(!std::is_same_v<decltype(e), mixed>);
+    static_assert(std::is_same_v<decltype(e)::tensor_type, mixed>);
+
+    mixed r = e;
+    for(size_t i = 0; i < r.size(); ++i) {
+        ASSERT_EQ(r[i], (a[i] + b[i]) * 0.5f - c[i]);
+    }
+
+    r = -a / 2 + 2 * b;
+    for(size_t i = 0; i < r.size(); ++i) {
+        ASSERT_EQ(r[i], -a[i] / 2 + 2 * b[i]);
+    }
+
+    // evaluating into an operand is fine, every element only reads its own position
+    a = a + a;
+    r += a - b;
+    ASSERT_EQ(r[5], -2.5f + 32 + 10 - 16);
+    ASSERT_EQ(mixed(a + b), b + a);
+
+    // temporaries are moved into the expression instead of dangling
+    auto t = mixed(b) + c;
+    ASSERT_EQ(mixed(t), b + c);
+
+    static_assert(addable<mixed, mixed>);
+    static_assert(!addable<mixed, Tensor<float,4,Covariant,Contravariant>>);
+    static_assert(!addable<mixed, Tensor<float,3,Contravariant,Covariant>>);
+}
+
+TEST(TensorTest, ForEachIndex) {
+    size_t visited = 0;
+    for_each_index<3,4>([&](size_t offset, std::array<size_t,4> const & dims) {
+        ASSERT_EQ(offset, visited);
+        ASSERT_EQ((TensorHelper<size_t,3,4>::dimension(offset)), (tuple<size_t,size_t,size_t,size_t>(dims[0], dims[1], dims[2], dims[3])));
+        ++visited;
+    });
+    ASSERT_EQ(visited, 81);
+
+    // a second layout walked alongside the first one, here the transpose
+    for_each_offsets<4,2,2>({{ {1,4}, {4,1} }}, [&](std::array<size_t,2> const & off, std::array<size_t,2> const & dims) {
+        ASSERT_EQ(off[0], dims[0] + 4 * dims[1]);
+        ASSERT_EQ(off[1], dims[1] + 4 * dims[0]);
+    });
+}
+
+TEST(TensorTest, MultiplyAndContract) {
+    Tensor<float,3,Contravariant,Contravariant> g;
+    Tensor<float,3,Covariant,Covariant,Covariant> t;
+    for(size_t i = 0; i < g.size(); ++i) g[i] = i + 1;
+    for(size_t i = 0; i < t.size(); ++i) t[i] = 2 * i - 7;
+
+    auto c = g.multiplyAndContract<1,3>(t);
+    auto o = (g * t).contract<1,3>();
+    static_assert(std::is_same_v<decltype(c), Tensor<float,3,Contravariant,Covariant,Covariant>>);
+
+    for(size_t a = 0; a < 3; ++a)
+    for(size_t b = 0; b < 3; ++b)
+    for(size_t d = 0; d < 3; ++d) {
+        float sum = 0;
+        for(size_t k = 0; k < 3; ++k) {
+            sum += g({a,k}) * t({b,k,d});
+        }
+        ASSERT_EQ(c({a,b,d}), sum);
+        ASSERT_EQ(o({a,b,d}), sum);
+    }
+}
+
 TEST(GLBlockTest, Contract) {
     typedef Tensor<float, 2, Covariant, Contravariant> t01;
     typedef Tensor<float, 2, Contravariant, Covariant> t10;
@@ -288,4 +527,665 @@ TEST(TensorTest, Types) {
         variance_container<Covariant>,
         typename contraction_type<0,2,Contravariant,Covariant,Covariant>::type
     >::value));
-}
\ No newline at end of file
+}
+TEST(TensorTest, Einsum) {
+    Tensor<float,4,Contravariant,Contravariant> g;
+    Tensor<float,4,Covariant,Covariant,Covariant> conn;
+    Tensor<float,4,Contravariant,Covariant> m;
+    for(size_t i = 0; i < g.size(); ++i) g[i] = 0.5f * i - 3;
+    for(size_t i = 0; i < conn.size(); ++i) conn[i] = 0.25f * i + 1;
+    for(size_t i = 0; i < m.size(); ++i) m[i] = i % 5;
+
+    // a single pair is the same sum, in the same order, as multiplyAndContract
+    auto c = einsum<"ab,cbd->acd">(g, conn);
+    static_assert(std::is_same_v<decltype(c), Tensor<float,4,Contravariant,Covariant,Covariant>>);
+    ASSERT_EQ(c, (g.multiplyAndContract<1,3>(conn)));
+
+    // the result may come out in any index order
+    auto p = einsum<"ab,cbd->dac">(g, conn);
+    static_assert(std::is_same_v<decltype(p), Tensor<float,4,Covariant,Contravariant,Covariant>>);
+    for(size_t a = 0; a < 4; ++a)
+    for(size_t cc = 0; cc < 4; ++cc)
+    for(size_t d = 0; d < 4; ++d) {
+        ASSERT_EQ(p({d,a,cc}), c({a,cc,d}));
+    }
+
+    // traces and several pairs at once
+    float trace = 0;
+    for(size_t a = 0; a < 4; ++a) trace += m({a,a});
+    ASSERT_EQ((einsum<"aa->">(m)({})), trace);
+
+    auto chain = einsum<"ab,bc,cd->ad">(m, m, m);
+    auto square = m.multiplyAndContract<1,2>(m);
+    ASSERT_EQ(chain, (square.multiplyAndContract<1,2>(m)));
+
+    // and the outer product when nothing is summed
+    Tensor<float,4,Contravariant> u;
+    Tensor<float,4,Covariant> v;
+    for(size_t i = 0; i < 4; ++i) {
+        u[i] = i + 1;
+        v[i] = 2 * i - 1;
+    }
+    ASSERT_EQ((einsum<"a,b->ab">(u, v)), u * v);
+    ASSERT_EQ((einsum<"a,a->">(u, v)({})), (u.multiplyAndContract<0,1>(v)({})));
+
+    // mismatches are compile errors
+    static_assert(einsum_compatible<"ab,bc->ac", decltype(m), decltype(m)>);
+    static_assert(!einsum_variances_pair<"ab,bcd->acd", decltype(m), decltype(conn)>);
+    static_assert(!einsum_labels_match_degrees<"ab,bc->ac", decltype(m), decltype(conn)>);
+    static_assert(!einsum_labels_pair<"ab,bc->abc", decltype(m), decltype(m)>);
+    static_assert(!einsum_labels_pair<"ab,bb->a", decltype(m), decltype(m)>);
+    static_assert(!einsum_same_space<"ab,bc->ac", decltype(m), Tensor<float,3,Contravariant,Covariant>>);
+    static_assert(!einsum_well_formed<"ab,bc">);
+    static_assert(!einsum_well_formed<"a1,1c->ac">);
+}
+
+TEST(TensorTest, PackedSymmetric) {
+    typedef PackedTensor<float,4,symmetry<2>,Covariant,Covariant> metric;
+    typedef PackedTensor<float,4,symmetry<1,2>,Covariant,Contravariant,Contravariant> derivative;
+    typedef PackedTensor<float,4,symmetry<2,2>,Covariant,Covariant,Covariant,Covariant> second_derivative;
+    static_assert(metric::size() == 10 && metric::full_size() == 16);
+    static_assert(derivative::size() == 40);
+    static_assert(second_derivative::size() == 100);
+
+    // every ordering of a symmetric group is the same slot, and every slot is reachable
+    std::array<size_t,100> hits{};
+    for_each_index<4,4>([&](size_t, std::array<size_t,4> const & i) {
+        auto slot = second_derivative::offset(i);
+        ASSERT_LT(slot, 100);
+        ASSERT_EQ(slot, second_derivative::offset({i[1], i[0], i[3], i[2]}));
+        ++hits[slot];
+    });
+    for(size_t s = 0; s < 100; ++s) {
+        ASSERT_EQ(hits[s], second_derivative::slot_multiplicity[s]);
+    }
+
+    derivative d;
+    d({2,1,3}) = 5;
+    ASSERT_EQ(d({2,3,1}), 5);
+    ASSERT_EQ(d.unchecked(2,3,1), 5);
+    ASSERT_EQ(d({1,2,3}), 0);
+    ASSERT_THROW(d.get({0,4,0}), std::out_of_range);
+
+    // unpacking fills both halves and packing keeps one of each
+    auto full = d.unpack();
+    ASSERT_EQ(full({2,1,3}), 5);
+    ASSERT_EQ(full({2,3,1}), 5);
+    ASSERT_EQ(derivative(full), d);
+
+    // elementwise expressions run over the packed components only
+    derivative e = d * 2.f + d;
+    ASSERT_EQ(e({2,3,1}), 15);
+
+    // contracting with a symmetric tensor visits each pair once and gives the full sum
+    metric g;
+    for(size_t s = 0; s < g.size(); ++s) g[s] = s + 1;
+    auto x = [](size_t c, size_t dd) { return float(3 * c + dd * dd); };
+    float full_sum = 0;
+    for(size_t c = 0; c < 4; ++c)
+    for(size_t dd = 0; dd < 4; ++dd) {
+        full_sum += g({c,dd}) * x(c,dd);
+    }
+    ASSERT_EQ(contract_symmetric(g, x), full_sum);
+}
+
+TEST(TensorTest, Linalg4) {
+    typedef Tensor<float,4,Covariant,Covariant> metric;
+    typedef Tensor<float,4,Contravariant,Contravariant> inverse_metric;
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-1, 1);
+    auto random_matrix = [&] {
+        metric m;
+        for(size_t i = 0; i < m.size(); ++i) m[i] = dist(rng);
+        for(size_t i = 0; i < 4; ++i) m({i,i}) += 4; // well conditioned
+        return m;
+    };
+
+    auto const & implementations = linalg4_implementations();
+    ASSERT_EQ(implementations.front().isa, std::string("portable"));
+    ASSERT_EQ(&linalg4_kernels(), &implementations.back());
+    auto const & portable = implementations.front();
+
+    // every implementation agrees with the scalar reference
+    for(int trial = 0; trial < 100; ++trial) {
+        metric a = random_matrix(), b = random_matrix();
+        float expected[16], product[16], vector[4];
+        ASSERT_TRUE(portable.invert(&a[0], expected));
+        portable.multiply(&a[0], &b[0], product);
+        portable.multiply_vector(&a[0], &b[0], vector);
+        float det = portable.determinant(&a[0]);
+
+        for(auto const & k : implementations) {
+            float out[16];
+            ASSERT_TRUE(k.invert(&a[0], out)) << k.isa;
+            for(size_t i = 0; i < 16; ++i) ASSERT_NEAR(out[i], expected[i], 1e-5) << k.isa;
+            ASSERT_NEAR(k.determinant(&a[0]), det, 1e-3 * std::abs(det)) << k.isa;
+            k.multiply(&a[0], &b[0], out);
+            for(size_t i = 0; i < 16; ++i) ASSERT_NEAR(out[i], product[i], 1e-5) << k.isa;
+            k.multiply_vector(&a[0], &b[0], out);
+            for(size_t i = 0; i < 4; ++i) ASSERT_NEAR(out[i], vector[i], 1e-5) << k.isa;
+        }
+    }
+
+    // singular matrices are reported and give a zero tensor
+    metric singular;
+    singular({0,0}) = 1;
+    float out[16];
+    for(auto const & k : implementations) {
+        ASSERT_FALSE(k.invert(&singular[0], out)) << k.isa;
+    }
+    ASSERT_EQ(invert(singular), inverse_metric());
+
+    // batched structure of arrays, with a count that leaves a scalar tail
+    size_t const count = 21, stride = 24;
+    std::vector<float> in(16 * stride), expected(16 * stride);
+    for(size_t i = 0; i < count; ++i) {
+        metric m = i == 5 ? singular : random_matrix();
+        float inv[16] = {};
+        portable.invert(&m[0], inv);
+        for(size_t c = 0; c < 16; ++c) {
+            in[c * stride + i] = m[c];
+            expected[c * stride + i] = inv[c];
+        }
+    }
+    for(auto const & k : implementations) {
+        std::vector<float> soa(16 * stride);
+        ASSERT_EQ(k.invert_soa(in.data(), soa.data(), count, stride), 1u) << k.isa;
+        for(size_t i = 0; i < count; ++i) {
+            for(size_t c = 0; c < 16; ++c) ASSERT_NEAR(soa[c * stride + i], expected[c * stride + i], 1e-5) << k.isa;
+        }
+        // a singular matrix in a full vector and in the scalar tail comes out zero
+        std::vector<float> tail(in);
+        for(size_t c = 0; c < 16; ++c) tail[c * stride + count - 1] = in[c * stride + 5];
+        ASSERT_EQ(k.invert_soa(tail.data(), soa.data(), count, stride), 2u) << k.isa;
+        for(size_t c = 0; c < 16; ++c) {
+            ASSERT_EQ(soa[c * stride + 5], 0.f) << k.isa;
+            ASSERT_EQ(soa[c * stride + count - 1], 0.f) << k.isa;
+        }
+    }
+
+    // the Tensor overloads keep track of variances
+    metric g = random_matrix();
+    auto inv = invert(g);
+    static_assert(std::is_same_v<decltype(inv), inverse_metric>);
+    auto identity = matrix_product(g, inv);
+    static_assert(std::is_same_v<decltype(identity), Tensor<float,4,Covariant,Contravariant>>);
+    for(size_t r = 0; r < 4; ++r)
+    for(size_t c = 0; c < 4; ++c) {
+        ASSERT_NEAR(identity({r,c}), r == c, 1e-5);
+    }
+    ASSERT_NEAR(determinant(g) * determinant(inv), 1, 1e-4);
+    ASSERT_NEAR(invert(inv)[6], g[6], 1e-5);
+
+    Tensor<float,4,Contravariant> v;
+    for(size_t i = 0; i < 4; ++i) v[i] = i + 1;
+    auto lowered = lower(v, g);
+    static_assert(std::is_same_v<decltype(lowered), Tensor<float,4,Covariant>>);
+    auto raised = raise(lowered, inv);
+    for(size_t i = 0; i < 4; ++i) ASSERT_NEAR(raised[i], v[i], 1e-5);
+}
+
+TEST(TensorTest, TensorField) {
+    typedef Tensor<float,4,Covariant,Covariant> metric;
+    typedef Tensor<float,4,Contravariant,Covariant,Covariant> connection;
+    typedef TensorField<float,4,Covariant,Covariant> metric_field;
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> dist(-1, 1);
+    size_t const points = 37;
+
+    std::vector<metric> gs(points);
+    std::vector<connection> cs(points);
+    for(size_t p = 0; p < points; ++p) {
+        for(size_t i = 0; i < metric::size(); ++i) gs[p][i] = dist(rng);
+        for(size_t i = 0; i < 4; ++i) gs[p]({i,i}) += 4;
+        for(size_t i = 0; i < connection::size(); ++i) cs[p][i] = dist(rng);
+    }
+
+    metric_field g(gs);
+    TensorField<float,4,Contravariant,Covariant,Covariant> c(cs);
+    ASSERT_EQ(g.points(), points);
+    ASSERT_EQ(g.stride() % metric_field::lanes, 0u);
+    ASSERT_EQ(g.component(5)[7], gs[7][5]);
+    ASSERT_EQ(g.tensors()[12], gs[12]);
+
+    // the per point proxy behaves like a Tensor
+    metric t = g[3];
+    ASSERT_EQ(t, gs[3]);
+    ASSERT_EQ(g[3]({1,2}), gs[3]({1,2}));
+    ASSERT_EQ(g[3].unchecked(1,2), gs[3]({1,2}));
+    ASSERT_THROW(g.at(points), std::out_of_range);
+    g[3] = g[4] * 2.f + gs[3];
+    metric expected = gs[4] * 2.f + gs[3];
+    ASSERT_EQ(g[3], expected);
+    g[3] = gs[3];
+    g[3] += g[3];
+    ASSERT_EQ(g[3], metric(gs[3] * 2.f));
+    g[3] = gs[3];
+
+    // bulk kernels agree with the per tensor ones
+    metric_field h = g;
+    h += g;
+    h *= 0.25f;
+    for(size_t p = 0; p < points; ++p) {
+        ASSERT_EQ(h[p], metric((gs[p] + gs[p]) * 0.25f));
+    }
+    ASSERT_THROW(h += metric_field(points + 1), std::invalid_argument);
+
+    auto gc = multiply_and_contract<1,2>(g, c);
+    static_assert(std::is_same_v<decltype(gc), TensorField<float,4,Covariant,Covariant,Covariant>>);
+    auto traced = contract<0,1>(c);
+    for(size_t p = 0; p < points; ++p) {
+        auto expected_gc = gs[p].multiplyAndContract<1,2>(cs[p]);
+        auto expected_trace = cs[p].contract<0,1>();
+        for(size_t i = 0; i < expected_gc.size(); ++i) ASSERT_NEAR(gc[p][i], expected_gc[i], 1e-5);
+        for(size_t i = 0; i < expected_trace.size(); ++i) ASSERT_NEAR(traced[p][i], expected_trace[i], 1e-5);
+    }
+
+    TensorField<float,4,Contravariant,Contravariant> inv(points);
+    ASSERT_EQ(invert(g, inv), 0u);
+    for(size_t p = 0; p < points; ++p) {
+        auto expected_inv = invert(gs[p]);
+        for(size_t i = 0; i < metric::size(); ++i) ASSERT_NEAR(inv[p][i], expected_inv[i], 1e-5);
+    }
+    // a singular point agrees with the per point inverse, zero
+    metric_field degenerate = g;
+    degenerate[3] = metric();
+    ASSERT_EQ(invert(degenerate, inv), 1u);
+    ASSERT_EQ(inv[3].tensor(), invert(metric()));
+    ASSERT_EQ(inv[3][0], 0.f);
+
+    // round trip through the float16 per point layout
+    std::vector<float> interleaved(points * 16);
+    g.store_interleaved(interleaved.data());
+    ASSERT_EQ(interleaved[16 * 9 + 6], gs[9][6]);
+    metric_field back(points);
+    back.load_interleaved(interleaved.data());
+    ASSERT_EQ(back, g);
+}
+
+TEST(TensorTest, TensorView) {
+    typedef Tensor<float,4,Covariant,Covariant> metric;
+    typedef Tensor<float,4,Covariant,Covariant,Covariant> derivative;
+    typedef Tensor<float,4,Contravariant,Covariant,Covariant> connection;
+
+    derivative dg;
+    connection c;
+    for(size_t i = 0; i < dg.size(); ++i) {
+        dg[i] = float(i);
+        c[i] = float(i % 7) - 3;
+    }
+
+    // fixing the derivative index gives d_a g_bc without a copy
+    auto d2 = view(dg).fix<0>(2);
+    static_assert(std::is_same_v<decltype(d2), TensorView<float,4,Covariant,Covariant>>);
+    ASSERT_EQ(&d2.unchecked(1,3), &dg({2,1,3}));
+    ASSERT_EQ(d2.get({1,3}), dg({2,1,3}));
+    ASSERT_THROW(d2.get({4,0}), std::out_of_range);
+
+    // permutations reorder indices and their variances
+    auto cp = view(std::as_const(c)).permute<1,2,0>();
+    static_assert(std::is_same_v<decltype(cp), TensorView<float const,4,Covariant,Covariant,Contravariant>>);
+    for(size_t a = 0; a < 4; ++a)
+    for(size_t b = 0; b < 4; ++b)
+    for(size_t d = 0; d < 4; ++d) {
+        ASSERT_EQ(cp({b,d,a}), c({a,b,d}));
+    }
+    metric g = d2.permute<1,0>();
+    ASSERT_EQ(g({3,1}), dg({2,1,3}));
+
+    // views are expressions and write through
+    metric twice = d2 * 2.f;
+    ASSERT_EQ(twice({1,3}), 2 * dg({2,1,3}));
+    d2 = g;
+    ASSERT_EQ(dg({2,1,3}), g({1,3}));
+    ASSERT_EQ(dg({2,3,1}), g({3,1}));
+    d2 = d2.permute<1,0>(); // aliasing reads the old values
+    ASSERT_EQ(dg({2,1,3}), g({3,1}));
+    d2 += g;
+    ASSERT_EQ(dg({2,1,3}), g({3,1}) + g({1,3}));
+
+    // expressions mixing views, tensors and scalars walk every operand along its own strides
+    typedef Tensor<float,4,Covariant,Covariant,Contravariant> permuted;
+    permuted pc = cp;
+    permuted mixed = (cp + pc) * 0.5f - -cp;
+    for(size_t a = 0; a < 4; ++a)
+    for(size_t b = 0; b < 4; ++b)
+    for(size_t d = 0; d < 4; ++d) {
+        ASSERT_EQ(mixed({b,d,a}), 2 * c({a,b,d}));
+    }
+    ASSERT_TRUE(cp == pc);
+    pc[5] += 1;
+    ASSERT_TRUE(cp != pc);
+
+    // external memory, such as a mapped buffer of float16s
+    float buffer[32] = {};
+    TensorView<float,4,Covariant,Covariant> second(buffer + 16);
+    second = g;
+    ASSERT_EQ(buffer[16 + 7], g[7]);
+
+    // contraction reads views in place and matches the Tensor functions
+    metric e = view(dg).fix<1>(0);
+    auto product = multiply_and_contract<0,3>(cp.permute<2,0,1>(), view(dg).fix<1>(0));
+    ASSERT_EQ(product, (c.multiplyAndContract<0,3>(e)));
+    ASSERT_EQ((contract<0,2>(cp)), (c.contract<0,1>()));
+}
+
+TEST(TensorTest, Sparse) {
+    typedef Tensor<float,4,Contravariant,Covariant,Covariant> connection;
+    typedef Tensor<float,4,Covariant,Covariant,Covariant> derivative;
+    typedef Tensor<float,4,Contravariant,Contravariant> inverse_metric;
+
+    derivative dg;
+    dg({1,0,0}) = 0.25f;
+    dg({1,2,2}) = 4;
+    dg({2,3,3}) = -1.5f;
+    connection c;
+    c({1,0,0}) = 2;
+    c({2,1,2}) = 0.5f;
+    c({2,2,1}) = 0.5f;
+    inverse_metric inv;
+    for(size_t i = 0; i < inv.size(); ++i) inv[i] = float(i % 5) - 2;
+
+    auto sdg = sparse(dg);
+    SparseTensor<float,4,Contravariant,Covariant,Covariant> sc(c);
+    ASSERT_EQ(sdg.nonzeros(), 3u);
+    ASSERT_EQ(sdg.dense(), dg);
+    ASSERT_EQ(sdg({1,2,2}), 4);
+    ASSERT_EQ(sdg.indices(1), (std::array<size_t,3>{ 1, 2, 2 }));
+    static_assert(std::is_same_v<decltype(sdg)::offset_type, uint8_t>);
+
+    // set keeps the nonzero list in step
+    sdg.set({3,3,3}, 1);
+    sdg.set({1,0,0}, 0);
+    ASSERT_EQ(sdg.nonzeros(), 3u);
+    ASSERT_EQ(sdg.indices(0), (std::array<size_t,3>{ 1, 2, 2 }));
+    ASSERT_EQ(sdg.indices(2), (std::array<size_t,3>{ 3, 3, 3 }));
+    dg({3,3,3}) = 1;
+    dg({1,0,0}) = 0;
+    ASSERT_EQ(sdg.dense(), dg);
+    ASSERT_THROW(sdg.set(size_t(64), 1.f), std::out_of_range);
+
+    // contractions agree with the dense ones
+    ASSERT_EQ((multiply_and_contract<0,3>(sc, sdg)), (c.multiplyAndContract<0,3>(dg)));
+    ASSERT_EQ((multiply_and_contract<0,4>(sc, sdg)), (c.multiplyAndContract<0,4>(dg)));
+    ASSERT_EQ((multiply_and_contract<2,3>(sc, inv)), (c.multiplyAndContract<2,3>(inv)));
+    ASSERT_EQ((multiply_and_contract<1,4>(sdg, inv)), (dg.multiplyAndContract<1,4>(inv)));
+    ASSERT_EQ((contract<0,2>(sc)), (c.contract<0,2>()));
+}
+
+TEST(TensorTest, Constexpr) {
+    typedef Tensor<float,4,Covariant,Covariant> metric;
+
+    // constants and their contractions fold at compile time
+    constexpr metric eta = minkowski<float>();
+    static_assert(eta({0,0}) == -1 && eta({2,2}) == 1 && eta({1,2}) == 0);
+    constexpr auto delta = eta.multiplyAndContract<1,2>(inverse_minkowski<float>());
+    static_assert(delta == kronecker_delta<float,4,Covariant,Contravariant>());
+    static_assert(kronecker_delta<float,4>().contract<0,1>()[0] == 4);
+
+    // arithmetic, expressions and products
+    constexpr metric twice = eta * 2.f - eta + eta;
+    static_assert(twice.unchecked(3,3) == 2);
+    constexpr auto sum = [] {
+        metric m = minkowski<float>();
+        m += minkowski<float>();
+        m *= 0.25f;
+        return m;
+    }();
+    static_assert(sum({1,1}) == 0.5f);
+    constexpr auto outer = eta * Tensor<float,4,Contravariant>(std::array<float,4>{ 1, 2, 3, 4 });
+    static_assert(outer.unchecked(1,1,3) == 4);
+    static_assert(Tensor<float,4,Covariant>(std::array<float,4>{ 1, 2, 4, 8 }).invert()[3] == 0.125f);
+
+    // the runtime path gives the same results
+    metric flat;
+    flat({0,0}) = -1;
+    for(size_t a = 1; a < 4; ++a) flat({a,a}) = 1;
+    ASSERT_EQ(flat, eta);
+    ASSERT_EQ((flat.multiplyAndContract<1,2>(inverse_minkowski<float>())), delta);
+}
+
+TEST(TensorTest, ReducedPrecision) {
+    // exact values, rounding to nearest even and the edges of the fp16 range
+    static_assert(to_fp16(1.f).bits == 0x3c00);
+    static_assert(to_fp16(-2.f).bits == 0xc000);
+    static_assert(to_fp16(65504.f).bits == 0x7bff);
+    static_assert(to_fp16(65520.f).bits == 0x7c00);
+    static_assert(to_fp16(1.f + 0x1p-11f).bits == 0x3c00);                // tie, rounds to even
+    static_assert(to_fp16(1.f + 3 * 0x1p-11f).bits == 0x3c02);            // tie, rounds to even
+    static_assert(to_fp16(0x1p-24f).bits == 0x0001);                      // smallest subnormal
+    static_assert(to_float(fp16{ 0x0001 }) == 0x1p-24f);
+    static_assert(to_float(to_fp16(0.1f)) == 0.0999755859375f);
+    static_assert(to_bf16(1.f).bits == 0x3f80);
+    static_assert(to_float(to_bf16(1.f + 0x1p-8f)) == 1.f);                // tie, rounds to even
+    static_assert(to_float(to_bf16(1.f + 3 * 0x1p-8f)) == 1.f + 0x1p-6f);
+
+    // every implementation matches the scalar conversion bit for bit
+    std::mt19937 rng(3);
+    std::vector<float> values = { 0.f, -0.f, 1e-8f, -3e-6f, 6.1e-5f, 65504.f, 7e4f, 1e30f,
+                                  std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity() };
+    std::uniform_real_distribution<float> exponent(-30, 20);
+    while(values.size() < 1003) {
+        values.push_back(std::ldexp(std::uniform_real_distribution<float>(-1, 1)(rng), int(exponent(rng))));
+    }
+
+    for(auto const & k : precision_implementations()) {
+        std::vector<fp16> h(values.size());
+        std::vector<bf16> b(values.size());
+        std::vector<float> back(values.size());
+        k.to_fp16(values.data(), h.data(), values.size());
+        k.to_bf16(values.data(), b.data(), values.size());
+        for(size_t i = 0; i < values.size(); ++i) {
+            ASSERT_EQ(h[i].bits, to_fp16(values[i]).bits) << k.isa << " " << values[i];
+            ASSERT_EQ(b[i].bits, to_bf16(values[i]).bits) << k.isa << " " << values[i];
+        }
+        k.from_fp16(h.data(), back.data(), values.size());
+        for(size_t i = 0; i < values.size(); ++i) ASSERT_EQ(back[i], to_float(h[i])) << k.isa;
+        k.from_bf16(b.data(), back.data(), values.size());
+        for(size_t i = 0; i < values.size(); ++i) ASSERT_EQ(back[i], to_float(b[i])) << k.isa;
+    }
+
+    fp16 nan = to_fp16(std::numeric_limits<float>::quiet_NaN());
+    ASSERT_TRUE(std::isnan(to_float(nan)));
+    ASSERT_TRUE(std::isnan(to_float(to_bf16(std::numeric_limits<float>::quiet_NaN()))));
+
+    // a compact tensor is half the size and loads back within half an ulp
+    typedef Tensor<float,4,Covariant,Covariant,Covariant> derivative;
+    static_assert(sizeof(CompactTensor<fp16,derivative>) == sizeof(derivative) / 2);
+    derivative d;
+    for(size_t i = 0; i < d.size(); ++i) d[i] = std::ldexp(float(i) + 0.3f, int(i % 9) - 4);
+    CompactTensor<fp16,derivative> h(d);
+    CompactTensor<bf16,derivative> b(d);
+    auto hd = h.load(), bd = b.load();
+    for(size_t i = 0; i < d.size(); ++i) {
+        ASSERT_LE(std::abs(hd[i] - d[i]), std::abs(d[i]) * 0x1p-11f);
+        ASSERT_LE(std::abs(bd[i] - d[i]), std::abs(d[i]) * 0x1p-8f);
+    }
+}
+
+TEST(TensorTest, Spatial) {
+    // the closed form slot of a symmetric pair agrees with the tables
+    typedef PackedGroups<3,2,2> pair3;
+    typedef PackedGroups<4,4,2,2> pairs4;
+    for(size_t i = 0; i < 3; ++i)
+    for(size_t j = 0; j < 3; ++j) {
+        ASSERT_EQ(pair3::offset({i, j}), (SymmetricGroup<3,2>::slot_of[i + 3 * j]));
+    }
+    for(size_t f = 0; f < 256; ++f) {
+        auto i = SymmetricGroup<4,4>::unflatten(f);
+        ASSERT_EQ(pairs4::offset(i), (SymmetricGroup<4,2>::slot_of[i[0] + 4 * i[1]] + 10 * SymmetricGroup<4,2>::slot_of[i[2] + 4 * i[3]]));
+    }
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> dist(-1, 1);
+
+    spatial_metric_type gamma;
+    for(size_t s = 0; s < gamma.size(); ++s) gamma[s] = 0.3 * dist(gen);
+    for(size_t i = 0; i < 3; ++i) gamma.unchecked(i, i) += 1.5;
+
+    auto inverse = invert(gamma);
+    auto dense = invert(gamma.unpack());
+    float det = determinant(gamma);
+    ASSERT_FLOAT_EQ(det, determinant(gamma.unpack()));
+    ASSERT_NEAR(det * determinant(inverse), 1.f, 1e-5);
+    for(size_t i = 0; i < 3; ++i)
+    for(size_t j = 0; j < 3; ++j) {
+        float sum = 0;
+        for(size_t k = 0; k < 3; ++k) sum += gamma.unchecked(i, k) * inverse.unchecked(k, j);
+        ASSERT_NEAR(sum, i == j, 1e-5);
+        ASSERT_FLOAT_EQ(dense.unchecked(i, j), inverse.unchecked(i, j));
+    }
+    ASSERT_EQ(invert(inverse_spatial_metric_type()), spatial_metric_type()); // singular
+
+    // a metric with lapse and shift, split and joined again
+    SpacetimeSplit split{ 1.3f, spatial_vector_type(), gamma };
+    for(size_t i = 0; i < 3; ++i) split.shift[i] = 0.2 * dist(gen);
+    auto g = join_metric(split);
+    auto again = split_metric(g);
+    ASSERT_NEAR(again.lapse, split.lapse, 1e-5);
+    for(size_t i = 0; i < 3; ++i) ASSERT_NEAR(again.shift[i], split.shift[i], 1e-5);
+    ASSERT_EQ(again.spatial_metric, gamma);
+
+    // the inverse from the split is the 4x4 inverse
+    auto inv = inverse_metric(split);
+    auto reference = invert(g);
+    for(size_t s = 0; s < inv.size(); ++s) {
+        ASSERT_NEAR(inv[s], reference[s], 1e-5);
+    }
+
+    // flat space in these coordinates has unit lapse and no shift
+    auto flat = split_metric(PackedTensor<float,4,symmetry<2>,Covariant,Covariant>(minkowski<float>()));
+    ASSERT_EQ(flat.lapse, 1.f);
+    ASSERT_EQ(flat.shift, spatial_vector_type());
+}
+
+TEST(TensorTest, RaiseLower) {
+    typedef Tensor<double,4,Covariant,Contravariant,Covariant> mixed;
+
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> dist(-1, 1);
+
+    PackedTensor<double,4,symmetry<2>,Covariant,Covariant> g;
+    for(size_t s = 0; s < g.size(); ++s) g[s] = 0.3 * dist(gen);
+    for(size_t i = 0; i < 4; ++i) g.unchecked(i, i) += 2;
+    auto inverse = invert(g);
+
+    mixed t;
+    for(size_t i = 0; i < t.size(); ++i) t[i] = dist(gen);
+
+    // the first index, the same as contracting with the inverse
+    auto up0 = raise<0>(t, inverse);
+    static_assert(std::is_same_v<decltype(up0), Tensor<double,4,Contravariant,Contravariant,Covariant>>);
+    auto product = inverse.unpack().multiplyAndContract<1,2>(t);
+    for(size_t i = 0; i < up0.size(); ++i) ASSERT_NEAR(up0[i], product[i], 1e-12);
+
+    // an inner index stays where it is
+    auto up2 = raise<2>(t, inverse);
+    static_assert(std::is_same_v<decltype(up2), Tensor<double,4,Covariant,Contravariant,Contravariant>>);
+    for(size_t a = 0; a < 4; ++a)
+    for(size_t b = 0; b < 4; ++b)
+    for(size_t c = 0; c < 4; ++c) {
+        double sum = 0;
+        for(size_t d = 0; d < 4; ++d) sum += inverse.unchecked(c, d) * t.unchecked(a, b, d);
+        ASSERT_NEAR(up2.unchecked(a, b, c), sum, 1e-12);
+    }
+
+    // a dense metric gives the same result, and lowering undoes raising
+    ASSERT_EQ(raise<2>(t, inverse.unpack()), up2);
+    auto down = lower<2>(up2, g);
+    static_assert(std::is_same_v<decltype(down), mixed>);
+    for(size_t i = 0; i < t.size(); ++i) ASSERT_NEAR(down[i], t[i], 1e-12);
+    auto lowered = lower<1>(t, g);
+    static_assert(std::is_same_v<decltype(lowered), Tensor<double,4,Covariant,Covariant,Covariant>>);
+    for(size_t i = 0; i < t.size(); ++i) ASSERT_NEAR(raise<1>(lowered, inverse)[i], t[i], 1e-12);
+
+    // several indices in one call are the passes one after the other
+    auto both = raise<0,2>(t, inverse);
+    static_assert(std::is_same_v<decltype(both), Tensor<double,4,Contravariant,Contravariant,Contravariant>>);
+    ASSERT_EQ(both, raise<2>(raise<0>(t, inverse), inverse));
+
+    // and a vector agrees with the linalg4 kernels
+    Tensor<float,4,Covariant> v({ 1.f, -2.f, 0.5f, 3.f });
+    Tensor<float,4,Contravariant,Contravariant> finverse;
+    for(size_t i = 0; i < 16; ++i) finverse[i] = float(inverse.unchecked(i % 4, i / 4));
+    auto expected = raise(v, finverse);
+    auto raised = raise<0>(v, finverse);
+    for(size_t i = 0; i < 4; ++i) ASSERT_FLOAT_EQ(raised[i], expected[i]);
+}
+
+TEST(TensorTest, EinsumCodegen) {
+    Tensor<float,4,Contravariant,Contravariant> inverse;
+    Tensor<float,4,Covariant,Covariant> metric;
+    Tensor<double,4,Contravariant,Covariant> m;
+
+    // small products unroll into one sum per element, with the offsets of Tensor storage
+    auto product = einsum_source<"ab,bc->ac">("inverse_product", inverse, metric);
+    EXPECT_NE(product.find("void inverse_product(global const float * restrict a0, global const float * restrict a1, "
+                           "global float * restrict out) {\n"), std::string::npos) << product;
+    EXPECT_NE(product.find("    out[5] = a0[1] * a1[4] + a0[5] * a1[5] + a0[9] * a1[6] + a0[13] * a1[7];\n"),
+              std::string::npos) << product;
+    EXPECT_NE(product.find("    inverse_product(a0 + 16 * i, a1 + 16 * i, out + 16 * i);\n"), std::string::npos) << product;
+
+    // larger ones keep their loops, with the strides folded in
+    EinsumCodegenOptions loops{ EinsumLanguage::cpp, 0 };
+    auto trace = einsum_source<"aa->">("trace", loops, m);
+    EXPECT_NE(trace.find("inline void trace(const double * __restrict a0, double * __restrict out) {\n"), std::string::npos) << trace;
+    EXPECT_NE(trace.find("sum += a0[s0 * 5];\n"), std::string::npos) << trace;
+    EXPECT_EQ(trace.find("kernel"), std::string::npos) << trace;
+
+    auto outer = einsum_source<"ab,cd->abcd">("outer", loops, inverse, metric);
+    EXPECT_NE(outer.find("sum += a0[i0 + i1 * 4] * a1[i2 + i3 * 4];\n"), std::string::npos) << outer;
+    EXPECT_NE(outer.find("out[i0 + i1 * 4 + i2 * 16 + i3 * 64] = sum;\n"), std::string::npos) << outer;
+
+    // double needs the extension on the device
+    EXPECT_EQ(einsum_source<"aa->">("trace", m).rfind("#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n", 0), 0u);
+}
+
+TEST(TensorTest, EinsumGenerated) {
+    // the C++ einsum_generate wrote for these types computes what einsum does
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    auto fill = [&](auto & t) {
+        for(size_t i = 0; i < t.size(); ++i) t[i] = dist(gen);
+    };
+    auto expect_near = [](auto const & generated, auto const & expected, double tolerance) {
+        for(size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_NEAR(generated[i], expected[i], tolerance * (1 + std::abs(expected[i]))) << i;
+        }
+    };
+
+    for(int round = 0; round < 8; ++round) {
+        Tensor<float,4,Contravariant,Contravariant> inverse;
+        Tensor<float,4,Covariant,Covariant> metric;
+        Tensor<float,4,Covariant,Covariant,Covariant> conn;
+        Tensor<double,4,Contravariant,Covariant> m0, m1, m2;
+        fill(inverse); fill(metric); fill(conn);
+        fill(m0); fill(m1); fill(m2);
+
+        auto product = einsum<"ab,bc->ac">(inverse, metric);
+        decltype(product) p;
+        einsum_generated::inverse_product(&inverse[0], &metric[0], &p[0]);
+        expect_near(p, product, 1e-6);
+
+        auto permuted = einsum<"ab,cbd->dac">(inverse, conn);
+        decltype(permuted) q;
+        einsum_generated::permuted(&inverse[0], &conn[0], &q[0]);
+        expect_near(q, permuted, 1e-6);
+
+        auto outer = einsum<"ab,cd->abcd">(inverse, metric);
+        decltype(outer) o;
+        einsum_generated::outer(&inverse[0], &metric[0], &o[0]);
+        expect_near(o, outer, 1e-6);
+
+        double trace = 0;
+        einsum_generated::trace(&m0[0], &trace);
+        ASSERT_NEAR(trace, (einsum<"aa->">(m0)({})), 1e-12);
+
+        auto chain = einsum<"ab,bc,cd->ad">(m0, m1, m2);
+        decltype(chain) c;
+        einsum_generated::chain(&m0[0], &m1[0], &m2[0], &c[0]);
+        expect_near(c, chain, 1e-12);
+    }
+}
@@ -0,0 +1,80 @@
+#include "trace.hpp"
+#include "block.hpp"
+
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+size_t count_occurrences(std::string const & haystack, std::string const & needle) {
+    size_t n = 0;
+    for(auto p = haystack.find(needle); p != std::string::npos; p = haystack.find(needle, p + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+TEST(TraceTest, ScopesFromManyThreads) {
+    clear_trace();
+
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([]() {
+            for(int i = 0; i < 10; i++) {
+                GRAVITATE_TRACE_SCOPE("test", "outer");
+                GRAVITATE_TRACE_SCOPE("test", "inner");
+            }
+        });
+    }
+    for(auto & t : threads) t.join();
+
+    std::stringstream ss;
+    write_chrome_trace(ss);
+    auto json = ss.str();
+
+    ASSERT_EQ(json.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0);
+    ASSERT_EQ(count_occurrences(json, "\"name\":\"outer\""), 40);
+    ASSERT_EQ(count_occurrences(json, "\"name\":\"inner\""), 40);
+    ASSERT_EQ(count_occurrences(json, "\"ph\":\"X\""), 80);
+}
+
+TEST(TraceTest, RingKeepsNewestEvents) {
+    clear_trace();
+
+    std::thread([]() {
+        for(size_t i = 0; i < TraceBuffer::capacity + 10; i++) {
+            GRAVITATE_TRACE_SCOPE("test", "wrap");
+        }
+    }).join();
+
+    std::stringstream ss;
+    write_chrome_trace(ss);
+
+    ASSERT_EQ(count_occurrences(ss.str(), "\"name\":\"wrap\""), TraceBuffer::capacity);
+}
+
+TEST(TraceTest, BlockStorageSpans) {
+    auto path = std::filesystem::temp_directory_path() / "trace_test.blk";
+    std::filesystem::remove(path);
+    clear_trace();
+
+    {
+        BlockStorage<int,int> blocks(path, 1);
+        *blocks.get(0) = 1;
+        *blocks.get(1) = 2;
+    }
+    std::filesystem::remove(path);
+
+    std::stringstream ss;
+    write_chrome_trace(ss);
+    auto json = ss.str();
+
+    ASSERT_EQ(count_occurrences(json, "\"name\":\"get\""), 2);
+    ASSERT_EQ(count_occurrences(json, "\"name\":\"grow_index\""), 2);
+    ASSERT_EQ(count_occurrences(json, "\"name\":\"save_one\""), 2);
+    ASSERT_GE(count_occurrences(json, "\"name\":\"increase_storage\""), 1);
+}